@@ -0,0 +1,311 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <MPFDParser-1.1.1/Parser.h>
+
+#include "nex_arena.h"
+#include "nex_benchmark.h"
+#include "nex_inference_engine.h"
+#include "nex_stub_detector.h"
+
+namespace NexIE = NexInferenceEngine;
+namespace NexBench = NexBenchmark;
+
+static const char help_message[] = "Display this help and exit";
+static const char filter_message[] = "Run only the benchmarks whose name contains this";
+static const char time_message[] = "Minimum seconds each benchmark runs for (default: 0.5)";
+static const char output_message[] = "Also write the results as JSON to this file";
+
+DEFINE_bool  (h, false,      help_message);
+DEFINE_string(filter, "",    filter_message);
+DEFINE_double(min_time, 0.5, time_message);
+DEFINE_string(o, "",         output_message);
+
+static void show_usage() {
+    std::cout << std::endl;
+    std::cout << "nextfodie-bench [OPTION]" << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << std::endl;
+    std::cout << "    -h                  " << help_message << std::endl;
+    std::cout << "    -filter <string>    " << filter_message << std::endl;
+    std::cout << "    -min_time <double>  " << time_message << std::endl;
+    std::cout << "    -o <string>         " << output_message << std::endl;
+    std::cout << std::endl;
+}
+
+static const int camera_sizes[][2] = {{640, 480}, {1280, 720}, {1920, 1080}};
+static const int input_size = 300;      // SSD input
+
+static std::string size_name(int w, int h) {
+    return std::to_string(w) + "x" + std::to_string(h);
+}
+
+static std::string byte_name(size_t bytes) {
+    return (bytes >= 1024 * 1024)? std::to_string(bytes / (1024 * 1024)) + "M" : std::to_string(bytes / 1024) + "K";
+}
+
+// A frame that compresses like a camera picture rather than like noise: smooth gradients,
+// flat blocks with edges and a little sensor noise
+static cv::Mat synthetic_frame(int w, int h) {
+    cv::Mat img(h, w, CV_8UC3);
+    uint32_t state = 12345;
+    for (int y = 0; y < h; y++) {
+        uint8_t *row = img.ptr<uint8_t>(y);
+        for (int x = 0; x < w; x++) {
+            state = state * 1664525u + 1013904223u;
+            int noise = (int)(state >> 29) - 4;
+            int block = (((x / 97) ^ (y / 61)) & 3) * 40;
+            for (int c = 0; c < 3; c++) {
+                int value = (x * (c + 1) * 255 / w + y * (3 - c) * 255 / h) / 3 + block + noise;
+                row[x * 3 + c] = (uint8_t)std::min(255, std::max(0, value));
+            }
+        }
+    }
+    return img;
+}
+
+// A multipart body with one image field of the given size, like the one POST /inference gets
+static const char bench_boundary[] = "----nextfodie-bench";
+
+static std::string multipart_body(size_t image_size, const std::string &boundary) {
+    std::string body = "--" + boundary + "\r\nContent-Disposition: form-data; name=\"threshold\"\r\n\r\n0.5\r\n";
+    body += "--" + boundary + "\r\nContent-Disposition: form-data; name=\"image\"; filename=\"frame.jpg\"\r\n"
+            "Content-Type: image/jpeg\r\n\r\n";
+    uint32_t state = 1;
+    for (size_t idx = 0; idx < image_size; idx++) {
+        state = state * 1664525u + 1013904223u;
+        char byte = (char)(state >> 24);
+        // Keep the boundary from showing up in the image by chance
+        body.push_back((byte == '-')? '+' : byte);
+    }
+    body += "\r\n--" + boundary + "--\r\n";
+    return body;
+}
+
+class ArenaMemory : public MPFD::Allocator {
+private:
+    NexIE::Arena::Ptr arena;
+
+public:
+    ArenaMemory(): arena(NexIE::Arena::acquire()) {};
+
+    void *Allocate(size_t size) {return this->arena->allocate(size);};
+    void *Reallocate(void *data, size_t old_size, size_t size) {return this->arena->reallocate(data, old_size, size);};
+    void Free(void *, size_t) {};
+};
+
+static void parse_multipart(MPFD::Parser &parser, const std::string &body, size_t chunk_size) {
+    parser.SetUploadedFilesStorage(MPFD::Parser::StoreUploadedFilesInMemory);
+    parser.SetMaxCollectedDataLength(std::numeric_limits<long>::max());
+    parser.SetContentType("multipart/form-data; boundary=" + std::string(bench_boundary));
+    for (size_t pos = 0; pos < body.size(); pos += chunk_size) {
+        parser.AcceptSomeData(body.data() + pos, (long)std::min(chunk_size, body.size() - pos));
+    }
+    auto &fields = parser.GetFieldsMap();
+    NexBench::keep(fields);
+}
+
+static void add_parser_benchmarks(NexBench::Suite &suite) {
+    static const size_t body_sizes[] = {64 * 1024, 1024 * 1024, 8 * 1024 * 1024};
+    static const size_t chunk_sizes[] = {4 * 1024, 16 * 1024, 64 * 1024, 1024 * 1024};
+    for (size_t body_size : body_sizes) {
+        auto body = std::make_shared<std::string>(multipart_body(body_size, bench_boundary));
+        for (size_t chunk_size : chunk_sizes) {
+            if (chunk_size > body_size) {
+                continue;
+            }
+            suite.add("mpfd/" + byte_name(body_size) + "/chunk_" + byte_name(chunk_size), (double)body->size(),
+                      [body, chunk_size]() {
+                MPFD::Parser parser;
+                parse_multipart(parser, *body, chunk_size);
+            });
+            // As the server parses inference requests, into a recycled arena
+            suite.add("mpfd/" + byte_name(body_size) + "/chunk_" + byte_name(chunk_size) + "/arena",
+                      (double)body->size(), [body, chunk_size]() {
+                ArenaMemory memory;
+                MPFD::Parser parser;
+                parser.SetAllocator(&memory);
+                parse_multipart(parser, *body, chunk_size);
+            });
+        }
+    }
+}
+
+static void add_decode_benchmarks(NexBench::Suite &suite, std::shared_ptr<NexIE::Detector> detector) {
+    static const char *formats[] = {".jpg", ".png"};
+    for (auto &size : camera_sizes) {
+        cv::Mat frame = synthetic_frame(size[0], size[1]);
+        for (const char *format : formats) {
+            auto encoded = std::make_shared<std::vector<uchar>>();
+            cv::imencode(format, frame, *encoded);
+            std::string name = std::string("decode/") + (format + 1) + "/" + size_name(size[0], size[1]);
+            suite.add(name, (double)encoded->size(), [detector, encoded]() {
+                auto img = detector->openImage((char*)encoded->data(), encoded->size());
+                NexBench::keep(img);
+            });
+        }
+    }
+}
+
+// The part of infer() before the network runs: letterbox to the input, then HWC to the
+// planar CHW blob, or both in one pass for uncompressed frames
+static void add_preprocess_benchmarks(NexBench::Suite &suite) {
+    auto network = std::make_shared<NexIE::Network>();
+    network->input_w = input_size;
+    network->input_h = input_size;
+    network->input_ch = 3;
+    auto storage = std::make_shared<std::vector<uint8_t>>((size_t)3 * input_size * input_size);
+    TensorDesc desc(Precision::U8, {1, 3, (size_t)input_size, (size_t)input_size}, Layout::NCHW);
+    network->input_blobs.push_back(make_shared_blob<uint8_t>(desc, storage->data(), storage->size()));
+
+    for (auto &size : camera_sizes) {
+        auto frame = std::make_shared<cv::Mat>(synthetic_frame(size[0], size[1]));
+        std::string name = size_name(size[0], size[1]);
+        suite.add("preprocess/letterbox/" + name, 0, [network, frame]() {
+            cv::Mat resized;
+            auto letterbox = network->letterbox(*frame, resized);
+            NexBench::keep(letterbox);
+            NexBench::keep(resized);
+        });
+        suite.add("preprocess/letterbox_fill/" + name, 0, [network, frame, storage]() {
+            cv::Mat resized;
+            network->letterbox(*frame, resized);
+            network->fillBlob(0, resized);
+            NexBench::keep(*storage);
+        });
+        // The same frame uncompressed, scaled and converted on its way into the blob
+        auto pixels = std::make_shared<std::vector<uint8_t>>(frame->data, frame->data + frame->total() * 3);
+        for (auto format : {NexIE::PIXEL_BGR, NexIE::PIXEL_NV12}) {
+            NexIE::RawImage image;
+            image.format = format;
+            image.width = size[0];
+            image.height = size[1];
+            image.data = pixels->data();
+            image.size = pixels->size();
+            image.validate();
+            suite.add("preprocess/raw_fill/" + std::string(NexIE::pixel_format_name(format)) + "/" + name, 0,
+                      [network, pixels, image, storage]() {
+                auto letterbox = NexIE::make_letterbox(image.width, image.height, network->input_w, network->input_h);
+                network->fillBlob(0, image, letterbox);
+                NexBench::keep(*storage);
+            });
+        }
+    }
+    auto resized = std::make_shared<cv::Mat>(synthetic_frame(input_size, input_size));
+    suite.add("preprocess/fill_blob/" + size_name(input_size, input_size), 0, [network, resized, storage]() {
+        network->fillBlob(0, *resized);
+        NexBench::keep(*storage);
+    });
+}
+
+// parse() and pack() over SSD output with the given number of detections above threshold
+static void add_postprocess_benchmarks(NexBench::Suite &suite, std::shared_ptr<NexIE::Detector> detector) {
+    static const int detection_counts[] = {0, 10, 100, 200};
+    auto network = std::make_shared<NexIE::NetworkShape>();
+    network->input_w = input_size;
+    network->input_h = input_size;
+    network->input_ch = 3;
+    network->object_size = 7;
+    network->max_output_count = 200;
+    auto model = std::make_shared<NexIE::Model>();
+    model->network = network;
+    model->version = 1;
+
+    for (int count : detection_counts) {
+        auto detections = std::make_shared<NexIE::Detections>();
+        detections->model = model;
+        detections->letterbox = NexIE::make_letterbox(1920, 1080, input_size, input_size);
+        detections->data.assign((size_t)network->max_output_count * network->object_size, 0);
+        for (int obj = 0; obj < count; obj++) {
+            float *row = &detections->data[obj * network->object_size];
+            row[1] = (float)(1 + obj % 90);
+            row[2] = 0.6f + 0.4f * obj / network->max_output_count;
+            row[3] = 0.1f + 0.002f * obj;
+            row[4] = 0.2f + 0.001f * obj;
+            row[5] = row[3] + 0.3f;
+            row[6] = row[4] + 0.4f;
+        }
+        if (count < network->max_output_count) {
+            detections->data[count * network->object_size] = -1;
+        }
+
+        auto buffer = std::make_shared<std::string>();
+        suite.add("postprocess/parse/" + std::to_string(count), 0, [detector, detections, buffer]() {
+            detector->parse(*detections, *buffer);
+            NexBench::keep(*buffer);
+        });
+        suite.add("postprocess/pack/" + std::to_string(count), 0, [detector, detections, buffer]() {
+            detector->pack(*detections, *buffer);
+            NexBench::keep(*buffer);
+        });
+    }
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        gflags::ParseCommandLineNonHelpFlags(&argc, &argv, true);
+        if (FLAGS_h) {
+            show_usage();
+            return 0;
+        }
+        if (FLAGS_min_time <= 0) {
+            throw std::logic_error("Parameter -min_time must be positive");
+        }
+
+        // Image decode and formatting are the same on every backend, the stub needs no model
+        std::shared_ptr<NexIE::Detector> detector = std::make_shared<NexIE::StubDetector>("fixed:0");
+        NexBench::Suite suite;
+        add_parser_benchmarks(suite);
+        add_decode_benchmarks(suite, detector);
+        add_preprocess_benchmarks(suite);
+        add_postprocess_benchmarks(suite, detector);
+
+        auto results = suite.run(FLAGS_filter, FLAGS_min_time, std::cerr);
+        NexBench::print_results(results, std::cout);
+        if (!FLAGS_o.empty()) {
+            std::ofstream fp(FLAGS_o);
+            fp << NexBench::results_json(results).serialize() << std::endl;
+            if (!fp) {
+                throw std::logic_error("Cannot write " + FLAGS_o);
+            }
+        }
+    }
+    catch (std::exception const &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,108 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <ostream>
+
+#include "nex_benchmark.h"
+
+namespace NexBenchmark {
+
+void Suite::add(const std::string &name, double bytes, std::function<void()> run) {
+    Case item;
+    item.name = name;
+    item.bytes = bytes;
+    item.run = run;
+    this->cases.push_back(item);
+}
+
+std::vector<Result> Suite::run(const std::string &filter, double min_time_s, std::ostream &log) {
+    typedef std::chrono::steady_clock clock;
+    std::vector<Result> results;
+    for (auto &item : this->cases) {
+        if (!filter.empty() && (item.name.find(filter) == std::string::npos)) {
+            continue;
+        }
+        log << item.name << "..." << std::flush;
+        item.run();     // warm up caches and lazily allocated buffers
+
+        uint64_t iterations = 1;
+        double elapsed_s = 0;
+        while (true) {
+            auto start = clock::now();
+            for (uint64_t idx = 0; idx < iterations; idx++) {
+                item.run();
+            }
+            elapsed_s = std::chrono::duration<double>(clock::now() - start).count();
+            if (elapsed_s >= min_time_s) {
+                break;
+            }
+            // Aim past the minimum time with the next batch, growing at most 10 times
+            double scale = (elapsed_s > 0)? 1.4 * min_time_s / elapsed_s : 10;
+            iterations = std::max<uint64_t>(iterations + 1, (uint64_t)(iterations * std::min(10.0, scale)));
+        }
+
+        Result result;
+        result.name = item.name;
+        result.iterations = iterations;
+        result.ns_per_op = elapsed_s * 1e9 / iterations;
+        result.bytes_per_op = item.bytes;
+        results.push_back(result);
+        log << " done" << std::endl;
+    }
+    return results;
+}
+
+void print_results(const std::vector<Result> &results, std::ostream &stream) {
+    stream << std::left << std::setw(40) << "benchmark" << std::right << std::setw(12) << "iterations"
+           << std::setw(14) << "us/op" << std::setw(12) << "MB/s" << std::endl;
+    for (auto &result : results) {
+        stream << std::left << std::setw(40) << result.name << std::right << std::setw(12) << result.iterations
+               << std::setw(14) << std::fixed << std::setprecision(3) << result.ns_per_op / 1000.0;
+        if (result.bytes_per_op > 0) {
+            stream << std::setw(12) << std::setprecision(1) << result.bytes_per_op * 1000.0 / result.ns_per_op;
+        }
+        stream << std::endl;
+    }
+}
+
+web::json::value results_json(const std::vector<Result> &results) {
+    web::json::value jsn = web::json::value::array(results.size());
+    for (size_t idx = 0; idx < results.size(); idx++) {
+        auto &result = results[idx];
+        web::json::value &item = jsn[idx];
+        item["name"] = web::json::value::string(result.name);
+        item["iterations"] = web::json::value::number(result.iterations);
+        item["ns_per_op"] = web::json::value::number(result.ns_per_op);
+        if (result.bytes_per_op > 0) {
+            item["mb_per_s"] = web::json::value::number(result.bytes_per_op * 1000.0 / result.ns_per_op);
+        }
+    }
+    return jsn;
+}
+
+} // namespace NexBenchmark
@@ -0,0 +1,71 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include <cpprest/json.h>
+
+namespace NexBenchmark {
+
+// Keep the compiler from dropping a result nobody reads
+template<class T>
+inline void keep(T const &value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+struct Result {
+    std::string name;
+    uint64_t iterations;
+    double ns_per_op;
+    double bytes_per_op;    // 0 when the case has no natural size
+};
+
+// Cases run one after another, each repeated in growing batches until a batch lasts at
+// least the minimum time, whose time per iteration is reported
+class Suite {
+private:
+    struct Case {
+        std::string name;
+        double bytes;
+        std::function<void()> run;
+    };
+
+    std::vector<Case> cases;
+
+public:
+    void add(const std::string &name, double bytes, std::function<void()> run);
+    // Cases whose name contains filter, all when it is empty
+    std::vector<Result> run(const std::string &filter, double min_time_s, std::ostream &log);
+};
+
+void print_results(const std::vector<Result> &results, std::ostream &stream);
+web::json::value results_json(const std::vector<Result> &results);
+
+} // namespace NexBenchmark
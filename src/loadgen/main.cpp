@@ -0,0 +1,370 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <dirent.h>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cpprest/http_client.h>
+#include <cpprest/json.h>
+#include <cpprest/rawptrstream.h>
+#include <gflags/gflags.h>
+
+#include "nex_histogram.h"
+
+using namespace web;
+using namespace web::http;
+using namespace web::http::client;
+
+typedef std::chrono::steady_clock clock_type;
+
+static const char help_message[] = "Display this help and exit";
+static const char url_message[] = "Server URL (default: http://localhost:30303)";
+static const char path_message[] = "Request path (default: /inference)";
+static const char images_message[] = "Directory of images to send, in turn";
+static const char rate_message[] = "Requests per second offered, whatever the responses (default: 10)";
+static const char arrival_message[] = "Arrivals, poisson or constant (default: poisson)";
+static const char duration_message[] = "Seconds to offer load for (default: 30)";
+static const char warmup_message[] = "Seconds of load before recording starts (default: 0)";
+static const char connections_message[] = "Number of HTTP clients the requests are spread over (default: 16)";
+static const char fields_message[] = "Extra form fields as name=value, separated by '&'";
+static const char header_message[] = "Extra request headers as name:value, separated by ';'";
+static const char timeout_message[] = "Seconds before a request is counted as failed (default: 30)";
+static const char seed_message[] = "Seed of the arrival times (default: 1)";
+static const char output_message[] = "Write the JSON report to this file (default: standard output)";
+
+DEFINE_bool  (h, false,           help_message);
+DEFINE_string(url, "http://localhost:30303", url_message);
+DEFINE_string(path, "/inference", path_message);
+DEFINE_string(images, "",         images_message);
+DEFINE_double(rate, 10,           rate_message);
+DEFINE_string(arrival, "poisson", arrival_message);
+DEFINE_double(duration, 30,       duration_message);
+DEFINE_double(warmup, 0,          warmup_message);
+DEFINE_int32 (connections, 16,    connections_message);
+DEFINE_string(fields, "",         fields_message);
+DEFINE_string(header, "",         header_message);
+DEFINE_int32 (timeout, 30,        timeout_message);
+DEFINE_int32 (seed, 1,            seed_message);
+DEFINE_string(o, "",              output_message);
+
+static void show_usage() {
+    std::cout << std::endl;
+    std::cout << "nextfodie-loadgen [OPTION]" << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << std::endl;
+    std::cout << "    -h                  " << help_message << std::endl;
+    std::cout << "    -url <string>       " << url_message << std::endl;
+    std::cout << "    -path <string>      " << path_message << std::endl;
+    std::cout << "    -images <string>    " << images_message << std::endl;
+    std::cout << "    -rate <double>      " << rate_message << std::endl;
+    std::cout << "    -arrival <string>   " << arrival_message << std::endl;
+    std::cout << "    -duration <double>  " << duration_message << std::endl;
+    std::cout << "    -warmup <double>    " << warmup_message << std::endl;
+    std::cout << "    -connections <int>  " << connections_message << std::endl;
+    std::cout << "    -fields <string>    " << fields_message << std::endl;
+    std::cout << "    -header <string>    " << header_message << std::endl;
+    std::cout << "    -timeout <int>      " << timeout_message << std::endl;
+    std::cout << "    -seed <int>         " << seed_message << std::endl;
+    std::cout << "    -o <string>         " << output_message << std::endl;
+    std::cout << std::endl;
+}
+
+static bool parse_cli(int argc, char *argv[]) {
+    gflags::ParseCommandLineNonHelpFlags(&argc, &argv, true);
+    if (FLAGS_h) {
+        show_usage();
+        return false;
+    }
+    if (FLAGS_images.empty()) {
+        throw std::logic_error("Parameter -images is required");
+    }
+    if (FLAGS_rate <= 0) {
+        throw std::logic_error("Parameter -rate must be positive");
+    }
+    if ((FLAGS_arrival != "poisson") && (FLAGS_arrival != "constant")) {
+        throw std::logic_error("Parameter -arrival must be poisson or constant");
+    }
+    if ((FLAGS_duration <= 0) || (FLAGS_warmup < 0)) {
+        throw std::logic_error("Parameter -duration must be positive and -warmup not negative");
+    }
+    if (FLAGS_connections < 1) {
+        throw std::logic_error("Parameter -connections must be at least 1");
+    }
+    return true;
+}
+
+// One image ready to send: the whole body, built once and sent from memory every time
+struct Payload {
+    std::string name;
+    std::vector<uint8_t> body;
+    std::string content_type;
+};
+
+static std::vector<char> read_file(const std::string &path) {
+    std::ifstream fp(path, std::ifstream::binary);
+    if (!fp) {
+        throw std::logic_error("Cannot open " + path);
+    }
+    return std::vector<char>((std::istreambuf_iterator<char>(fp)), std::istreambuf_iterator<char>());
+}
+
+static void append(std::vector<uint8_t> &body, const std::string &text) {
+    body.insert(body.end(), text.begin(), text.end());
+}
+
+static std::vector<Payload> load_payloads(const std::string &dir) {
+    static const char boundary[] = "nextfodie-loadgen-boundary";
+    std::vector<std::string> names;
+    DIR *handle = opendir(dir.c_str());
+    if (handle == NULL) {
+        throw std::logic_error("Cannot open directory " + dir);
+    }
+    while (struct dirent *entry = readdir(handle)) {
+        std::string name = entry->d_name;
+        auto pos = name.rfind('.');
+        std::string ext = (pos == std::string::npos)? "" : name.substr(pos + 1);
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        if ((ext == "jpg") || (ext == "jpeg") || (ext == "png") || (ext == "bmp")) {
+            names.push_back(name);
+        }
+    }
+    closedir(handle);
+    std::sort(names.begin(), names.end());
+    if (names.empty()) {
+        throw std::logic_error("No images (.jpg, .png, .bmp) in " + dir);
+    }
+
+    std::vector<Payload> payloads;
+    for (auto &name : names) {
+        Payload payload;
+        payload.name = name;
+        auto image = read_file(dir + "/" + name);
+        std::istringstream fields(FLAGS_fields);
+        std::string field;
+        while (std::getline(fields, field, '&')) {
+            auto pos = field.find('=');
+            if (pos == std::string::npos) {
+                continue;
+            }
+            append(payload.body, std::string("--") + boundary + "\r\nContent-Disposition: form-data; name=\"" +
+                   field.substr(0, pos) + "\"\r\n\r\n" + field.substr(pos + 1) + "\r\n");
+        }
+        append(payload.body, std::string("--") + boundary + "\r\nContent-Disposition: form-data; name=\"image\"; filename=\"" +
+               name + "\"\r\nContent-Type: application/octet-stream\r\n\r\n");
+        payload.body.insert(payload.body.end(), image.begin(), image.end());
+        append(payload.body, std::string("\r\n--") + boundary + "--\r\n");
+        payload.content_type = std::string("multipart/form-data; boundary=") + boundary;
+        payloads.push_back(std::move(payload));
+    }
+    return payloads;
+}
+
+// Outcome of the recorded requests. Latency runs from the time a request was due, not
+// from when it was sent, so that a stalled client does not hide the wait of the requests
+// behind it (coordinated omission); service time runs from when it was sent. Every recorded
+// request counts in latency, whether it failed, timed out or was never answered, since
+// those are the tail; success_latency and service only hold successful ones.
+struct Results {
+    std::mutex mutex;
+    NexLoadGen::LatencyHistogram latency;
+    NexLoadGen::LatencyHistogram success_latency;
+    NexLoadGen::LatencyHistogram service;
+    std::map<int, uint64_t> statuses;
+    std::map<uint64_t, clock_type::time_point> unanswered;     // due time of recorded requests by id
+    uint64_t sent = 0;
+    uint64_t completed = 0;
+    uint64_t failed = 0;        // no response
+    uint64_t late = 0;          // sent over 1mS after it was due
+    bool closed = false;        // reported, later responses are not counted
+    std::atomic<int> outstanding;
+
+    Results(): outstanding(0) {};
+};
+
+static uint64_t elapsed_us(clock_type::time_point from, clock_type::time_point to) {
+    return (uint64_t)std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(to - from).count());
+}
+
+static void send_request(http_client &client, const Payload &payload, uint64_t id, clock_type::time_point due,
+                         bool record, std::shared_ptr<Results> results) {
+    http_request request(methods::POST);
+    request.set_request_uri(FLAGS_path);
+    std::istringstream headers(FLAGS_header);
+    std::string header;
+    while (std::getline(headers, header, ';')) {
+        auto pos = header.find(':');
+        if (pos != std::string::npos) {
+            request.headers().add(header.substr(0, pos), header.substr(pos + 1));
+        }
+    }
+    request.set_body(concurrency::streams::rawptr_stream<uint8_t>::open_istream(payload.body.data(), payload.body.size()),
+                     payload.body.size(), payload.content_type);
+
+    auto sent = clock_type::now();
+    results->outstanding++;
+    if (record) {
+        std::lock_guard<std::mutex> lock(results->mutex);
+        results->sent++;
+        results->late += (elapsed_us(due, sent) > 1000)? 1 : 0;
+        results->unanswered[id] = due;
+    }
+    client.request(request).then([](http_response response) {
+        // The response counts once its body is in
+        return response.content_ready();
+    }).then([id, due, sent, record, results](pplx::task<http_response> task) {
+        auto done = clock_type::now();
+        int status = -1;
+        try {
+            status = task.get().status_code();
+        }
+        catch (std::exception const &) {
+        }
+        if (record) {
+            std::lock_guard<std::mutex> lock(results->mutex);
+            if (!results->closed) {
+                // Errors and timeouts count at the time they took, a timeout near -timeout
+                results->unanswered.erase(id);
+                results->latency.record(elapsed_us(due, done));
+                if (status < 0) {
+                    results->failed++;
+                }
+                else {
+                    results->completed++;
+                    results->statuses[status]++;
+                    if ((status >= 200) && (status < 300)) {
+                        results->success_latency.record(elapsed_us(due, done));
+                        results->service.record(elapsed_us(sent, done));
+                    }
+                }
+            }
+        }
+        results->outstanding--;
+    });
+}
+
+int main(int argc, char *argv[]) {
+    try {
+        if (!parse_cli(argc, argv)) {
+            return 0;
+        }
+        auto payloads = load_payloads(FLAGS_images);
+        std::cerr << "Loaded " << payloads.size() << " images from " << FLAGS_images << std::endl;
+
+        http_client_config config;
+        config.set_timeout(std::chrono::seconds(FLAGS_timeout));
+        std::vector<std::unique_ptr<http_client>> clients;
+        for (int idx = 0; idx < FLAGS_connections; idx++) {
+            clients.emplace_back(new http_client(FLAGS_url, config));
+        }
+
+        // Open loop: requests are due at fixed or exponentially distributed intervals and go
+        // out when due, however many are still waiting for their response
+        auto results = std::make_shared<Results>();
+        std::mt19937_64 random(FLAGS_seed);
+        std::exponential_distribution<double> poisson(FLAGS_rate);
+        bool constant = (FLAGS_arrival == "constant");
+        auto start = clock_type::now();
+        auto record_from = start + std::chrono::microseconds((int64_t)(FLAGS_warmup * 1e6));
+        auto end = record_from + std::chrono::microseconds((int64_t)(FLAGS_duration * 1e6));
+        double offset_s = 0;
+        uint64_t scheduled = 0;
+        while (true) {
+            offset_s += constant? 1.0 / FLAGS_rate : poisson(random);
+            auto due = start + std::chrono::microseconds((int64_t)(offset_s * 1e6));
+            if (due >= end) {
+                break;
+            }
+            std::this_thread::sleep_until(due);
+            const Payload &payload = payloads[scheduled % payloads.size()];
+            http_client &client = *clients[scheduled % clients.size()];
+            send_request(client, payload, scheduled, due, due >= record_from, results);
+            scheduled++;
+        }
+
+        // Wait for the responses, up to the request timeout
+        auto drain_end = clock_type::now() + std::chrono::seconds(FLAGS_timeout + 1);
+        while ((results->outstanding > 0) && (clock_type::now() < drain_end)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        // Requests still unanswered count with the time they have waited so far
+        std::unique_lock<std::mutex> lock(results->mutex);
+        auto drained = clock_type::now();
+        for (auto &item : results->unanswered) {
+            results->latency.record(elapsed_us(item.second, drained));
+        }
+        results->closed = true;
+        json::value report;
+        report["config"]["url"]         = json::value::string(FLAGS_url + FLAGS_path);
+        report["config"]["images"]      = json::value::number((uint64_t)payloads.size());
+        report["config"]["arrival"]     = json::value::string(FLAGS_arrival);
+        report["config"]["rate"]        = json::value::number(FLAGS_rate);
+        report["config"]["duration"]    = json::value::number(FLAGS_duration);
+        report["config"]["warmup"]      = json::value::number(FLAGS_warmup);
+        report["config"]["connections"] = json::value::number(FLAGS_connections);
+        report["requests"]["sent"]      = json::value::number(results->sent);
+        report["requests"]["completed"] = json::value::number(results->completed);
+        report["requests"]["failed"]    = json::value::number(results->failed);
+        report["requests"]["late"]      = json::value::number(results->late);
+        report["requests"]["pending"]   = json::value::number((uint64_t)results->unanswered.size());
+        for (auto &item : results->statuses) {
+            report["requests"]["status"][std::to_string(item.first)] = json::value::number(item.second);
+        }
+        report["throughput"]["offered"]  = json::value::number(results->sent / FLAGS_duration);
+        report["throughput"]["achieved"] = json::value::number(results->success_latency.count() / FLAGS_duration);
+        report["latency_ms"]         = results->latency.toJson();
+        report["success_latency_ms"] = results->success_latency.toJson();
+        report["service_time_ms"]    = results->service.toJson();
+
+        if (FLAGS_o.empty()) {
+            std::cout << report.serialize() << std::endl;
+        }
+        else {
+            std::ofstream fp(FLAGS_o);
+            fp << report.serialize() << std::endl;
+            if (!fp) {
+                throw std::logic_error("Cannot write " + FLAGS_o);
+            }
+        }
+    }
+    catch (std::exception const &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,121 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#include <algorithm>
+#include <cmath>
+
+#include "nex_histogram.h"
+
+static const int sub_bucket_bits = 8;
+static const uint64_t sub_bucket_count = 1 << sub_bucket_bits;     // linear below this
+static const uint64_t sub_bucket_half = sub_bucket_count / 2;
+static const uint64_t max_value_us = (1ULL << 40) - 1;            // about 12 days
+
+static int highest_bit(uint64_t value) {
+    int bit = 0;
+    while (value >>= 1) {
+        bit++;
+    }
+    return bit;
+}
+
+namespace NexLoadGen {
+
+LatencyHistogram::LatencyHistogram() {
+    this->counts.assign(bucketIndex(max_value_us) + 1, 0);
+    this->total = 0;
+    this->min_value = 0;
+    this->max_value = 0;
+    this->sum = 0;
+}
+
+// Values below sub_bucket_count have a bucket each, above that a power of two has
+// sub_bucket_half buckets
+size_t LatencyHistogram::bucketIndex(uint64_t value) {
+    int shift = std::max(0, highest_bit(value | (sub_bucket_count - 1)) - (sub_bucket_bits - 1));
+    return (size_t)(shift * sub_bucket_half + (value >> shift));
+}
+
+uint64_t LatencyHistogram::highestEquivalent(size_t index) {
+    if (index < sub_bucket_count) {
+        return index;
+    }
+    int shift = (int)(index / sub_bucket_half) - 1;
+    uint64_t sub = index - shift * sub_bucket_half;
+    return ((sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t value_us) {
+    value_us = std::min(value_us, max_value_us);
+    this->counts[bucketIndex(value_us)]++;
+    this->min_value = (this->total == 0)? value_us : std::min(this->min_value, value_us);
+    this->max_value = std::max(this->max_value, value_us);
+    this->total++;
+    this->sum += (double)value_us;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other) {
+    for (size_t idx = 0; idx < this->counts.size(); idx++) {
+        this->counts[idx] += other.counts[idx];
+    }
+    if (other.total > 0) {
+        this->min_value = (this->total == 0)? other.min_value : std::min(this->min_value, other.min_value);
+        this->max_value = std::max(this->max_value, other.max_value);
+    }
+    this->total += other.total;
+    this->sum += other.sum;
+}
+
+uint64_t LatencyHistogram::percentile(double percentile) const {
+    if (this->total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)std::ceil(std::min(100.0, std::max(0.0, percentile)) / 100.0 * this->total);
+    rank = std::max<uint64_t>(1, rank);
+    uint64_t seen = 0;
+    for (size_t idx = 0; idx < this->counts.size(); idx++) {
+        seen += this->counts[idx];
+        if (seen >= rank) {
+            return std::min(highestEquivalent(idx), this->max_value);
+        }
+    }
+    return this->max_value;
+}
+
+web::json::value LatencyHistogram::toJson() const {
+    static const double percentiles[] = {50, 75, 90, 95, 99, 99.9, 99.99};
+    static const char *names[] = {"p50", "p75", "p90", "p95", "p99", "p99.9", "p99.99"};
+    web::json::value jsn;
+    jsn["count"] = web::json::value::number(this->total);
+    jsn["min"]   = web::json::value::number(this->min() / 1000.0);
+    jsn["mean"]  = web::json::value::number(this->mean() / 1000.0);
+    for (size_t idx = 0; idx < sizeof(percentiles) / sizeof(percentiles[0]); idx++) {
+        jsn[names[idx]] = web::json::value::number(this->percentile(percentiles[idx]) / 1000.0);
+    }
+    jsn["max"]   = web::json::value::number(this->max() / 1000.0);
+    return jsn;
+}
+
+} // namespace NexLoadGen
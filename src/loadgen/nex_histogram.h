@@ -0,0 +1,65 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <cpprest/json.h>
+
+namespace NexLoadGen {
+
+// Latency histogram in microseconds with log-linear buckets like HdrHistogram: every
+// power of two is split in 128 linear buckets, so that a recorded value is off by less
+// than 1% at any magnitude while the whole range up to hours takes a few thousand counters.
+class LatencyHistogram {
+private:
+    std::vector<uint64_t> counts;
+    uint64_t total;
+    uint64_t min_value;
+    uint64_t max_value;
+    double sum;
+
+    static size_t bucketIndex(uint64_t value);
+    static uint64_t highestEquivalent(size_t index);
+
+public:
+    LatencyHistogram();
+
+    void record(uint64_t value_us);
+    void merge(const LatencyHistogram &other);
+    uint64_t count() const {return this->total;};
+    // Smallest recorded value at or above the given percentile, in microseconds
+    uint64_t percentile(double percentile) const;
+    double mean() const {return (this->total > 0)? this->sum / this->total : 0;};
+    uint64_t min() const {return (this->total > 0)? this->min_value : 0;};
+    uint64_t max() const {return this->max_value;};
+
+    // min, mean, percentiles and max in milliseconds
+    web::json::value toJson() const;
+};
+
+} // namespace NexLoadGen
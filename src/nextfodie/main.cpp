@@ -26,19 +26,35 @@
 #include <cstdlib>
 #include <exception>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <sys/stat.h>
+#include <thread>
 
 #include <cpprest/http_listener.h>
 #include <gflags/gflags.h>
 
 #include "nex_inference_engine.h"
+#include "nex_model_benchmark.h"
+#include "nex_motion_gate.h"
 #include "nex_request_handler.h"
+#include "nex_request_queue.h"
+#include "nex_stub_detector.h"
+#include "nex_thread_pool.h"
+#include "nex_tracker.h"
+#include "nex_topology.h"
+#include "nex_websocket.h"
+#include "nex_workers.h"
 
 using namespace web::http::experimental::listener;
 namespace NexIE = NexInferenceEngine;
 
-NexIE::ObjectDetection *ie = NULL;
+NexIE::Detector *ie = NULL;
+NexIE::RequestQueue *queue = NULL;
+NexIE::ThreadPool *decoders = NULL;
+NexIE::MotionGate *motion = NULL;
+NexIE::StreamTrackers *trackers = NULL;
+NexIE::Worker *worker = NULL;
 
 static const char help_message[] = "Display this help and exit";
 static const char host_message[] = "Host name/IP (default: localhost)";
@@ -46,6 +62,29 @@ static const char port_message[] = "Port number (default 30303)";
 static const char device_message[] = "Specify the target device to infer on (default: CPU); CPU and GPU is acceptable.";
 static const char model_message[] = "Path to an .xml file with a trained model";
 static const char threshold_message[] = "Threshold for inference score/probability (default: 0.5)";
+static const char labelmap_message[] = "Path to a labelmap (.pbtxt or one class name per line)";
+static const char class_thresholds_message[] = "Per-class thresholds as class:threshold, separated by ',' (class id or labelmap name)";
+static const char decoders_message[] = "Number of threads decoding images ahead of inference (default: 2)";
+static const char motion_message[] = "Share of changed pixels below which a frame with a stream_id reuses the detections of its stream (default: 0.005, 0 to always infer)";
+static const char streams_message[] = "Number of streams (stream_id) the motion gate and the tracker remember (default: 256)";
+static const char ws_port_message[] = "Port of the WebSocket endpoint /inference/stream for streaming frames (default: 0, disabled)";
+static const char inflight_message[] = "Frames of a WebSocket stream in the pipeline at once, unless the stream asks otherwise (default: 2)";
+static const char video_dir_message[] = "Directory whose files POST /inference/video may read by path (default: none, uploads only)";
+static const char workers_message[] = "Number of worker processes sharing the port, each on its own CPUs (default: 0, no workers)";
+static const char io_cpus_message[] = "CPUs for HTTP I/O and decode, as 0-3,8 or auto for a quarter of the cores of every NUMA node (default: any)";
+static const char infer_cpus_message[] = "CPUs for inference, as 0-3,8 or auto for the cores of every NUMA node not given to I/O (default: any)";
+static const char stub_message[] = "Run on the stub detector with this latency in mS, as fixed:20, uniform:10,30, normal:20,5 or lognormal:20,0.5";
+static const char stub_objects_message[] = "Number of detections the stub detector returns per image (default: 10)";
+static const char cache_message[] = "Directory to cache compiled networks in (default: disabled)";
+static const char benchmark_message[] = "Benchmark the model and exit, with the POST /benchmark query such as batch=1,2&nireq=1,2,4&duration=3&budget_ms=50 (default for the default grid)";
+static const char nireq_message[] = "Number of infer requests run in parallel (default: 1)";
+static const char queue_message[] = "Number of inference requests waiting per priority lane before new ones get 503 (default: 32)";
+static const char reserve_message[] = "Infer requests kept for the high priority lane (default: a quarter of -nireq)";
+static const char weight_message[] = "Share of the high priority lane against 1 for the low one (default: 4)";
+
+// Limits of the WebSocket endpoint, a frame being one message
+static const size_t max_stream_frame = 32 * 1024 * 1024;
+static const int max_stream_connections = 64;
 
 DEFINE_bool  (h, false,       help_message);
 DEFINE_string(H, "localhost", host_message);
@@ -53,6 +92,25 @@ DEFINE_int32 (p, 30303,       port_message);
 DEFINE_string(d, "CPU",       device_message);
 DEFINE_string(m, "",          model_message);
 DEFINE_double(t, 0.5,         threshold_message);
+DEFINE_string(l, "",          labelmap_message);
+DEFINE_string(ct, "",         class_thresholds_message);
+DEFINE_string(c, "",          cache_message);
+DEFINE_string(stub, "",       stub_message);
+DEFINE_int32 (stub_obj, 10,   stub_objects_message);
+DEFINE_string(benchmark, "",  benchmark_message);
+DEFINE_int32 (nireq, 1,       nireq_message);
+DEFINE_int32 (queue, 32,      queue_message);
+DEFINE_int32 (reserve, -1,    reserve_message);
+DEFINE_int32 (weight, 4,      weight_message);
+DEFINE_int32 (decoders, 2,    decoders_message);
+DEFINE_double(motion, 0.005,  motion_message);
+DEFINE_int32 (streams, 256,   streams_message);
+DEFINE_int32 (ws_port, 0,     ws_port_message);
+DEFINE_int32 (inflight, 2,    inflight_message);
+DEFINE_string(video_dir, "",  video_dir_message);
+DEFINE_int32 (workers, 0,     workers_message);
+DEFINE_string(io_cpus, "",    io_cpus_message);
+DEFINE_string(ie_cpus, "",    infer_cpus_message);
 
 static void show_usage() {
     std::cout << std::endl;
@@ -65,11 +123,46 @@ static void show_usage() {
     std::cout << "    -d <string>     " << device_message << std::endl;
     std::cout << "    -m <string>     " << model_message << std::endl;
     std::cout << "    -t <double>     " << threshold_message << std::endl;
+    std::cout << "    -l <string>     " << labelmap_message << std::endl;
+    std::cout << "    -ct <string>    " << class_thresholds_message << std::endl;
+    std::cout << "    -c <string>     " << cache_message << std::endl;
+    std::cout << "    -stub <string>  " << stub_message << std::endl;
+    std::cout << "    -stub_obj <int> " << stub_objects_message << std::endl;
+    std::cout << "    -benchmark <str>" << benchmark_message << std::endl;
+    std::cout << "    -nireq <int>    " << nireq_message << std::endl;
+    std::cout << "    -queue <int>    " << queue_message << std::endl;
+    std::cout << "    -reserve <int>  " << reserve_message << std::endl;
+    std::cout << "    -weight <int>   " << weight_message << std::endl;
+    std::cout << "    -decoders <int> " << decoders_message << std::endl;
+    std::cout << "    -motion <double>" << motion_message << std::endl;
+    std::cout << "    -streams <int>  " << streams_message << std::endl;
+    std::cout << "    -ws_port <int>  " << ws_port_message << std::endl;
+    std::cout << "    -inflight <int> " << inflight_message << std::endl;
+    std::cout << "    -video_dir <dir>" << video_dir_message << std::endl;
+    std::cout << "    -workers <int>  " << workers_message << std::endl;
+    std::cout << "    -io_cpus <list> " << io_cpus_message << std::endl;
+    std::cout << "    -ie_cpus <list> " << infer_cpus_message << std::endl;
     std::cout << std::endl;
     NexIE::display_intel_ie_version();
     std::cout << std::endl;
 }
 
+// Throws unless a CPU flag is empty, auto or a CPU list
+static void check_cpulist(const char *name, const std::string &value) {
+    if (value.empty() || (value == "auto")) {
+        return;
+    }
+    std::vector<int> cpus;
+    try {
+        cpus = NexIE::parse_cpulist(value);
+    }
+    catch (std::invalid_argument const &) {
+    }
+    if (cpus.empty()) {
+        throw std::logic_error(std::string("Parameter ") + name + " must be a CPU list such as 0-3,8 or auto");
+    }
+}
+
 static bool parse_cli(int argc, char *argv[]) {
     gflags::ParseCommandLineNonHelpFlags(&argc, &argv, true);
     if (FLAGS_h) {
@@ -82,6 +175,53 @@ static bool parse_cli(int argc, char *argv[]) {
     if ((FLAGS_t < 0) || (FLAGS_t > 1)) {
         throw std::logic_error("Parameter -t must be between 0 and 1 (default: 0.7)");
     }
+    if (FLAGS_nireq < 1) {
+        throw std::logic_error("Parameter -nireq must be at least 1");
+    }
+    if (FLAGS_queue < 0) {
+        throw std::logic_error("Parameter -queue must not be negative");
+    }
+    if (FLAGS_reserve >= FLAGS_nireq) {
+        throw std::logic_error("Parameter -reserve must be less than -nireq");
+    }
+    if (FLAGS_weight < 1) {
+        throw std::logic_error("Parameter -weight must be at least 1");
+    }
+    if (FLAGS_decoders < 1) {
+        throw std::logic_error("Parameter -decoders must be at least 1");
+    }
+    if ((FLAGS_motion < 0) || (FLAGS_motion > 1)) {
+        throw std::logic_error("Parameter -motion must be between 0 and 1");
+    }
+    if (FLAGS_streams < 1) {
+        throw std::logic_error("Parameter -streams must be at least 1");
+    }
+    if ((FLAGS_ws_port < 0) || (FLAGS_ws_port > 65535) || (FLAGS_ws_port == FLAGS_p)) {
+        throw std::logic_error("Parameter -ws_port should be in range 1-65535 and differ from -p (default: 0)");
+    }
+    if ((FLAGS_inflight < 1) || (FLAGS_inflight > 32)) {
+        throw std::logic_error("Parameter -inflight must be between 1 and 32");
+    }
+    if (FLAGS_workers < 0) {
+        throw std::logic_error("Parameter -workers must not be negative");
+    }
+    if (!FLAGS_video_dir.empty()) {
+        struct stat buffer;
+        if ((stat(FLAGS_video_dir.c_str(), &buffer) != 0) || !S_ISDIR(buffer.st_mode)) {
+            throw std::logic_error("Parameter -video_dir must be a directory");
+        }
+    }
+    check_cpulist("-io_cpus", FLAGS_io_cpus);
+    check_cpulist("-ie_cpus", FLAGS_ie_cpus);
+    if (!FLAGS_stub.empty()) {
+        NexIE::LatencyModel latency(FLAGS_stub);    // throws when invalid
+    }
+    if ((FLAGS_stub_obj < 0) || (FLAGS_stub_obj > 100)) {
+        throw std::logic_error("Parameter -stub_obj must be between 0 and 100");
+    }
+    if (!FLAGS_benchmark.empty() && (FLAGS_workers > 0)) {
+        throw std::logic_error("Parameter -benchmark cannot be used with -workers");
+    }
     if ((FLAGS_d != "CPU") && (FLAGS_d != "GPU")) {
         throw std::logic_error("Parameter -d must be CPU or GPU");
     }
@@ -118,21 +258,155 @@ static std::string& find_application_path(char *argv[]) {
     return app_path;
 }
 
+// Load what a manifest describes, the network only when it names one other than the
+// network already running
+static void load_manifest(const NexIE::ModelManifest &manifest, bool same_network=false) {
+    NexIE::LabelMap::Ptr labels;
+    if (!manifest.labelmap.empty()) {
+        labels = NexIE::LabelMap::load(manifest.labelmap);
+    }
+    auto class_thresholds = NexIE::parse_class_thresholds(manifest.class_thresholds);
+    if (manifest.xml.empty() || same_network) {
+        ie->setLabelMap(labels, &class_thresholds);
+        return;
+    }
+    std::string model_xml = manifest.xml;
+    std::string model_bin = manifest.bin;
+    std::cout << "Loading model...";
+    ie->loadModel(model_xml, model_bin, labels, &class_thresholds);
+    std::cout << " done" << (ie->loadedFromCache()? " (cached)" : "") << std::endl;
+}
+
+// Workers reload the shared manifest whenever another worker published a model. A new
+// labelmap or new class thresholds leave the network as it is.
+static void reload_models() {
+    while (true) {
+        NexIE::wait_model_update();
+        NexIE::ModelManifest manifest;
+        bool started = false;
+        bool loaded = false;
+        try {
+            bool same_network = false;
+            started = NexIE::begin_model_load(*worker, manifest, same_network);
+            if (started) {
+                load_manifest(manifest, same_network);
+                loaded = true;
+            }
+        }
+        catch (std::exception const &e) {
+            std::cout << " " << e.what() << std::endl;
+        }
+        try {
+            if (started) {
+                NexIE::finish_model_load(*worker, loaded? &manifest : NULL);
+            }
+        }
+        catch (std::exception const &e) {
+            std::cout << " " << e.what() << std::endl;
+        }
+    }
+}
+
+// Benchmark the loaded model as POST /benchmark does, the report goes to stdout as JSON
+static int run_benchmark(const std::string &spec) {
+    try {
+        auto plan = NexIE::parse_benchmark_plan(web::http::uri::split_query((spec == "default")? "" : spec));
+        std::cout << "Benchmark (points: " << plan.batches.size() * plan.nireqs.size() << "; duration: "
+                  << plan.duration_s << "S)" << std::endl;
+        auto report = NexIE::run_benchmark_plan(*ie, plan, std::cout);
+        std::cout << report.toJson().serialize() << std::endl;
+    }
+    catch (std::exception const &e) {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
     if (!parse_cli(argc, argv)) {
         return 0;
     }
 
-    auto app_path = find_application_path(argv);
-    if (FLAGS_m.size() > 0) {
-        std::cout << "Loading model...";
-        ie = new NexIE::ObjectDetection(app_path, FLAGS_d, FLAGS_m);
-        std::cout << " done" << std::endl;
+    NexIE::ModelManifest manifest;
+    manifest.xml = FLAGS_m;
+    manifest.labelmap = FLAGS_l;
+    manifest.class_thresholds = FLAGS_ct;
+    if (FLAGS_workers > 0) {
+        // Fork before the plugin starts any thread. Only workers go on from here.
+        static NexIE::Worker this_worker;
+        if (!NexIE::run_workers(FLAGS_workers, manifest, this_worker)) {
+            return 0;
+        }
+        worker = &this_worker;
+        NexIE::set_reuseport(true);
+        NexIE::set_affinity(worker->cpus);
+        bool same_network;
+        NexIE::begin_model_load(*worker, manifest, same_network);
+    }
+
+    // "auto" splits the CPUs of this process (or worker) between I/O and inference
+    std::vector<int> io_cpus, infer_cpus;
+    if ((FLAGS_io_cpus == "auto") || (FLAGS_ie_cpus == "auto")) {
+        NexIE::split_cpus((worker != NULL)? worker->cpus : NexIE::allowed_cpus(), io_cpus, infer_cpus);
+    }
+    if ((FLAGS_io_cpus != "auto") && !FLAGS_io_cpus.empty()) {
+        io_cpus = NexIE::parse_cpulist(FLAGS_io_cpus);
+    }
+    if ((FLAGS_ie_cpus != "auto") && !FLAGS_ie_cpus.empty()) {
+        infer_cpus = NexIE::parse_cpulist(FLAGS_ie_cpus);
+    }
+    if (infer_cpus.empty() && (worker != NULL)) {
+        infer_cpus = worker->cpus;
+    }
+    if ((worker == NULL) || (worker->index == 0)) {
+        NexIE::print_topology(std::cout, io_cpus, infer_cpus);
+    }
+
+    if (FLAGS_stub.empty()) {
+        auto app_path = find_application_path(argv);
+        auto detection = new NexIE::ObjectDetection(app_path, FLAGS_d);
+        detection->setCacheDir(FLAGS_c);
+        detection->setInferRequests(FLAGS_nireq);
+        detection->setInferenceCpus(infer_cpus);
+        if (!infer_cpus.empty() && (FLAGS_d == "CPU")) {
+            // One plugin thread per inference CPU, kept on its CPU
+            detection->setConfig("CPU_THREADS_NUM", std::to_string(infer_cpus.size()));
+            detection->setConfig("CPU_BIND_THREAD", "YES");
+        }
+        ie = detection;
     }
     else {
-        ie = new NexIE::ObjectDetection(app_path, FLAGS_d);
+        auto stub = new NexIE::StubDetector(FLAGS_stub, FLAGS_stub_obj);
+        stub->setInferRequests(FLAGS_nireq);
+        std::cout << stub->describe() << std::endl;
+        ie = stub;
+    }
+    load_manifest(manifest);
+    if (worker != NULL) {
+        NexIE::finish_model_load(*worker, &manifest);
     }
     ie->setThreshold(FLAGS_t);
+    if (!FLAGS_benchmark.empty()) {
+        return run_benchmark(FLAGS_benchmark);
+    }
+    if (worker != NULL) {
+        std::thread(reload_models).detach();
+    }
+
+    // The listener threads, decoders and executors started from here on inherit the I/O CPUs,
+    // inference itself runs on the inference CPUs
+    if (!NexIE::set_affinity(io_cpus)) {
+        std::cout << "Cannot pin to CPUs " << NexIE::format_cpulist(io_cpus) << std::endl;
+    }
+    int reserve = (FLAGS_reserve < 0)? FLAGS_nireq / 4 : FLAGS_reserve;
+    queue = new NexIE::RequestQueue(FLAGS_nireq, FLAGS_queue, reserve, FLAGS_weight);
+    decoders = new NexIE::ThreadPool(FLAGS_decoders);
+    motion = new NexIE::MotionGate(FLAGS_motion, FLAGS_streams);
+    trackers = new NexIE::StreamTrackers(FLAGS_streams);
+    if (!FLAGS_video_dir.empty()) {
+        set_video_dir(FLAGS_video_dir);
+    }
 
     std::string addr = FLAGS_H + ":" + std::to_string(FLAGS_p);
     if (FLAGS_H.find("://") == std::string::npos) {
@@ -150,6 +424,15 @@ int main(int argc, char *argv[]) {
         listener.open()
                 .then([&listener]() {})
                 .wait();
+        std::unique_ptr<NexIE::WebSocketServer> streams;
+        if (FLAGS_ws_port > 0) {
+            std::string host = FLAGS_H.substr((FLAGS_H.find("://") == std::string::npos)? 0 : FLAGS_H.find("://") + 3);
+            streams.reset(new NexIE::WebSocketServer(host, FLAGS_ws_port, "/inference/stream", max_stream_frame,
+                                                     max_stream_connections, [](NexIE::WebSocket::Ptr socket) {
+                handle_stream(socket, FLAGS_inflight);
+            }));
+            std::cout << "Listen to ws://" << host << ":" << FLAGS_ws_port << "/inference/stream" << std::endl;
+        }
         while (true);
     }
     catch (std::exception const &e) {
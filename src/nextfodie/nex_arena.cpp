@@ -0,0 +1,198 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+#include "nex_arena.h"
+
+namespace NexInferenceEngine {
+
+static const size_t min_block = 64 * 1024;
+// An arena keeps this much across requests, enough for bodies of about 1MB collected in
+// doubling steps; a larger request mallocs the rest
+static const size_t retained_bytes = 4 * 1024 * 1024;
+static const size_t thread_cached = 2;
+static const size_t shared_cached = 16;
+
+// Set while the thread is ending, when its cache may be gone already
+static thread_local bool thread_ending = false;
+
+// Arenas cached on a thread, given to the shared cache when the thread ends
+struct ArenaCache {
+    std::vector<Arena*> arenas;
+
+    ~ArenaCache() {
+        thread_ending = true;
+        for (auto arena : this->arenas) {
+            Arena::release(arena);
+        }
+    }
+};
+
+static std::mutex shared_mutex;
+static std::vector<Arena*> shared_arenas;
+
+static ArenaCache* thread_cache() {
+    if (thread_ending) {
+        return NULL;
+    }
+    static thread_local ArenaCache cache;
+    return &cache;
+}
+
+void ArenaRelease::operator()(Arena *arena) const {
+    Arena::release(arena);
+}
+
+Arena::Arena(): current(0), used(0), last(NULL) {
+}
+
+Arena::~Arena() {
+    for (auto &block : this->blocks) {
+        free(block.data);
+    }
+}
+
+Arena::Ptr Arena::acquire() {
+    ArenaCache *cache = thread_cache();
+    if ((cache != NULL) && !cache->arenas.empty()) {
+        Arena *arena = cache->arenas.back();
+        cache->arenas.pop_back();
+        return Ptr(arena);
+    }
+    {
+        std::lock_guard<std::mutex> lock(shared_mutex);
+        if (!shared_arenas.empty()) {
+            Arena *arena = shared_arenas.back();
+            shared_arenas.pop_back();
+            return Ptr(arena);
+        }
+    }
+    return Ptr(new Arena());
+}
+
+void Arena::release(Arena *arena) {
+    if (arena == NULL) {
+        return;
+    }
+    arena->reset();
+    ArenaCache *cache = thread_cache();
+    if ((cache != NULL) && (cache->arenas.size() < thread_cached)) {
+        cache->arenas.push_back(arena);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(shared_mutex);
+        if (shared_arenas.size() < shared_cached) {
+            shared_arenas.push_back(arena);
+            return;
+        }
+    }
+    delete arena;
+}
+
+// Keep the largest blocks which fit in the retained size. They are filled smallest first, so
+// a growing allocation moves up through them as it did when they were allocated.
+void Arena::reset() {
+    std::sort(this->blocks.begin(), this->blocks.end(), [](const Block &a, const Block &b) {
+        return a.size > b.size;
+    });
+    size_t kept = 0;
+    size_t total = 0;
+    for (auto &block : this->blocks) {
+        if (total + block.size <= retained_bytes) {
+            total += block.size;
+            this->blocks[kept++] = block;
+        }
+        else {
+            free(block.data);
+        }
+    }
+    this->blocks.resize(kept);
+    std::reverse(this->blocks.begin(), this->blocks.end());
+    this->current = 0;
+    this->used = 0;
+    this->last = NULL;
+}
+
+void* Arena::allocate(size_t size, size_t align) {
+    // Later blocks are tried in turn, those passed over stay unused until the reset
+    while (this->current < this->blocks.size()) {
+        Block &block = this->blocks[this->current];
+        size_t offset = (this->used + align - 1) & ~(align - 1);
+        if (offset + size <= block.size) {
+            this->used = offset + size;
+            this->last = block.data + offset;
+            return this->last;
+        }
+        this->current++;
+        this->used = 0;
+    }
+    Block block;
+    block.size = std::max(min_block, size);
+    block.data = (char*)malloc(block.size);     // aligned for any type
+    if (block.data == NULL) {
+        throw std::bad_alloc();
+    }
+    this->blocks.push_back(block);
+    this->current = this->blocks.size() - 1;
+    this->used = size;
+    this->last = block.data;
+    return this->last;
+}
+
+void* Arena::reallocate(void *data, size_t old_size, size_t size) {
+    if (data == NULL) {
+        return this->allocate(size);
+    }
+    if (size <= old_size) {
+        return data;
+    }
+    if ((data == this->last) && (this->current < this->blocks.size())) {
+        Block &block = this->blocks[this->current];
+        size_t offset = (char*)data - block.data;
+        if (offset + size <= block.size) {
+            this->used = offset + size;
+            return data;
+        }
+    }
+    void *moved = this->allocate(size);
+    memcpy(moved, data, old_size);
+    return moved;
+}
+
+size_t Arena::capacity() const {
+    size_t total = 0;
+    for (auto &block : this->blocks) {
+        total += block.size;
+    }
+    return total;
+}
+
+} // namespace NexInferenceEngine
@@ -0,0 +1,77 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace NexInferenceEngine {
+
+class Arena;
+
+struct ArenaRelease {
+    void operator()(Arena *arena) const;
+};
+
+// Memory of one request, handed out by bumping through blocks and given back all at once.
+// Arenas are recycled with their blocks through a cache per thread, backed by one shared
+// cache for requests that end on another thread than they started, so that a steady flow
+// of requests stops calling malloc().
+class Arena {
+private:
+    struct Block {
+        char *data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks;
+    size_t current;         // block being filled
+    size_t used;            // of the current block
+    void *last;             // latest allocation, which may still grow in place
+
+    void reset();
+
+    Arena(const Arena&);
+    Arena& operator=(const Arena&);
+
+public:
+    typedef std::unique_ptr<Arena, ArenaRelease> Ptr;
+
+    Arena();
+    ~Arena();
+
+    // An empty arena, a recycled one when there is any
+    static Ptr acquire();
+    static void release(Arena *arena);
+
+    // Never fails, throws std::bad_alloc like new
+    void* allocate(size_t size, size_t align=alignof(std::max_align_t));
+    // The latest allocation grows in place while its block has room, others are copied
+    void* reallocate(void *data, size_t old_size, size_t size);
+    size_t capacity() const;
+};
+
+} // namespace NexInferenceEngine
@@ -0,0 +1,94 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#include <cstring>
+
+#include "nex_binary_writer.h"
+
+namespace NexInferenceEngine {
+
+void binary_append_u8(std::string &out, uint8_t value) {
+    out.push_back((char)value);
+}
+
+void binary_append_u16(std::string &out, uint16_t value) {
+    out.push_back((char)(value & 0xff));
+    out.push_back((char)(value >> 8));
+}
+
+void binary_append_u32(std::string &out, uint32_t value) {
+    for (int shift = 0; shift < 32; shift += 8) {
+        out.push_back((char)((value >> shift) & 0xff));
+    }
+}
+
+void binary_append_f16(std::string &out, float value) {
+    binary_append_u16(out, float_to_half(value));
+}
+
+void binary_append_f32(std::string &out, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    binary_append_u32(out, bits);
+}
+
+uint16_t float_to_half(float value) {
+    // IEEE 754 binary16, round to nearest even
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+    uint32_t exponent = (bits >> 23) & 0xff;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (exponent == 0xff) {                 // infinity or NaN
+        return sign | 0x7c00 | (mantissa? 0x200 : 0);
+    }
+    int half_exponent = (int)exponent - 127 + 15;
+    if (half_exponent >= 0x1f) {            // overflow
+        return sign | 0x7c00;
+    }
+    if (half_exponent <= 0) {               // subnormal or zero
+        if (half_exponent < -10) {
+            return sign;
+        }
+        mantissa |= 0x800000;
+        int shift = 14 - half_exponent;
+        uint32_t half_mantissa = mantissa >> shift;
+        uint32_t remainder = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if ((remainder > halfway) || ((remainder == halfway) && (half_mantissa & 1))) {
+            half_mantissa++;
+        }
+        return sign | (uint16_t)half_mantissa;
+    }
+    uint16_t half = sign | (uint16_t)(half_exponent << 10) | (uint16_t)(mantissa >> 13);
+    uint32_t remainder = mantissa & 0x1fff;
+    if ((remainder > 0x1000) || ((remainder == 0x1000) && (half & 1))) {
+        half++;                             // may carry into the exponent, which is still correct
+    }
+    return half;
+}
+
+} // namespace NexInferenceEngine
@@ -0,0 +1,820 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+#include "nex_detector.h"
+#include "nex_binary_writer.h"
+#include "nex_json_writer.h"
+
+// Class-aware greedy NMS over SSD output rows; the survivors are left sorted by score.
+// Boxes are kept as structure of arrays so that the inner loop can be vectorized.
+static void non_max_suppression(std::vector<float> &rows, int object_size, float iou_threshold) {
+    size_t count = rows.size() / object_size;
+    std::vector<size_t> order(count);
+    for (size_t i = 0; i < count; i++) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&rows, object_size](size_t a, size_t b) {
+        return rows[a * object_size + 2] > rows[b * object_size + 2];
+    });
+
+    std::vector<float> label(count), x0(count), y0(count), x1(count), y1(count), area(count);
+    for (size_t i = 0; i < count; i++) {
+        const float *row = &rows[order[i] * object_size];
+        label[i] = row[1];
+        x0[i] = row[3];
+        y0[i] = row[4];
+        x1[i] = row[5];
+        y1[i] = row[6];
+        area[i] = (x1[i] - x0[i]) * (y1[i] - y0[i]);
+    }
+
+    std::vector<uint8_t> suppressed(count, 0);
+    for (size_t i = 0; i < count; i++) {
+        if (suppressed[i]) {
+            continue;
+        }
+        const float bl = label[i], bx0 = x0[i], by0 = y0[i], bx1 = x1[i], by1 = y1[i], barea = area[i];
+        for (size_t j = i + 1; j < count; j++) {
+            float w = std::max(0.0f, std::min(bx1, x1[j]) - std::max(bx0, x0[j]));
+            float h = std::max(0.0f, std::min(by1, y1[j]) - std::max(by0, y0[j]));
+            float inter = w * h;
+            // iou > threshold, without the division
+            suppressed[j] |= (uint8_t)((inter > iou_threshold * (barea + area[j] - inter)) & (label[j] == bl));
+        }
+    }
+
+    std::vector<float> kept;
+    kept.reserve(rows.size());
+    for (size_t i = 0; i < count; i++) {
+        if (!suppressed[i]) {
+            auto row = rows.begin() + order[i] * object_size;
+            kept.insert(kept.end(), row, row + object_size);
+        }
+    }
+    rows.swap(kept);
+}
+
+// Number of tiles of the given length needed to cover length with at least the given overlap
+static int tile_count(int length, int tile, float overlap) {
+    if (tile >= length) {
+        return 1;
+    }
+    int stride = std::max(1, (int)(tile * (1.0f - overlap)));
+    return (length - tile + stride - 1) / stride + 1;
+}
+
+static int tile_position(int length, int tile, int count, int idx) {
+    if (count < 2) {
+        return 0;
+    }
+    return (int)((long)(length - tile) * idx / (count - 1));
+}
+
+static std::string trim(const std::string &text) {
+    size_t start = text.find_first_not_of(" \t\r\n");
+    if (start == std::string::npos) {
+        return "";
+    }
+    size_t end = text.find_last_not_of(" \t\r\n");
+    return text.substr(start, end - start + 1);
+}
+
+namespace NexInferenceEngine {
+
+// Class ids named by a filter, either a number or every id with that labelmap name
+static std::vector<int> class_ids(const std::string &spec, const LabelMap *labels) {
+    if (!spec.empty() && (spec.find_first_not_of("0123456789") == std::string::npos) && (spec.size() < 6)) {
+        return std::vector<int>(1, std::stoi(spec));
+    }
+    return labels? labels->ids(spec) : std::vector<int>();
+}
+
+void ClassRules::set(const std::string &spec, float score, const LabelMap *labels, bool strict) {
+    auto ids = class_ids(spec, labels);
+    if (ids.empty() && strict) {
+        throw std::invalid_argument("Unknown class (" + spec + ")");
+    }
+    for (int id : ids) {
+        if ((size_t)id >= this->min_scores.size()) {
+            this->min_scores.resize(id + 1, this->other_score);
+        }
+        this->min_scores[id] = score;
+    }
+}
+
+ClassRules::ClassRules(const DetectionFilter &filter, const Model *model, float threshold) {
+    const LabelMap *labels = model? model->labels.get() : NULL;
+    float base = (filter.threshold < 0)? threshold : filter.threshold;
+    this->other_score = base;
+    // The threshold of a request overrides the class thresholds of the model too, only its own
+    // class thresholds come before it
+    bool model_thresholds = model && !model->class_thresholds.empty() && (filter.threshold < 0);
+    bool uniform = filter.class_thresholds.empty() && filter.include_classes.empty() && filter.exclude_classes.empty()
+                   && !model_thresholds;
+    if (uniform) {
+        return;
+    }
+
+    // Model thresholds may name classes of an earlier labelmap, those are skipped
+    this->min_scores.assign(labels? labels->maxId() + 1 : 0, base);
+    if (model_thresholds) {
+        for (auto &item : model->class_thresholds) {
+            this->set(item.first, item.second, labels, false);
+        }
+    }
+    for (auto &item : filter.class_thresholds) {
+        this->set(item.first, item.second, labels, true);
+    }
+    if (!filter.include_classes.empty()) {
+        std::vector<float> included(this->min_scores.size(), 2.0f);
+        for (auto &spec : filter.include_classes) {
+            auto ids = class_ids(spec, labels);
+            if (ids.empty()) {
+                throw std::invalid_argument("Unknown class (" + spec + ")");
+            }
+            for (int id : ids) {
+                if ((size_t)id >= included.size()) {
+                    included.resize(id + 1, 2.0f);
+                    this->min_scores.resize(id + 1, base);
+                }
+                included[id] = this->min_scores[id];
+            }
+        }
+        this->min_scores.swap(included);
+        this->other_score = 2.0f;
+    }
+    for (auto &spec : filter.exclude_classes) {
+        this->set(spec, 2.0f, labels, true);
+    }
+}
+
+// Call back with (class_id, score, bbox, track_id) for every row which passes the filter, where
+// bbox is xmin, ymin, xmax, ymax in source image pixels and track_id is 0 unless the rows are
+// tracked. With top_k the rows come by score.
+template<class Callback>
+static void for_each_detection(const Detections &detections, const ClassRules &rules, const DetectionFilter &filter,
+                               Callback callback) {
+    struct Candidate {
+        int class_id;
+        float score;
+        float bbox[4];
+        int track_id;
+    };
+    static thread_local std::vector<Candidate> candidates;
+    candidates.clear();
+
+    const Letterbox &letterbox = detections.letterbox;
+    size_t object_size = detections.model? detections.model->network->object_size : 7;
+    float img_w = (float)letterbox.image_w;
+    float img_h = (float)letterbox.image_h;
+    for (size_t idx = 0; idx + object_size <= detections.data.size(); idx += object_size) {
+        const float *row = &detections.data[idx];
+        if (row[0] < 0) {
+            break;
+        }
+
+        int class_id = static_cast<int>(row[1]);
+        float score = row[2];
+        if (score < rules.minScore(class_id)) {
+            continue;
+        }
+
+        // Undo the letterbox, boxes are relative to the source image
+        Candidate item;
+        item.class_id = class_id;
+        item.score = score;
+        item.track_id = detections.tracked? (int)row[0] : 0;
+        item.bbox[0] = std::min(img_w, std::max(0.0f, letterbox.imageX(row[3])));   // xmin
+        item.bbox[1] = std::min(img_h, std::max(0.0f, letterbox.imageY(row[4])));   // ymin
+        item.bbox[2] = std::min(img_w, std::max(0.0f, letterbox.imageX(row[5])));   // xmax
+        item.bbox[3] = std::min(img_h, std::max(0.0f, letterbox.imageY(row[6])));   // ymax
+        if ((item.bbox[2] - item.bbox[0]) * (item.bbox[3] - item.bbox[1]) < filter.min_box_area) {
+            continue;
+        }
+        if (filter.top_k > 0) {
+            candidates.push_back(item);
+        } else {
+            callback(item.class_id, item.score, item.bbox, item.track_id);
+        }
+    }
+
+    if (filter.top_k > 0) {
+        size_t count = std::min(candidates.size(), (size_t)filter.top_k);
+        std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(),
+                          [](const Candidate &a, const Candidate &b) {return a.score > b.score;});
+        for (size_t idx = 0; idx < count; idx++) {
+            callback(candidates[idx].class_id, candidates[idx].score, candidates[idx].bbox, candidates[idx].track_id);
+        }
+    }
+}
+
+// "name:0.7, 3:0.4"
+ClassThresholds parse_class_thresholds(const std::string &text) {
+    ClassThresholds thresholds;
+    std::istringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (trim(item).empty()) {
+            continue;
+        }
+        auto pos = item.rfind(':');
+        std::string spec = (pos == std::string::npos)? "" : trim(item.substr(0, pos));
+        if (spec.empty()) {
+            throw std::invalid_argument("Invalid class threshold (" + trim(item) + ")");
+        }
+        float threshold = std::stof(item.substr(pos + 1));
+        if ((threshold < 0) || (threshold > 1)) {
+            throw std::invalid_argument("Class threshold must be between 0 and 1 (" + trim(item) + ")");
+        }
+        thresholds[spec] = threshold;
+    }
+    return thresholds;
+}
+
+// "person, 3"
+std::set<std::string> parse_class_list(const std::string &text) {
+    std::set<std::string> classes;
+    std::istringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        item = trim(item);
+        if (!item.empty()) {
+            classes.insert(item);
+        }
+    }
+    return classes;
+}
+
+Letterbox make_letterbox(int image_w, int image_h, int input_w, int input_h) {
+    Letterbox letterbox;
+    double ratio_w = (double)input_w / (double)image_w;
+    double ratio_h = (double)input_h / (double)image_h;
+    double ratio = (ratio_w < ratio_h)? ratio_w : ratio_h;
+    int resized_w = std::max(1, std::min(input_w, (int)(image_w * ratio + 0.5)));
+    int resized_h = std::max(1, std::min(input_h, (int)(image_h * ratio + 0.5)));
+
+    letterbox.image_w  = image_w;
+    letterbox.image_h  = image_h;
+    letterbox.input_w  = input_w;
+    letterbox.input_h  = input_h;
+    letterbox.scale_x  = (float)resized_w / (float)image_w;
+    letterbox.scale_y  = (float)resized_h / (float)image_h;
+    letterbox.pad_left = (input_w - resized_w) / 2;
+    letterbox.pad_top  = (input_h - resized_h) / 2;
+    return letterbox;
+}
+
+Letterbox NetworkShape::letterbox(const cv::Mat &img, cv::Mat &resized) {
+    // Resize and keep aspect ratio, then pad evenly on both sides
+    Letterbox letterbox = make_letterbox(img.size().width, img.size().height, this->input_w, this->input_h);
+    if ((letterbox.image_w == this->input_w) && (letterbox.image_h == this->input_h)) {
+        resized = img;
+        return letterbox;
+    }
+
+    int resized_w = (int)(letterbox.image_w * letterbox.scale_x + 0.5);
+    int resized_h = (int)(letterbox.image_h * letterbox.scale_y + 0.5);
+    int interpolation = (letterbox.scale_x < 1.0)? cv::INTER_AREA : cv::INTER_CUBIC;
+    cv::resize(img, resized, cv::Size(resized_w, resized_h), 0, 0, interpolation);
+
+    int right  = this->input_w - resized_w - letterbox.pad_left;
+    int bottom = this->input_h - resized_h - letterbox.pad_top;
+    if (letterbox.pad_left + right + letterbox.pad_top + bottom > 0) {
+        cv::Mat padded;
+        cv::copyMakeBorder(resized, padded, letterbox.pad_top, bottom, letterbox.pad_left, right, cv::BORDER_CONSTANT);
+        resized = padded;
+    }
+    return letterbox;
+}
+
+static const struct {
+    const char *name;
+    PixelFormat format;
+} pixel_formats[] = {
+    {"bgr",  PIXEL_BGR},
+    {"rgb",  PIXEL_RGB},
+    {"gray", PIXEL_GRAY},
+    {"nv12", PIXEL_NV12},
+    {"i420", PIXEL_I420},
+};
+
+bool parse_pixel_format(const std::string &text, PixelFormat &format) {
+    for (const auto &entry : pixel_formats) {
+        if (text == entry.name) {
+            format = entry.format;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *pixel_format_name(PixelFormat format) {
+    for (const auto &entry : pixel_formats) {
+        if (entry.format == format) {
+            return entry.name;
+        }
+    }
+    return "unknown";
+}
+
+void RawImage::validate() {
+    if ((this->width <= 0) || (this->height <= 0)) {
+        throw std::invalid_argument("A raw image needs its width and height");
+    }
+    if (this->stride < 0) {
+        throw std::invalid_argument("Invalid stride: " + std::to_string(this->stride));
+    }
+    bool yuv = (this->format == PIXEL_NV12) || (this->format == PIXEL_I420);
+    if (yuv && ((this->width % 2) || (this->height % 2))) {
+        throw std::invalid_argument("NV12 and I420 images need an even width and height");
+    }
+    bool packed = (this->format == PIXEL_BGR) || (this->format == PIXEL_RGB);
+    size_t row = (size_t)this->width * (packed? 3 : 1);
+    size_t stride = this->stride? (size_t)this->stride : row;
+    if (stride < row) {
+        throw std::invalid_argument("Stride " + std::to_string(stride) + " is shorter than a row of " +
+                                    std::to_string(row) + " bytes");
+    }
+    if ((this->format == PIXEL_I420) && (stride % 2)) {
+        throw std::invalid_argument("I420 images need an even stride");
+    }
+    size_t needed = yuv? stride * this->height / 2 * 3 : stride * (this->height - 1) + row;
+    if (this->size < needed) {
+        throw std::invalid_argument("Raw image of " + std::to_string(this->size) + " bytes, " +
+                                    std::to_string(needed) + " needed");
+    }
+    this->stride = (int)stride;
+}
+
+cv::Mat RawImage::toMat() const {
+    // Mat headers only take mutable data, nothing is written through them
+    uint8_t *data = const_cast<uint8_t*>(this->data);
+    int w = this->width;
+    int h = this->height;
+    cv::Mat bgr;
+    switch (this->format) {
+    case PIXEL_BGR:
+        cv::Mat(h, w, CV_8UC3, data, this->stride).copyTo(bgr);
+        break;
+    case PIXEL_RGB:
+        cv::cvtColor(cv::Mat(h, w, CV_8UC3, data, this->stride), bgr, cv::COLOR_RGB2BGR);
+        break;
+    case PIXEL_GRAY:
+        cv::cvtColor(cv::Mat(h, w, CV_8UC1, data, this->stride), bgr, cv::COLOR_GRAY2BGR);
+        break;
+    case PIXEL_NV12:
+        cv::cvtColor(cv::Mat(h * 3 / 2, w, CV_8UC1, data, this->stride), bgr, cv::COLOR_YUV2BGR_NV12);
+        break;
+    case PIXEL_I420:
+        if (this->stride == w) {
+            cv::cvtColor(cv::Mat(h * 3 / 2, w, CV_8UC1, data), bgr, cv::COLOR_YUV2BGR_I420);
+        }
+        else {
+            // OpenCV expects the planes without row padding
+            cv::Mat planes(h * 3 / 2, w, CV_8UC1);
+            uint8_t *dst = planes.ptr<uint8_t>();
+            for (int y = 0; y < h; y++, dst += w) {
+                memcpy(dst, data + (size_t)y * this->stride, w);
+            }
+            const uint8_t *chroma = data + (size_t)this->stride * h;
+            for (int y = 0; y < h; y++, dst += w / 2) {
+                memcpy(dst, chroma + (size_t)y * (this->stride / 2), w / 2);
+            }
+            cv::cvtColor(planes, bgr, cv::COLOR_YUV2BGR_I420);
+        }
+        break;
+    }
+    return bgr;
+}
+
+// Source pixels [begin, end) under each of the resized pixels along one axis: all of them
+// when shrinking, the one at the center when enlarging
+static void footprints(int source, int resized, std::vector<int> &begin, std::vector<int> &end) {
+    begin.resize(resized);
+    end.resize(resized);
+    for (int i = 0; i < resized; i++) {
+        if (resized > source) {
+            begin[i] = (int)((2 * (int64_t)i + 1) * source / (2 * (int64_t)resized));
+            end[i] = begin[i] + 1;
+        }
+        else {
+            begin[i] = (int)((int64_t)i * source / resized);
+            end[i] = (int)((int64_t)(i + 1) * source / resized);
+        }
+    }
+}
+
+static inline uint8_t saturate(int value) {
+    return (uint8_t)((value < 0)? 0 : ((value > 255)? 255 : value));
+}
+
+// BT.601 video range in the fixed point of OpenCV, which converts the same frames for
+// the other requests
+static inline void yuv_to_bgr(int y, int u, int v, uint8_t *bgr) {
+    const int shift = 20;
+    const int half = 1 << (shift - 1);
+    int luma = std::max(0, y - 16) * 1220542;
+    u -= 128;
+    v -= 128;
+    bgr[0] = saturate((luma + 2116026 * u + half) >> shift);
+    bgr[1] = saturate((luma - 852492 * v - 409993 * u + half) >> shift);
+    bgr[2] = saturate((luma + 1673527 * v + half) >> shift);
+}
+
+// Average over the source rectangle [x0, x1) x [y0, y1) as BGR. The format is a template
+// argument so that the branches on it fold away in the pixel loop.
+template<PixelFormat format>
+static inline void sample(const RawImage &image, int x0, int x1, int y0, int y1, uint8_t *bgr) {
+    const uint8_t *data = image.data;
+    size_t stride = (size_t)image.stride;
+    int count = (x1 - x0) * (y1 - y0);
+    if ((format == PIXEL_BGR) || (format == PIXEL_RGB)) {
+        int sum[3] = {0, 0, 0};
+        for (int y = y0; y < y1; y++) {
+            const uint8_t *px = data + y * stride + x0 * 3;
+            for (int x = x0; x < x1; x++, px += 3) {
+                sum[0] += px[0];
+                sum[1] += px[1];
+                sum[2] += px[2];
+            }
+        }
+        int first = (format == PIXEL_BGR)? 0 : 2;
+        bgr[0] = (uint8_t)((sum[first] + count / 2) / count);
+        bgr[1] = (uint8_t)((sum[1] + count / 2) / count);
+        bgr[2] = (uint8_t)((sum[2 - first] + count / 2) / count);
+        return;
+    }
+
+    int luma = 0;
+    for (int y = y0; y < y1; y++) {
+        const uint8_t *px = data + y * stride;
+        for (int x = x0; x < x1; x++) {
+            luma += px[x];
+        }
+    }
+    luma = (luma + count / 2) / count;
+    if (format == PIXEL_GRAY) {
+        bgr[0] = bgr[1] = bgr[2] = (uint8_t)luma;
+        return;
+    }
+
+    // 4:2:0, every chroma sample covers 2x2 luma pixels
+    int cx0 = x0 / 2, cx1 = (x1 + 1) / 2;
+    int cy0 = y0 / 2, cy1 = (y1 + 1) / 2;
+    int chroma_count = (cx1 - cx0) * (cy1 - cy0);
+    int u = 0, v = 0;
+    const uint8_t *chroma = data + stride * image.height;
+    if (format == PIXEL_NV12) {
+        for (int y = cy0; y < cy1; y++) {
+            const uint8_t *px = chroma + y * stride;
+            for (int x = cx0; x < cx1; x++) {
+                u += px[2 * x];
+                v += px[2 * x + 1];
+            }
+        }
+    }
+    else {
+        size_t chroma_stride = stride / 2;
+        const uint8_t *v_plane = chroma + chroma_stride * (image.height / 2);
+        for (int y = cy0; y < cy1; y++) {
+            const uint8_t *pu = chroma + y * chroma_stride;
+            const uint8_t *pv = v_plane + y * chroma_stride;
+            for (int x = cx0; x < cx1; x++) {
+                u += pu[x];
+                v += pv[x];
+            }
+        }
+    }
+    yuv_to_bgr(luma, (u + chroma_count / 2) / chroma_count, (v + chroma_count / 2) / chroma_count, bgr);
+}
+
+template<PixelFormat format>
+static void fill_rows(const RawImage &image, const Letterbox &letterbox, int channels, uint8_t *planes,
+                      int resized_w, int resized_h) {
+    std::vector<int> col_begin, col_end, row_begin, row_end;
+    footprints(image.width, resized_w, col_begin, col_end);
+    footprints(image.height, resized_h, row_begin, row_end);
+
+    size_t plane = (size_t)letterbox.input_w * letterbox.input_h;
+    uint8_t bgr[3];
+    for (int i = 0; i < resized_h; i++) {
+        size_t offset = (size_t)(letterbox.pad_top + i) * letterbox.input_w + letterbox.pad_left;
+        for (int j = 0; j < resized_w; j++) {
+            sample<format>(image, col_begin[j], col_end[j], row_begin[i], row_end[i], bgr);
+            for (int c = 0; c < channels; c++) {
+                planes[c * plane + offset + j] = bgr[c];
+            }
+        }
+    }
+}
+
+void fill_letterboxed(const RawImage &image, const Letterbox &letterbox, int channels, uint8_t *planes) {
+    int resized_w = (int)(letterbox.image_w * letterbox.scale_x + 0.5);
+    int resized_h = (int)(letterbox.image_h * letterbox.scale_y + 0.5);
+    channels = std::min(channels, 3);
+
+    // Black padding around the image, written once
+    size_t plane = (size_t)letterbox.input_w * letterbox.input_h;
+    int right = letterbox.input_w - resized_w - letterbox.pad_left;
+    for (int c = 0; c < channels; c++) {
+        uint8_t *dst = planes + c * plane;
+        for (int h = 0; h < letterbox.input_h; h++, dst += letterbox.input_w) {
+            if ((h < letterbox.pad_top) || (h >= letterbox.pad_top + resized_h)) {
+                memset(dst, 0, letterbox.input_w);
+            }
+            else {
+                memset(dst, 0, letterbox.pad_left);
+                memset(dst + letterbox.pad_left + resized_w, 0, right);
+            }
+        }
+    }
+
+    switch (image.format) {
+    case PIXEL_BGR:
+        fill_rows<PIXEL_BGR>(image, letterbox, channels, planes, resized_w, resized_h);
+        break;
+    case PIXEL_RGB:
+        fill_rows<PIXEL_RGB>(image, letterbox, channels, planes, resized_w, resized_h);
+        break;
+    case PIXEL_GRAY:
+        fill_rows<PIXEL_GRAY>(image, letterbox, channels, planes, resized_w, resized_h);
+        break;
+    case PIXEL_NV12:
+        fill_rows<PIXEL_NV12>(image, letterbox, channels, planes, resized_w, resized_h);
+        break;
+    case PIXEL_I420:
+        fill_rows<PIXEL_I420>(image, letterbox, channels, planes, resized_w, resized_h);
+        break;
+    }
+}
+
+void Detector::setLabelMap(LabelMap::Ptr labels, const ClassThresholds *class_thresholds) {
+    std::lock_guard<std::mutex> lock(this->model_mutex);
+    this->setModel(this->model? this->model->network : nullptr,
+                   labels? labels : (this->model? this->model->labels : nullptr),
+                   class_thresholds? *class_thresholds : (this->model? this->model->class_thresholds : ClassThresholds()));
+}
+
+// Called with model_mutex held. Requests that already took the previous model finish on it.
+void Detector::setModel(NetworkShape::Ptr network, LabelMap::Ptr labels, const ClassThresholds &class_thresholds) {
+    auto model = std::make_shared<Model>();
+    model->network = network;
+    model->labels  = labels;
+    model->class_thresholds = class_thresholds;
+    model->version = this->model? this->model->version + 1 : 1;
+    this->model = model;
+}
+
+std::shared_ptr<const Model> Detector::currentModel() {
+    std::lock_guard<std::mutex> lock(this->model_mutex);
+    if (!this->model || !this->model->network) {
+        throw std::logic_error("Model is not loaded");
+    }
+    return this->model;
+}
+
+// A retrained model usually keeps its classes, so the current labelmap stays by default
+void Detector::replaceNetwork(NetworkShape::Ptr network, LabelMap::Ptr labels, const ClassThresholds *class_thresholds) {
+    std::lock_guard<std::mutex> lock(this->model_mutex);
+    this->setModel(network, labels? labels : (this->model? this->model->labels : nullptr),
+                   class_thresholds? *class_thresholds : (this->model? this->model->class_thresholds : ClassThresholds()));
+}
+
+uint32_t Detector::modelVersion() {
+    std::lock_guard<std::mutex> lock(this->model_mutex);
+    return this->model? this->model->version : 0;
+}
+
+std::vector<Detections> Detector::inferBatch(std::vector<cv::Mat> &images) {
+    for (auto &img : images) {
+        if (img.empty()) {
+            throw std::logic_error("Failed to get frame from image file");
+        }
+    }
+    std::vector<Detections> results(images.size());
+    this->runBatch(this->currentModel(), images, results);
+    return results;
+}
+
+Detections Detector::inferRegions(cv::Mat &img, std::vector<cv::Rect> &regions, const DetectionFilter &filter) {
+    if (img.empty()) {
+        throw std::logic_error("Failed to get frame from image file");
+    }
+    auto model = this->currentModel();
+    return this->runRegions(model, img, regions, ClassRules(filter, model.get(), this->threshold));
+}
+
+// Rows of one region which pass the rules, in normalized full image coordinates
+void Detector::mergeRegion(std::vector<float> &merged, const std::vector<float> &output, const NetworkShape &network,
+                           const ClassRules &rules, const cv::Rect &region, const Letterbox &letterbox,
+                           const cv::Size &image) {
+    for (int obj = 0; obj < network.max_output_count; obj++) {
+        const float *row = &output[obj * network.object_size];
+        if (row[0] < 0) {
+            break;
+        }
+        if (row[2] < rules.minScore((int)row[1])) {
+            continue;
+        }
+        float xmin = std::min((float)region.width,  std::max(0.0f, letterbox.imageX(row[3])));
+        float ymin = std::min((float)region.height, std::max(0.0f, letterbox.imageY(row[4])));
+        float xmax = std::min((float)region.width,  std::max(0.0f, letterbox.imageX(row[5])));
+        float ymax = std::min((float)region.height, std::max(0.0f, letterbox.imageY(row[6])));
+        merged.push_back(0);
+        merged.push_back(row[1]);
+        merged.push_back(row[2]);
+        merged.push_back((region.x + xmin) / image.width);
+        merged.push_back((region.y + ymin) / image.height);
+        merged.push_back((region.x + xmax) / image.width);
+        merged.push_back((region.y + ymax) / image.height);
+    }
+}
+
+// Objects seen by overlapping regions are merged, then the result is laid out like a
+// single SSD output over the whole image so that parse() can consume it
+Detections Detector::mergedDetections(std::vector<float> &merged, const std::shared_ptr<const Model> &model,
+                                      const cv::Size &image) {
+    const NetworkShape &network = *model->network;
+    Detections detections;
+    non_max_suppression(merged, network.object_size, 0.5f);
+    merged.resize(std::min(merged.size(), (size_t)(network.max_output_count * network.object_size)));
+    if (merged.size() < (size_t)(network.max_output_count * network.object_size)) {
+        merged.resize(merged.size() + network.object_size, -1);
+    }
+    detections.data.swap(merged);
+    detections.letterbox = make_letterbox(image.width, image.height, image.width, image.height);
+    detections.model = model;
+    return detections;
+}
+
+Detections Detector::inferTiles(cv::Mat &img, int tile_size, float overlap, int max_tiles,
+                                const DetectionFilter &filter) {
+    if (img.empty()) {
+        throw std::logic_error("Failed to get frame from image file");
+    }
+    int img_w = img.size().width;
+    int img_h = img.size().height;
+    overlap = std::min(0.9f, std::max(0.0f, overlap));
+    auto model = this->currentModel();
+
+    // One pass over the whole frame catches objects larger than a tile. Tiles keep the
+    // aspect ratio of the network input and grow until the grid fits in max_tiles.
+    std::vector<cv::Rect> regions;
+    regions.push_back(cv::Rect(0, 0, img_w, img_h));
+    double aspect = (double)model->network->input_h / (double)model->network->input_w;
+    while ((tile_size > 0) && (max_tiles > 1)) {
+        int tile_w = std::min(tile_size, img_w);
+        int tile_h = std::min((int)(tile_size * aspect + 0.5), img_h);
+        int nx = tile_count(img_w, tile_w, overlap);
+        int ny = tile_count(img_h, tile_h, overlap);
+        if (nx * ny < 2) {
+            break;
+        }
+        if (nx * ny < max_tiles) {
+            for (int y = 0; y < ny; y++) {
+                for (int x = 0; x < nx; x++) {
+                    regions.push_back(cv::Rect(tile_position(img_w, tile_w, nx, x), tile_position(img_h, tile_h, ny, y), tile_w, tile_h));
+                }
+            }
+            break;
+        }
+        tile_size += tile_size / 4 + 1;
+    }
+
+    return this->runRegions(model, img, regions, ClassRules(filter, model.get(), this->threshold));
+}
+
+void Detector::collect(const Detections &detections, std::vector<float> &boxes, const DetectionFilter &filter) {
+    ClassRules rules(filter, detections.model.get(), this->threshold);
+    float img_w = (float)detections.letterbox.image_w;
+    float img_h = (float)detections.letterbox.image_h;
+    boxes.clear();
+    for_each_detection(detections, rules, filter, [&](int class_id, float score, const float *bbox, int) {
+        boxes.push_back((float)class_id);
+        boxes.push_back(score);
+        boxes.push_back(bbox[0] / img_w);
+        boxes.push_back(bbox[1] / img_h);
+        boxes.push_back(bbox[2] / img_w);
+        boxes.push_back(bbox[3] / img_h);
+    });
+}
+
+void Detector::parse(const Detections &detections, std::string &json, bool normalized,
+                     const DetectionFilter &filter) {
+    // Format straight from the output rows; the caller reuses json between requests so
+    // that its capacity is allocated only once
+    ClassRules rules(filter, detections.model.get(), this->threshold);
+    float img_w = (float)detections.letterbox.image_w;
+    float img_h = (float)detections.letterbox.image_h;
+    const LabelMap *labels = detections.model? detections.model->labels.get() : NULL;
+    json.clear();
+    json.push_back('[');
+    for_each_detection(detections, rules, filter, [&](int class_id, float score, const float *bbox, int track_id) {
+        if (json.size() > 1) {
+            json.push_back(',');
+        }
+        json.append("{\"bbox\":[");
+        for (int i = 0; i < 4; i++) {
+            if (i > 0) {
+                json.push_back(',');
+            }
+            if (normalized) {
+                json_append_float(json, bbox[i] / ((i % 2 == 0)? img_w : img_h));
+            } else {
+                json_append_int(json, (long)(bbox[i] + 0.5f));
+            }
+        }
+        json.append("],\"class\":");
+        json.append(labels? labels->literal(class_id) : "\"\"");
+        json.append(",\"class_id\":");
+        json_append_int(json, class_id);
+        json.append(",\"score\":");
+        json_append_float(json, score);
+        if (detections.tracked) {
+            json.append(",\"track_id\":");
+            json_append_int(json, track_id);
+        }
+        json.push_back('}');
+    });
+    json.push_back(']');
+}
+
+void Detector::pack(const Detections &detections, std::string &data, bool normalized,
+                    const DetectionFilter &filter, bool score_f32, bool box_f32) {
+    // Binary detection format, see doc/binary_format.md. 16-bit boxes are always in pixels.
+    ClassRules rules(filter, detections.model.get(), this->threshold);
+    float img_w = (float)detections.letterbox.image_w;
+    float img_h = (float)detections.letterbox.image_h;
+    normalized = normalized && box_f32;
+    uint8_t flags = (score_f32? 0x01 : 0) | (box_f32? 0x02 : 0) | (normalized? 0x04 : 0) |
+                    (detections.tracked? 0x08 : 0);
+
+    data.clear();
+    data.append("NXFD", 4);
+    binary_append_u8(data, 1);                      // format version
+    binary_append_u8(data, flags);
+    binary_append_u16(data, 0);                     // record count, filled in below
+    binary_append_u32(data, detections.model? detections.model->version : 0);
+    binary_append_u32(data, (uint32_t)detections.letterbox.image_w);
+    binary_append_u32(data, (uint32_t)detections.letterbox.image_h);
+
+    uint16_t count = 0;
+    for_each_detection(detections, rules, filter, [&](int class_id, float score, const float *bbox, int track_id) {
+        if (count == 0xffff) {
+            return;
+        }
+        count++;
+        binary_append_u16(data, (uint16_t)class_id);
+        if (score_f32) {
+            binary_append_f32(data, score);
+        } else {
+            binary_append_f16(data, score);
+        }
+        for (int i = 0; i < 4; i++) {
+            if (normalized) {
+                binary_append_f32(data, bbox[i] / ((i % 2 == 0)? img_w : img_h));
+            } else if (box_f32) {
+                binary_append_f32(data, bbox[i]);
+            } else {
+                binary_append_u16(data, (uint16_t)std::min(65535.0f, bbox[i] + 0.5f));
+            }
+        }
+        if (detections.tracked) {
+            binary_append_u32(data, (uint32_t)track_id);
+        }
+    });
+    data[6] = (char)(count & 0xff);
+    data[7] = (char)(count >> 8);
+}
+
+} // namespace NexInferenceEngine
@@ -0,0 +1,232 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#pragma once
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "nex_labelmap.h"
+#include "nex_model_benchmark.h"
+
+namespace NexInferenceEngine {
+
+// Geometry of the letterbox applied to an image to fit the network input: the image is
+// scaled by scale_x/scale_y (equal unless the rounding differs) and centered with padding.
+struct Letterbox {
+    int image_w;        // source image in pixels
+    int image_h;
+    int input_w;        // network input in pixels
+    int input_h;
+    float scale_x;      // network pixels per source pixel
+    float scale_y;
+    int pad_left;       // padding in network pixels
+    int pad_top;
+
+    // source image pixel of a normalized network output coordinate
+    float imageX(float x) const {return (x * this->input_w - this->pad_left) / this->scale_x;};
+    float imageY(float y) const {return (y * this->input_h - this->pad_top) / this->scale_y;};
+};
+
+Letterbox make_letterbox(int image_w, int image_h, int input_w, int input_h);
+
+// Uncompressed frames as cameras and decoders hand them over. NV12 and I420 are 4:2:0
+// BT.601 video range YUV, their chroma right below the luma plane: NV12 interleaved at
+// the luma stride, I420 as a U then a V plane at half of it.
+enum PixelFormat {
+    PIXEL_BGR,
+    PIXEL_RGB,
+    PIXEL_GRAY,
+    PIXEL_NV12,
+    PIXEL_I420
+};
+
+bool parse_pixel_format(const std::string &text, PixelFormat &format);
+const char *pixel_format_name(PixelFormat format);
+
+// A frame in a buffer owned by someone else
+struct RawImage {
+    PixelFormat format;
+    int width;
+    int height;
+    int stride;             // bytes from one row to the next, of the luma plane for YUV
+    const uint8_t *data;
+    size_t size;
+
+    RawImage(): format(PIXEL_BGR), width(0), height(0), stride(0), data(NULL), size(0) {};
+
+    // Stride 0 becomes the packed row. Throws std::invalid_argument when the frame does
+    // not fit the format or the buffer.
+    void validate();
+    // Converted to BGR, for what works on a decoded image (tiles, regions, motion, tracking)
+    cv::Mat toMat() const;
+};
+
+// Scale the frame into the letterbox and write it as planar BGR network input, with the
+// colour conversion in the same pass and no intermediate image. Shrinking averages the
+// source pixels under each input pixel, enlarging takes the nearest. The padding is black.
+void fill_letterboxed(const RawImage &image, const Letterbox &letterbox, int channels, uint8_t *planes);
+
+// Input and output layout of a loaded network, which a backend extends with what runs it
+class NetworkShape {
+public:
+    typedef std::shared_ptr<NetworkShape> Ptr;
+
+    int input_w;
+    int input_h;
+    int input_ch;
+    int object_size;
+    int max_output_count;
+
+    NetworkShape(): input_w(0), input_h(0), input_ch(0), object_size(0), max_output_count(0) {};
+    virtual ~NetworkShape() {};
+
+    Letterbox letterbox(const cv::Mat &img, cv::Mat &resized);
+};
+
+// Score thresholds keyed by class id or labelmap name
+typedef std::map<std::string, float> ClassThresholds;
+
+ClassThresholds parse_class_thresholds(const std::string &text);
+std::set<std::string> parse_class_list(const std::string &text);
+
+// Which detections go into a response, applied while the output rows are walked so that
+// nothing is formatted for a detection that is dropped. Classes are ids or labelmap names.
+struct DetectionFilter {
+    float threshold;                        // below 0 for the detector threshold
+    ClassThresholds class_thresholds;       // over threshold and the thresholds of the model
+    std::set<std::string> include_classes;  // empty for every class
+    std::set<std::string> exclude_classes;
+    int top_k;                              // highest scores only, 0 for all
+    float min_box_area;                     // in source image pixels
+
+    DetectionFilter(float threshold=-1): threshold(threshold), top_k(0), min_box_area(0) {};
+};
+
+// What a request runs against. Network and labels are replaced together, so a response
+// never names the classes of one model with the output of another.
+struct Model {
+    NetworkShape::Ptr network;  // null until a model is loaded
+    LabelMap::Ptr labels;       // null without a labelmap
+    ClassThresholds class_thresholds;
+    uint32_t version;
+};
+
+// Network output rows (image_id, label, conf, xmin, ymin, xmax, ymax) terminated by a
+// negative image_id, with the transform back to the source image and the model that ran.
+// Rows of tracked objects carry the track id in place of the image_id.
+struct Detections {
+    std::vector<float> data;
+    Letterbox letterbox;
+    std::shared_ptr<const Model> model;
+    bool tracked = false;
+};
+
+// A DetectionFilter resolved against the labels of one model into the lowest score each
+// class id needs, which is above any score for classes that are filtered out
+class ClassRules {
+private:
+    std::vector<float> min_scores;
+    float other_score;      // classes beyond the table
+
+    void set(const std::string &spec, float score, const LabelMap *labels, bool strict);
+
+public:
+    ClassRules(const DetectionFilter &filter, const Model *model, float threshold);
+
+    float minScore(int class_id) const {
+        return ((class_id >= 0) && ((size_t)class_id < this->min_scores.size()))? this->min_scores[class_id] : this->other_score;
+    };
+};
+
+// What requests run on. A backend loads networks and runs them on regions of an image;
+// thresholds, labels, tiling and the response formats are the same for every backend.
+class Detector {
+protected:
+    float threshold;
+
+    std::shared_ptr<const Model> model;
+    std::mutex model_mutex;
+
+    std::shared_ptr<const Model> currentModel();
+    void setModel(NetworkShape::Ptr network, LabelMap::Ptr labels, const ClassThresholds &class_thresholds);
+    // Labels and class thresholds stay as they are unless given
+    void replaceNetwork(NetworkShape::Ptr network, LabelMap::Ptr labels, const ClassThresholds *class_thresholds);
+
+    // Run the network of the model on every region and merge the results with mergeRegion()
+    // and mergedDetections()
+    virtual Detections runRegions(const std::shared_ptr<const Model> &model, cv::Mat &img,
+                                  std::vector<cv::Rect> &regions, const ClassRules &rules) = 0;
+    // Run the network of the model on every image, as many at a time as there are infer requests
+    virtual void runBatch(const std::shared_ptr<const Model> &model, std::vector<cv::Mat> &images,
+                          std::vector<Detections> &results) = 0;
+    static void mergeRegion(std::vector<float> &merged, const std::vector<float> &output, const NetworkShape &network,
+                            const ClassRules &rules, const cv::Rect &region, const Letterbox &letterbox,
+                            const cv::Size &image);
+    static Detections mergedDetections(std::vector<float> &merged, const std::shared_ptr<const Model> &model,
+                                       const cv::Size &image);
+
+public:
+    Detector(): threshold(0.5) {};
+    virtual ~Detector() {};
+
+    virtual void loadModel(std::string &model_xml, std::string &model_bin, LabelMap::Ptr labels=nullptr,
+                           const ClassThresholds *class_thresholds=NULL) = 0;
+    virtual bool loadedFromCache() {return false;};
+    // The current model with this batch size on nireq infer requests of its own, for
+    // run_benchmark(). Throws when no model is loaded.
+    virtual BenchmarkSession::Ptr openBenchmark(int batch, int nireq) = 0;
+    void setLabelMap(LabelMap::Ptr labels, const ClassThresholds *class_thresholds=NULL);
+    uint32_t modelVersion();
+    void setThreshold(float threshold) {this->threshold = threshold;};
+    cv::Mat openImage(std::string imagepath) {return cv::imread(imagepath);};
+    cv::Mat openImage(std::vector<char> raw_data) {return cv::imdecode(cv::Mat(raw_data), cv::IMREAD_COLOR);};
+    // Decodes straight from the buffer, which is not copied
+    cv::Mat openImage(char *raw_data, size_t size) {
+        return cv::imdecode(cv::Mat(1, (int)size, CV_8UC1, raw_data), cv::IMREAD_COLOR);
+    };
+    virtual Detections infer(cv::Mat &img) = 0;
+    // Straight from uncompressed pixels into the network input, see fill_letterboxed()
+    virtual Detections inferRaw(const RawImage &image) = 0;
+    // Detections of each image, all of them from the same model
+    std::vector<Detections> inferBatch(std::vector<cv::Mat> &images);
+    Detections inferRegions(cv::Mat &img, std::vector<cv::Rect> &regions, const DetectionFilter &filter=DetectionFilter());
+    Detections inferTiles(cv::Mat &img, int tile_size, float overlap=0.2, int max_tiles=16,
+                          const DetectionFilter &filter=DetectionFilter());
+    // Rows which pass the filter as (class_id, score, xmin, ymin, xmax, ymax) normalized to the source image
+    void collect(const Detections &detections, std::vector<float> &boxes, const DetectionFilter &filter=DetectionFilter());
+    void parse(const Detections &detections, std::string &json, bool normalized=true,
+               const DetectionFilter &filter=DetectionFilter());
+    void pack(const Detections &detections, std::string &data, bool normalized=true,
+              const DetectionFilter &filter=DetectionFilter(), bool score_f32=false, bool box_f32=false);
+};
+
+} // namespace NexInferenceEngine
@@ -23,9 +23,19 @@
  *
  *******************************************************************************
  */
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <fstream>
+#include <iomanip>
 #include <memory>
+#include <sstream>
 #include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
 
 #include <ext_list.hpp>
 
@@ -37,6 +47,41 @@ static std::string model_bin_filename(const std::string &filepath) {
     return filepath.substr(0, pos) + ".bin";
 }
 
+// 64-bit FNV-1a, used to key the compiled network cache
+static void fnv1a_update(uint64_t &hash, const char *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= (uint8_t)data[i];
+        hash *= 1099511628211ULL;
+    }
+}
+
+static void fnv1a_update(uint64_t &hash, const std::string &str) {
+    // include the terminating null so that adjacent fields cannot run together
+    fnv1a_update(hash, str.c_str(), str.size() + 1);
+}
+
+static std::string read_file(const std::string &filepath) {
+    std::ifstream fp(filepath, std::ifstream::binary);
+    if (!fp) {
+        throw std::logic_error("Cannot open " + filepath);
+    }
+    std::ostringstream content;
+    content << fp.rdbuf();
+    return content.str();
+}
+
+static void fnv1a_update_file(uint64_t &hash, const std::string &filepath) {
+    std::ifstream fp(filepath, std::ifstream::binary);
+    if (!fp) {
+        throw std::logic_error("Cannot open " + filepath);
+    }
+    std::vector<char> buffer(1024*1024);
+    while (fp) {
+        fp.read(buffer.data(), buffer.size());
+        fnv1a_update(hash, buffer.data(), (size_t)fp.gcount());
+    }
+}
+
 namespace NexInferenceEngine {
 
 void display_intel_ie_version() {
@@ -46,21 +91,22 @@ void display_intel_ie_version() {
 }
 
 ObjectDetection::ObjectDetection(std::string &app_path, std::string &device) {
+    this->network_from_cache = false;
+    this->infer_request_count = 1;
     this->loadPlugin(app_path, device);
-    this->input_w  = 0;
-    this->input_h  = 0;
-    this->input_ch = 0;
-    this->setThreshold(0.5);
 }
 
 ObjectDetection::ObjectDetection(std::string &app_path, std::string &device, std::string &model_xml, float threshold) {
     std::string model_bin = model_bin_filename(model_xml);
+    this->network_from_cache = false;
+    this->infer_request_count = 1;
     this->loadPlugin(app_path, device);
     this->loadModel(model_xml, model_bin);
     this->setThreshold(threshold);
 }
 
 void ObjectDetection::loadPlugin(std::string &app_path, std::string &device) {
+    this->device = device;
     this->plugin = PluginDispatcher({this->findPluginPath(), ""}).getPluginByDevice(device);
     if (device.find("CPU") != std::string::npos) {
         auto ext_path = app_path + "/lib/libcpu_extension.so";
@@ -75,7 +121,7 @@ std::string ObjectDetection::findPluginPath() {
     return plugin_path;
 }
 
-std::string ObjectDetection::validateNetwork(CNNNetReader &reader) {
+std::string ObjectDetection::validateNetwork(CNNNetReader &reader, Network &network) {
     // Validate network input
     // SSD-based network should have one input and one output
     // https://software.intel.com/en-us/articles/OpenVINO-InferEngine #Understanding Inference Engine Memory Primitives
@@ -96,15 +142,15 @@ std::string ObjectDetection::validateNetwork(CNNNetReader &reader) {
     }
 
     DataPtr &output = output_info.begin()->second;
-    this->output_type = output_info.begin()->first;
+    network.output_type = output_info.begin()->first;
 
     const SizeVector output_dims = output->getTensorDesc().getDims();
-    this->max_output_count = output_dims[2];
-    this->object_size = output_dims[3];
+    network.max_output_count = output_dims[2];
+    network.object_size = output_dims[3];
     if (output_dims.size() != 4) {
         throw std::logic_error("Incorrect output dimensions for SSD");
     }
-    if (this->object_size != 7) {
+    if (network.object_size != 7) {
         throw std::logic_error("Output should have 7 as a last dimension");
     }
     output->setPrecision(Precision::FP32);
@@ -113,109 +159,353 @@ std::string ObjectDetection::validateNetwork(CNNNetReader &reader) {
     return input_type;
 }
 
-void ObjectDetection::loadModel(std::string &model_xml, std::string &model_bin) {
-    CNNNetReader reader;
+std::string ObjectDetection::cachedNetworkPath(std::string &model_xml, MappedFile &model_bin) {
+    if (this->cache_dir.empty()) {
+        return "";
+    }
+    if ((mkdir(this->cache_dir.c_str(), 0755) != 0) && (errno != EEXIST)) {
+        throw std::logic_error("Cannot create cache directory " + this->cache_dir);
+    }
 
-    reader.ReadNetwork(model_xml);
-    reader.getNetwork().setBatchSize(1);
-    reader.ReadWeights(model_bin);
+    // A compiled network is only valid for the same IR, device, plugin config and IE build
+    uint64_t hash = 14695981039346656037ULL;
+    fnv1a_update_file(hash, model_xml);
+    fnv1a_update(hash, (const char*)model_bin.data(), model_bin.size());
+    fnv1a_update(hash, this->device);
+    for (auto &item : this->network_config) {
+        fnv1a_update(hash, item.first);
+        fnv1a_update(hash, item.second);
+    }
+    fnv1a_update(hash, std::string(GetInferenceEngineVersion()->buildNumber));
 
-    auto input_type = this->validateNetwork(reader);
-    this->network = this->plugin.LoadNetwork(reader.getNetwork(), {});
-    this->infer_request = this->network.CreateInferRequest();
-    this->input_blob = this->infer_request.GetBlob(input_type);
-    auto blob_size = this->input_blob->getTensorDesc().getDims();
-    this->input_w  = (int)blob_size[3];
-    this->input_h  = (int)blob_size[2];
-    this->input_ch = (int)blob_size[1];
+    std::ostringstream stream;
+    stream << this->cache_dir << "/" << std::hex << std::setw(16) << std::setfill('0') << hash << ".blob";
+    return stream.str();
 }
 
-const float* ObjectDetection::infer(cv::Mat &img) {
-    if (img.empty()) {
-        throw std::logic_error("Failed to get frame from image file");
+void ObjectDetection::loadModel(std::string &model_xml) {
+    std::string model_bin = model_bin_filename(model_xml);
+    this->loadModel(model_xml, model_bin);
+}
+
+void ObjectDetection::loadModel(std::string &model_xml, std::string &model_bin, LabelMap::Ptr labels,
+                                const ClassThresholds *class_thresholds) {
+    this->replaceNetwork(this->loadNetwork(model_xml, model_bin), labels, class_thresholds);
+}
+
+CNNNetReader::Ptr ObjectDetection::readNetwork(const std::string &xml, MappedFile &weights, int batch,
+                                               Network &network) {
+    auto reader = std::make_shared<CNNNetReader>();
+    reader->ReadNetwork(xml.data(), xml.size());
+    reader->getNetwork().setBatchSize(batch);
+
+    network.input_type = this->validateNetwork(*reader, network);
+    // Hand the mapped file to the reader instead of letting ReadWeights() copy it to the heap
+    TensorDesc weights_desc(Precision::U8, {weights.size()}, Layout::C);
+    reader->SetWeights(make_shared_blob<uint8_t>(weights_desc, weights.data(), weights.size()));
+    return reader;
+}
+
+// Export to a file of its own next to the blob, then rename it into place, so that workers
+// and loads running together never write into the same file or publish a torn one
+void ObjectDetection::exportNetwork(Network &network, const std::string &cache_path) {
+    std::string temp_template = cache_path + ".XXXXXX";
+    std::vector<char> temp_path(temp_template.begin(), temp_template.end());
+    temp_path.push_back('\0');
+    int fd = mkstemp(temp_path.data());
+    if (fd < 0) {
+        return;
+    }
+    close(fd);
+    // Not every plugin supports Export() (CPU does not), so failing here is not an error
+    try {
+        network.executable.Export(temp_path.data());
+        if (rename(temp_path.data(), cache_path.c_str()) == 0) {
+            return;
+        }
+    }
+    catch (std::exception const &) {
     }
-    int img_w = img.size().width;
-    int img_h = img.size().height;
-
-    // Resize and keep aspect ratio
-    if (this->input_w != img_w || this->input_h != img_h) {
-        cv::Mat img_new;
-        double ratio_w = (double)this->input_w / (double)img_w;
-        double ratio_h = (double)this->input_w / (double)img_h;
-        double ratio = (ratio_w < ratio_h)? ratio_w : ratio_h;
-        int interpolation = (ratio < 1.0)? cv::INTER_AREA : cv::INTER_CUBIC;
-        cv::resize(img, img_new, cv::Size(), ratio, ratio, interpolation);
-
-        int resized_w = img_new.size().width;
-        int resized_h = img_new.size().height;
-        int top = 0;
-        int bottom = 0;
-        int left = 0;
-        int right = 0;
-        if (resized_w < this->input_w) {
-            left = (this->input_w - resized_w) / 2;
-            right = this->input_w - left;
+    remove(temp_path.data());
+}
+
+Network::Ptr ObjectDetection::loadNetwork(std::string &model_xml, std::string &model_bin) {
+    ScopedAffinity pin(this->infer_cpus);
+    auto network = std::make_shared<Network>();
+    network->xml = read_file(model_xml);
+    auto weights = std::make_shared<MappedFile>(model_bin.empty()? model_bin_filename(model_xml) : model_bin);
+    auto reader = this->readNetwork(network->xml, *weights, 1, *network);
+
+    auto cache_path = this->cachedNetworkPath(model_xml, *weights);
+    struct stat buffer;
+    bool from_cache = false;
+    if (!cache_path.empty() && (stat(cache_path.c_str(), &buffer) == 0)) {
+        try {
+            network->executable = this->plugin.ImportNetwork(cache_path, this->network_config);
+            from_cache = true;
         }
-        if (resized_h < this->input_h) {
-            top = (this->input_h - resized_h) / 2;
-            bottom = this->input_h - top;
+        catch (std::exception const &) {
+            // stale or unreadable blob, compile the network again below
+            remove(cache_path.c_str());
         }
-        if (top + left > 0) {
-            img = img_new;
-            cv::copyMakeBorder(img, img_new, top, bottom, left, right, cv::BORDER_CONSTANT);
-            img = img_new;
+    }
+    if (!from_cache) {
+        network->executable = this->plugin.LoadNetwork(reader->getNetwork(), this->network_config);
+        if (!cache_path.empty()) {
+            this->exportNetwork(*network, cache_path);
         }
     }
+    network->weights = weights;
+    network->createRequests(this->infer_request_count);
+    this->network_from_cache = from_cache;
+    return network;
+}
+
+void Network::createRequests(int count) {
+    std::lock_guard<std::mutex> lock(this->request_mutex);
+    this->infer_requests.clear();
+    this->input_blobs.clear();
+    this->idle_requests.clear();
+    for (int idx = 0; idx < count; idx++) {
+        this->infer_requests.push_back(this->executable.CreateInferRequest());
+        this->input_blobs.push_back(this->infer_requests[idx].GetBlob(this->input_type));
+        this->idle_requests.push_back(idx);
+    }
+    auto blob_size = this->input_blobs[0]->getTensorDesc().getDims();
+    this->input_w  = (int)blob_size[3];
+    this->input_h  = (int)blob_size[2];
+    this->input_ch = (int)blob_size[1];
+}
+
+int Network::acquireRequest(bool wait) {
+    std::unique_lock<std::mutex> lock(this->request_mutex);
+    while (this->idle_requests.empty()) {
+        if (!wait) {
+            return -1;
+        }
+        this->request_cv.wait(lock);
+    }
+    int idx = this->idle_requests.back();
+    this->idle_requests.pop_back();
+    return idx;
+}
+
+void Network::releaseRequest(int idx) {
+    {
+        std::lock_guard<std::mutex> lock(this->request_mutex);
+        this->idle_requests.push_back(idx);
+    }
+    this->request_cv.notify_one();
+}
 
-    // place resized image data into blob
-    uint8_t* blob_data = static_cast<uint8_t*>(this->input_blob->buffer());
-    for (size_t c = 0; c < this->input_ch; c++) {
-        for (size_t h = 0; h < this->input_h; h++) {
-            for (size_t w = 0; w < this->input_w; w++) {
-                blob_data[c * this->input_w * this->input_h + h * this->input_h + w] = img.at<cv::Vec3b>(h, w)[c];
+void Network::fillBlob(int idx, const cv::Mat &img) {
+    // place resized image data into blob (interleaved HWC to planar CHW)
+    uint8_t* blob_data = static_cast<uint8_t*>(this->input_blobs[idx]->buffer());
+    size_t plane = (size_t)this->input_w * this->input_h;
+    int channels = img.channels();
+    for (int h = 0; h < this->input_h; h++) {
+        const uint8_t *row = img.ptr<uint8_t>(h);
+        for (int c = 0; c < this->input_ch; c++) {
+            uint8_t *dst = blob_data + c * plane + (size_t)h * this->input_w;
+            for (int w = 0; w < this->input_w; w++) {
+                dst[w] = row[w * channels + c];
             }
         }
     }
+}
 
-    // Do infer
-    this->infer_request.Infer();
+void Network::fillBlob(int idx, const RawImage &image, const Letterbox &letterbox) {
+    fill_letterboxed(image, letterbox, this->input_ch, static_cast<uint8_t*>(this->input_blobs[idx]->buffer()));
+}
 
-    return this->infer_request.GetBlob(this->output_type)->buffer().as<PrecisionTrait<Precision::FP32>::value_type*>();
+void Network::collectOutput(int idx, std::vector<float> &output) {
+    const float *detections = this->infer_requests[idx].GetBlob(this->output_type)->buffer().as<PrecisionTrait<Precision::FP32>::value_type*>();
+    output.assign(detections, detections + this->max_output_count * this->object_size);
 }
 
-json::value ObjectDetection::parse(const float *detections, bool normalized, float threshold) {
-    float th = (threshold < 0)? this->threshold : threshold;
-    std::vector<json::value> objs;
-    for (int idx = 0; idx < this->max_output_count; idx++) {
-        if (detections[idx * this->object_size + 0] < 0) {
-            break;
-        }
+// A model loaded again with another batch size and its own infer requests
+class NetworkBenchmark : public BenchmarkSession {
+private:
+    ScopedAffinity pin;     // on the inference CPUs like requests, released last
+    Network::Ptr network;   // keeps the weights mapped
+    ExecutableNetwork executable;
+    std::vector<InferRequest> infer_requests;
+
+public:
+    NetworkBenchmark(const std::vector<int> &cpus, Network::Ptr network): pin(cpus), network(network) {};
+
+    void load(InferencePlugin &plugin, const std::map<std::string, std::string> &config, CNNNetwork cnn, int nireq);
+    int requests() {return (int)this->infer_requests.size();};
+    void start(int idx) {this->infer_requests[idx].StartAsync();};
+    void wait(int idx) {this->infer_requests[idx].Wait(IInferRequest::WaitMode::RESULT_READY);};
+};
 
-        float score = detections[idx * this->object_size + 2];
-        if (score < th) {
-            continue;
+void NetworkBenchmark::load(InferencePlugin &plugin, const std::map<std::string, std::string> &config, CNNNetwork cnn,
+                            int nireq) {
+    this->executable = plugin.LoadNetwork(cnn, config);
+
+    // Noise rather than zeros, so that no plugin can take a shortcut on the input
+    uint32_t state = 12345;
+    for (int idx = 0; idx < nireq; idx++) {
+        this->infer_requests.push_back(this->executable.CreateInferRequest());
+        Blob::Ptr blob = this->infer_requests[idx].GetBlob(this->network->input_type);
+        uint8_t *data = static_cast<uint8_t*>(blob->buffer());
+        for (size_t i = 0; i < blob->size(); i++) {
+            state = state * 1664525u + 1013904223u;
+            data[i] = (uint8_t)(state >> 24);
         }
+    }
+}
+
+BenchmarkSession::Ptr ObjectDetection::openBenchmark(int batch, int nireq) {
+    auto network = std::static_pointer_cast<Network>(this->currentModel()->network);
+    std::unique_ptr<NetworkBenchmark> session(new NetworkBenchmark(this->infer_cpus, network));
+    // A reader of its own, the network of the model goes on serving requests meanwhile
+    Network shape;
+    auto reader = this->readNetwork(network->xml, *network->weights, batch, shape);
+    session->load(this->plugin, this->network_config, reader->getNetwork(), nireq);
+    return BenchmarkSession::Ptr(session.release());
+}
+
+Detections ObjectDetection::infer(cv::Mat &img) {
+    if (img.empty()) {
+        throw std::logic_error("Failed to get frame from image file");
+    }
+    ScopedAffinity pin(this->infer_cpus);
+    Detections detections;
+    detections.model = this->currentModel();
+    Network &network = static_cast<Network&>(*detections.model->network);
+    cv::Mat resized;
+    detections.letterbox = network.letterbox(img, resized);
+
+    // Do infer
+    int idx = network.acquireRequest();
+    try {
+        network.fillBlob(idx, resized);
+        network.infer_requests[idx].Infer();
+        network.collectOutput(idx, detections.data);
+    }
+    catch (...) {
+        network.releaseRequest(idx);
+        throw;
+    }
+    network.releaseRequest(idx);
+
+    return detections;
+}
 
-        json::value obj;
-        obj["class_id"] = json::value::number(static_cast<int>(detections[idx * this->object_size + 1]));
-        obj["class"]    = json::value::string("");
-        obj["score"]    = json::value::number(score);
-        obj["bbox"]     = json::value::array(4);
-        if (normalized) {
-            obj["bbox"][0] = json::value::number(detections[idx * this->object_size + 3]);   // xmin
-            obj["bbox"][1] = json::value::number(detections[idx * this->object_size + 4]);   // ymin
-            obj["bbox"][2] = json::value::number(detections[idx * this->object_size + 5]);   // xmax
-            obj["bbox"][3] = json::value::number(detections[idx * this->object_size + 6]);   // ymax
-        } else {
-            obj["bbox"][0] = json::value::number((int)(detections[idx * this->object_size + 3] * this->input_w));  // xmin
-            obj["bbox"][1] = json::value::number((int)(detections[idx * this->object_size + 4] * this->input_h));  // ymin
-            obj["bbox"][2] = json::value::number((int)(detections[idx * this->object_size + 5] * this->input_w));  // xmax
-            obj["bbox"][3] = json::value::number((int)(detections[idx * this->object_size + 6] * this->input_h));  // ymax
+Detections ObjectDetection::inferRaw(const RawImage &image) {
+    ScopedAffinity pin(this->infer_cpus);
+    Detections detections;
+    detections.model = this->currentModel();
+    Network &network = static_cast<Network&>(*detections.model->network);
+    detections.letterbox = make_letterbox(image.width, image.height, network.input_w, network.input_h);
+
+    int idx = network.acquireRequest();
+    try {
+        network.fillBlob(idx, image, detections.letterbox);
+        network.infer_requests[idx].Infer();
+        network.collectOutput(idx, detections.data);
+    }
+    catch (...) {
+        network.releaseRequest(idx);
+        throw;
+    }
+    network.releaseRequest(idx);
+
+    return detections;
+}
+
+Detections ObjectDetection::runRegions(const std::shared_ptr<const Model> &model, cv::Mat &img,
+                                       std::vector<cv::Rect> &regions, const ClassRules &rules) {
+    ScopedAffinity pin(this->infer_cpus);
+    Network &network = static_cast<Network&>(*model->network);
+
+    // Start as many regions as there are idle infer requests, then collect the oldest one
+    // whenever the pool runs dry. Rows are mapped to normalized full image coordinates.
+    std::vector<float> merged;
+    std::vector<float> output;
+    std::vector<Letterbox> letterboxes(regions.size());
+    std::vector<std::pair<int, size_t>> pending;    // (infer request, region)
+    size_t next = 0;
+    try {
+        while ((next < regions.size()) || !pending.empty()) {
+            int idx = (next < regions.size())? network.acquireRequest(pending.empty()) : -1;
+            if (idx >= 0) {
+                pending.push_back(std::make_pair(idx, next));
+                cv::Mat resized;
+                letterboxes[next] = network.letterbox(img(regions[next]), resized);
+                next++;
+                network.fillBlob(idx, resized);
+                network.infer_requests[idx].StartAsync();
+                continue;
+            }
+
+            idx = pending.front().first;
+            cv::Rect &region = regions[pending.front().second];
+            Letterbox &letterbox = letterboxes[pending.front().second];
+            network.infer_requests[idx].Wait(IInferRequest::WaitMode::RESULT_READY);
+            network.collectOutput(idx, output);
+            pending.erase(pending.begin());
+            network.releaseRequest(idx);
+
+            mergeRegion(merged, output, network, rules, region, letterbox, img.size());
         }
-        objs.push_back(obj);
     }
+    catch (...) {
+        for (auto &item : pending) {
+            try {
+                network.infer_requests[item.first].Wait(IInferRequest::WaitMode::RESULT_READY);
+            }
+            catch (...) {}
+            network.releaseRequest(item.first);
+        }
+        throw;
+    }
+
+    return mergedDetections(merged, model, img.size());
+}
+
+void ObjectDetection::runBatch(const std::shared_ptr<const Model> &model, std::vector<cv::Mat> &images,
+                               std::vector<Detections> &results) {
+    ScopedAffinity pin(this->infer_cpus);
+    Network &network = static_cast<Network&>(*model->network);
+
+    // Pipelined like runRegions(), each image keeps its own output
+    std::vector<std::pair<int, size_t>> pending;    // (infer request, image)
+    size_t next = 0;
+    try {
+        while ((next < images.size()) || !pending.empty()) {
+            int idx = (next < images.size())? network.acquireRequest(pending.empty()) : -1;
+            if (idx >= 0) {
+                pending.push_back(std::make_pair(idx, next));
+                cv::Mat resized;
+                results[next].model = model;
+                results[next].letterbox = network.letterbox(images[next], resized);
+                next++;
+                network.fillBlob(idx, resized);
+                network.infer_requests[idx].StartAsync();
+                continue;
+            }
 
-    return json::value::array(objs);
+            idx = pending.front().first;
+            Detections &detections = results[pending.front().second];
+            network.infer_requests[idx].Wait(IInferRequest::WaitMode::RESULT_READY);
+            network.collectOutput(idx, detections.data);
+            pending.erase(pending.begin());
+            network.releaseRequest(idx);
+        }
+    }
+    catch (...) {
+        for (auto &item : pending) {
+            try {
+                network.infer_requests[item.first].Wait(IInferRequest::WaitMode::RESULT_READY);
+            }
+            catch (...) {}
+            network.releaseRequest(item.first);
+        }
+        throw;
+    }
 }
 
 }; // namespace NexInferenceEngine
\ No newline at end of file
@@ -24,7 +24,13 @@
  *******************************************************************************
  */
 #pragma once
+#include <atomic>
+#include <condition_variable>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -33,6 +39,10 @@
 
 #include <inference_engine.hpp>
 
+#include "nex_detector.h"
+#include "nex_mapped_file.h"
+#include "nex_topology.h"
+
 using namespace InferenceEngine;
 using namespace web;
 
@@ -40,41 +50,77 @@ namespace NexInferenceEngine {
 
 void display_intel_ie_version();
 
-class ObjectDetection {
+// A compiled network and its pool of infer requests, each with its own input blob. The
+// requests running on it keep it alive, so a newly loaded model can replace it any time.
+class Network : public NetworkShape {
 private:
-    float threshold;
+    std::vector<int> idle_requests;
+    std::mutex request_mutex;
+    std::condition_variable request_cv;
+
+public:
+    typedef std::shared_ptr<Network> Ptr;
 
-    int input_w;
-    int input_h;
-    int input_ch;
+    ExecutableNetwork executable;
+    std::string xml;            // the IR with the weights, to read the network again for benchmarks
+    MappedFile::Ptr weights;
+    std::vector<InferRequest> infer_requests;
+    std::vector<Blob::Ptr> input_blobs;
+    std::string input_type;
     std::string output_type;
 
+    void createRequests(int count);
+    int acquireRequest(bool wait=true);
+    void releaseRequest(int idx);
+    void fillBlob(int idx, const cv::Mat &img);
+    void fillBlob(int idx, const RawImage &image, const Letterbox &letterbox);
+    void collectOutput(int idx, std::vector<float> &output);
+};
+
+// The OpenVINO backend
+class ObjectDetection : public Detector {
+private:
+    std::string device;
+    std::string cache_dir;
+    std::map<std::string, std::string> network_config;
+    std::atomic<bool> network_from_cache;   // of the last network loaded
+    int infer_request_count;
+    std::vector<int> infer_cpus;    // empty to run anywhere
+
     InferencePlugin plugin;
-    ExecutableNetwork network;
-    InferRequest infer_request;
-    Blob::Ptr input_blob;
-    uint8_t* blob_data;
-    int object_size;
-    int max_output_count;
-
-    std::string validateNetwork(CNNNetReader &reader);
+
+    std::string validateNetwork(CNNNetReader &reader, Network &network);
+    CNNNetReader::Ptr readNetwork(const std::string &xml, MappedFile &weights, int batch, Network &network);
     std::string findPluginPath();
     void loadPlugin(std::string &app_path, std::string &device);
+    std::string cachedNetworkPath(std::string &model_xml, MappedFile &model_bin);
+    void exportNetwork(Network &network, const std::string &cache_path);
+    Network::Ptr loadNetwork(std::string &model_xml, std::string &model_bin);
+
+protected:
+    Detections runRegions(const std::shared_ptr<const Model> &model, cv::Mat &img, std::vector<cv::Rect> &regions,
+                          const ClassRules &rules);
+    void runBatch(const std::shared_ptr<const Model> &model, std::vector<cv::Mat> &images,
+                  std::vector<Detections> &results);
 
 public:
     ObjectDetection(std::string &app_path, std::string &device);
     ObjectDetection(std::string &app_path, std::string &device, std::string &model_xml, float threshold=0.5);
 
-    void loadModel(std::string &model_xml, std::string &model_bin);
-    void setThreshold(float threshold) {this->threshold = threshold;};
-    cv::Mat openImage(std::string imagepath) {return cv::imread(imagepath);};
-    cv::Mat openImage(std::vector<char> raw_data) {return cv::imdecode(cv::Mat(raw_data), cv::IMREAD_COLOR);};
-    cv::Mat openImage(char *raw_data, size_t size) {
-        std::vector<char> vec(raw_data, raw_data + size);
-        return cv::imdecode(cv::Mat(vec), cv::IMREAD_COLOR);
-    };
-    const float* infer(cv::Mat &img);
-    json::value parse(const float *detections, bool normalized=true, float threshold=-1);
+    void loadModel(std::string &model_xml);
+    void loadModel(std::string &model_xml, std::string &model_bin, LabelMap::Ptr labels=nullptr,
+                   const ClassThresholds *class_thresholds=NULL);
+    void setCacheDir(const std::string &cache_dir) {this->cache_dir = cache_dir;};
+    // Load networks and run inference on these CPUs, so that plugin threads and the
+    // input blobs (first touched there) stay on their NUMA node
+    void setInferenceCpus(const std::vector<int> &cpus) {this->infer_cpus = cpus;};
+    void setConfig(const std::string &key, const std::string &value) {this->network_config[key] = value;};
+    bool loadedFromCache() {return this->network_from_cache;};
+    void setInferRequests(int count) {this->infer_request_count = (count < 1)? 1 : count;};
+    // The model read again with this batch size, apart from the network serving requests
+    BenchmarkSession::Ptr openBenchmark(int batch, int nireq);
+    Detections infer(cv::Mat &img);
+    Detections inferRaw(const RawImage &image);
 };
 
-} // namespace NexInferenceEngine
\ No newline at end of file
+} // namespace NexInferenceEngine
@@ -0,0 +1,117 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#include <cmath>
+#include <cstdint>
+
+#include "nex_json_writer.h"
+
+namespace NexInferenceEngine {
+
+static const int FLOAT_DECIMALS = 6;
+static const uint64_t FLOAT_SCALE = 1000000;
+
+static void append_digits(std::string &out, uint64_t value) {
+    char buffer[20];
+    int pos = sizeof(buffer);
+    do {
+        buffer[--pos] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    out.append(buffer + pos, sizeof(buffer) - pos);
+}
+
+void json_append_int(std::string &out, long value) {
+    if (value < 0) {
+        out.push_back('-');
+        append_digits(out, (uint64_t)(-(value + 1)) + 1);
+    }
+    else {
+        append_digits(out, (uint64_t)value);
+    }
+}
+
+void json_append_float(std::string &out, float value) {
+    // Fixed point with up to 6 decimals, trailing zeros dropped; scores and normalized
+    // coordinates do not need more. NaN and infinity are not valid JSON.
+    if (!std::isfinite(value)) {
+        out.append("null");
+        return;
+    }
+    double number = value;
+    if (number < 0) {
+        number = -number;
+        out.push_back('-');
+    }
+    if (number >= 1e12) {
+        append_digits(out, (uint64_t)number);
+        return;
+    }
+    uint64_t fixed = (uint64_t)(number * FLOAT_SCALE + 0.5);
+    append_digits(out, fixed / FLOAT_SCALE);
+    uint64_t fraction = fixed % FLOAT_SCALE;
+    if (fraction == 0) {
+        return;
+    }
+    char buffer[FLOAT_DECIMALS + 1];
+    buffer[0] = '.';
+    for (int pos = FLOAT_DECIMALS; pos > 0; pos--) {
+        buffer[pos] = (char)('0' + fraction % 10);
+        fraction /= 10;
+    }
+    int length = FLOAT_DECIMALS + 1;
+    while (buffer[length - 1] == '0') {
+        length--;
+    }
+    out.append(buffer, length);
+}
+
+void json_append_string(std::string &out, const std::string &value) {
+    static const char hex[] = "0123456789abcdef";
+    out.push_back('"');
+    for (char ch : value) {
+        switch (ch) {
+            case '"':  out.append("\\\""); break;
+            case '\\': out.append("\\\\"); break;
+            case '\b': out.append("\\b"); break;
+            case '\f': out.append("\\f"); break;
+            case '\n': out.append("\\n"); break;
+            case '\r': out.append("\\r"); break;
+            case '\t': out.append("\\t"); break;
+            default:
+                if ((unsigned char)ch < 0x20) {
+                    out.append("\\u00");
+                    out.push_back(hex[(ch >> 4) & 0x0f]);
+                    out.push_back(hex[ch & 0x0f]);
+                }
+                else {
+                    out.push_back(ch);
+                }
+        }
+    }
+    out.push_back('"');
+}
+
+} // namespace NexInferenceEngine
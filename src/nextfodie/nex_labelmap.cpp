@@ -0,0 +1,232 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "nex_json_writer.h"
+#include "nex_labelmap.h"
+
+// Large enough for any detection model, small enough that a bogus id cannot exhaust memory
+static const long max_class_id = 65535;
+
+// Tokens of the protobuf text format: '{', '}', ':', quoted strings (unescaped) and words
+static bool next_token(const std::string &text, size_t &pos, std::string &token, bool &quoted) {
+    while (pos < text.size()) {
+        if (isspace((unsigned char)text[pos])) {
+            pos++;
+        }
+        else if (text[pos] == '#') {
+            pos = text.find('\n', pos);
+            if (pos == std::string::npos) {
+                pos = text.size();
+            }
+        }
+        else {
+            break;
+        }
+    }
+    if (pos >= text.size()) {
+        return false;
+    }
+
+    token.clear();
+    quoted = false;
+    char c = text[pos];
+    if ((c == '{') || (c == '}') || (c == ':')) {
+        token.push_back(c);
+        pos++;
+    }
+    else if ((c == '"') || (c == '\'')) {
+        quoted = true;
+        for (pos++; (pos < text.size()) && (text[pos] != c); pos++) {
+            if ((text[pos] == '\\') && (pos + 1 < text.size())) {
+                pos++;
+            }
+            token.push_back(text[pos]);
+        }
+        if (pos >= text.size()) {
+            throw std::invalid_argument("Unterminated string in labelmap");
+        }
+        pos++;
+    }
+    else {
+        while ((pos < text.size()) && !isspace((unsigned char)text[pos]) && (text.find_first_of("{}:\"'#", pos) != pos)) {
+            token.push_back(text[pos++]);
+        }
+    }
+    return true;
+}
+
+static long parse_class_id(const std::string &token) {
+    char *end = NULL;
+    long id = strtol(token.c_str(), &end, 10);
+    if (token.empty() || (*end != '\0') || (id < 0) || (id > max_class_id)) {
+        throw std::invalid_argument("Invalid class id in labelmap (" + token + ")");
+    }
+    return id;
+}
+
+static std::string trim(const std::string &text) {
+    size_t start = text.find_first_not_of(" \t\r\n");
+    if (start == std::string::npos) {
+        return "";
+    }
+    size_t end = text.find_last_not_of(" \t\r\n");
+    return text.substr(start, end - start + 1);
+}
+
+namespace NexInferenceEngine {
+
+void LabelMap::add(long id, const std::string &name, std::unordered_map<std::string, int> &interned) {
+    if ((size_t)id >= this->index.size()) {
+        this->index.resize(id + 1, -1);
+    }
+    auto it = interned.find(name);
+    if (it != interned.end()) {
+        this->index[id] = it->second;
+        return;
+    }
+    this->index[id] = (int)this->names.size();
+    interned[name] = this->index[id];
+    this->names.push_back(name);
+    this->literals.push_back("");
+    json_append_string(this->literals.back(), name);
+}
+
+LabelMap::Ptr LabelMap::parse(const std::string &text) {
+    auto labelmap = std::make_shared<LabelMap>();
+    std::unordered_map<std::string, int> interned;
+    size_t pos = 0;
+    std::string token;
+    bool quoted = false;
+
+    if (!next_token(text, pos, token, quoted) || quoted || (token != "item")) {
+        // Plain text list, one name per line, blank lines leave their id unnamed
+        std::istringstream stream(text);
+        std::string line;
+        for (long id = 0; std::getline(stream, line); id++) {
+            line = trim(line);
+            if (!line.empty()) {
+                if (id > max_class_id) {
+                    throw std::invalid_argument("Too many classes in labelmap");
+                }
+                labelmap->add(id, line, interned);
+            }
+        }
+        return labelmap;
+    }
+
+    // Protobuf text format, fields other than id, name and display_name are skipped
+    do {
+        if (quoted || (token != "item") || !next_token(text, pos, token, quoted) || (token != "{")) {
+            throw std::invalid_argument("Invalid labelmap, expected item { ... }");
+        }
+        long id = -1;
+        std::string name, display_name;
+        int depth = 1;
+        while (depth > 0) {
+            if (!next_token(text, pos, token, quoted)) {
+                throw std::invalid_argument("Invalid labelmap, missing }");
+            }
+            if (quoted) {
+                continue;
+            }
+            if (token == "{") {
+                depth++;
+            }
+            else if (token == "}") {
+                depth--;
+            }
+            else if ((depth == 1) && (token == "id" || token == "name" || token == "display_name")) {
+                std::string key = token;
+                if (!next_token(text, pos, token, quoted) || (token != ":") || !next_token(text, pos, token, quoted)) {
+                    throw std::invalid_argument("Invalid labelmap, expected " + key + ": value");
+                }
+                if (key == "id") {
+                    id = parse_class_id(token);
+                }
+                else if (key == "name") {
+                    name = token;
+                }
+                else {
+                    display_name = token;
+                }
+            }
+        }
+        if (id < 0) {
+            throw std::invalid_argument("Invalid labelmap, item without id");
+        }
+        labelmap->add(id, display_name.empty()? name : display_name, interned);
+    } while (next_token(text, pos, token, quoted));
+
+    return labelmap;
+}
+
+LabelMap::Ptr LabelMap::load(const std::string &filepath) {
+    std::ifstream file(filepath);
+    if (!file) {
+        throw std::logic_error("Cannot open labelmap " + filepath);
+    }
+    std::ostringstream text;
+    text << file.rdbuf();
+    return parse(text.str());
+}
+
+const std::string& LabelMap::name(int class_id) const {
+    static const std::string unknown;
+    if ((class_id < 0) || ((size_t)class_id >= this->index.size()) || (this->index[class_id] < 0)) {
+        return unknown;
+    }
+    return this->names[this->index[class_id]];
+}
+
+const std::string& LabelMap::literal(int class_id) const {
+    static const std::string unknown = "\"\"";
+    if ((class_id < 0) || ((size_t)class_id >= this->index.size()) || (this->index[class_id] < 0)) {
+        return unknown;
+    }
+    return this->literals[this->index[class_id]];
+}
+
+std::vector<int> LabelMap::ids(const std::string &name) const {
+    std::vector<int> result;
+    for (size_t idx = 0; idx < this->names.size(); idx++) {
+        if (this->names[idx] != name) {
+            continue;
+        }
+        for (size_t id = 0; id < this->index.size(); id++) {
+            if (this->index[id] == (int)idx) {
+                result.push_back((int)id);
+            }
+        }
+        break;
+    }
+    return result;
+}
+
+} // namespace NexInferenceEngine
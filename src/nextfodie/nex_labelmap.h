@@ -0,0 +1,59 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#pragma once
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace NexInferenceEngine {
+
+// Class names indexed by class id. Every distinct name is stored once, already formatted as
+// a JSON string literal, so responses copy it in without allocating per detection.
+class LabelMap {
+private:
+    std::vector<std::string> names;     // interned names
+    std::vector<std::string> literals;  // names as JSON string literals
+    std::vector<int> index;             // class id -> names, -1 when the id has no name
+
+    void add(long id, const std::string &name, std::unordered_map<std::string, int> &interned);
+
+public:
+    typedef std::shared_ptr<const LabelMap> Ptr;
+
+    // Either a TensorFlow labelmap (item { id: 1 name: "..." display_name: "..." }) where
+    // display_name wins over name, or a plain text list with the class id as line number
+    static Ptr parse(const std::string &text);
+    static Ptr load(const std::string &filepath);
+
+    size_t size() const {return this->names.size();};
+    const std::string& name(int class_id) const;
+    const std::string& literal(int class_id) const;
+    std::vector<int> ids(const std::string &name) const;
+    int maxId() const {return (int)this->index.size() - 1;};
+};
+
+} // namespace NexInferenceEngine
@@ -0,0 +1,68 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "nex_mapped_file.h"
+
+namespace NexInferenceEngine {
+
+MappedFile::MappedFile(const std::string &filepath) {
+    int fd = open(filepath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::logic_error("Cannot open " + filepath);
+    }
+    struct stat buffer;
+    if (fstat(fd, &buffer) != 0) {
+        close(fd);
+        throw std::logic_error("Cannot stat " + filepath);
+    }
+    this->length = (size_t)buffer.st_size;
+    this->addr = NULL;
+    if (this->length > 0) {
+        // Read-only, the network reader copies what it keeps out of the weights. The pages
+        // stay shared with the page cache and with other processes mapping the file.
+        void *addr = mmap(NULL, this->length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            close(fd);
+            throw std::logic_error("Cannot map " + filepath);
+        }
+        madvise(addr, this->length, MADV_WILLNEED);
+        this->addr = static_cast<uint8_t*>(addr);
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (this->addr != NULL) {
+        munmap(this->addr, this->length);
+    }
+}
+
+} // namespace NexInferenceEngine
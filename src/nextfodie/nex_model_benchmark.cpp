@@ -0,0 +1,230 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+
+#include "nex_detector.h"
+#include "nex_model_benchmark.h"
+
+static const int max_batch = 64;
+static const int max_nireq = 32;
+static const size_t max_points = 64;
+static const double max_duration_s = 60;
+
+static std::vector<int> parse_int_list(const std::string &name, const std::string &text, int max) {
+    std::vector<int> values;
+    std::istringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        char *end = NULL;
+        long value = strtol(item.c_str(), &end, 10);
+        if (item.empty() || (*end != '\0') || (value < 1) || (value > max)) {
+            throw std::invalid_argument("Invalid " + name + " (" + text + "), use values 1 to " + std::to_string(max) +
+                                        " separated by ','");
+        }
+        if (std::find(values.begin(), values.end(), (int)value) == values.end()) {
+            values.push_back((int)value);
+        }
+    }
+    if (values.empty()) {
+        throw std::invalid_argument("Invalid " + name + " (empty)");
+    }
+    std::sort(values.begin(), values.end());
+    return values;
+}
+
+static double parse_number(const std::string &name, const std::string &text, double min, double max) {
+    char *end = NULL;
+    double value = strtod(text.c_str(), &end);
+    if (text.empty() || (*end != '\0') || !(value >= min) || !(value <= max)) {
+        std::ostringstream stream;
+        stream << "Invalid " << name << " (" << text << "), use " << min << " to " << max;
+        throw std::invalid_argument(stream.str());
+    }
+    return value;
+}
+
+// Nearest rank percentile of sorted values
+static double percentile(const std::vector<double> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t rank = (size_t)std::ceil(p * sorted.size());
+    return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+namespace NexInferenceEngine {
+
+BenchmarkPlan parse_benchmark_plan(const std::map<std::string, std::string> &params) {
+    BenchmarkPlan plan;
+    for (auto &param : params) {
+        if (param.first == "batch") {
+            plan.batches = parse_int_list("batch", param.second, max_batch);
+        }
+        else if (param.first == "nireq") {
+            plan.nireqs = parse_int_list("nireq", param.second, max_nireq);
+        }
+        else if (param.first == "duration") {
+            plan.duration_s = parse_number("duration", param.second, 0.1, max_duration_s);
+        }
+        else if (param.first == "budget_ms") {
+            plan.latency_budget_ms = parse_number("budget_ms", param.second, 0, 1e6);
+        }
+        else {
+            throw std::invalid_argument("Unknown benchmark parameter (" + param.first + ")");
+        }
+    }
+    if (plan.batches.size() * plan.nireqs.size() > max_points) {
+        throw std::invalid_argument("Too many benchmark points, at most " + std::to_string(max_points));
+    }
+    return plan;
+}
+
+BenchmarkPoint run_benchmark(BenchmarkSession &session, int batch, double duration_s) {
+    typedef std::chrono::steady_clock clock;
+    int count = session.requests();
+    for (int idx = 0; idx < count; idx++) {
+        session.start(idx);
+    }
+    for (int idx = 0; idx < count; idx++) {
+        session.wait(idx);
+    }
+
+    // Requests finish in the order they started, so waiting on them in turn keeps them all busy
+    std::vector<clock::time_point> started(count);
+    std::vector<double> latencies;
+    auto begin = clock::now();
+    auto end = begin + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(duration_s));
+    for (int idx = 0; idx < count; idx++) {
+        started[idx] = clock::now();
+        session.start(idx);
+    }
+    auto last = begin;
+    int running = count;
+    for (int idx = 0; running > 0; idx = (idx + 1) % count) {
+        if (started[idx] == clock::time_point()) {
+            continue;
+        }
+        session.wait(idx);
+        last = clock::now();
+        latencies.push_back(std::chrono::duration<double, std::milli>(last - started[idx]).count());
+        if (last < end) {
+            started[idx] = clock::now();
+            session.start(idx);
+        }
+        else {
+            started[idx] = clock::time_point();
+            running--;
+        }
+    }
+
+    BenchmarkPoint point;
+    point.batch = batch;
+    point.nireq = count;
+    point.requests = latencies.size();
+    point.duration_s = std::chrono::duration<double>(last - begin).count();
+    point.fps = (point.duration_s > 0)? point.requests * batch / point.duration_s : 0;
+    double sum = 0;
+    for (double latency : latencies) {
+        sum += latency;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    point.mean_ms = latencies.empty()? 0 : sum / latencies.size();
+    point.p50_ms = percentile(latencies, 0.50);
+    point.p90_ms = percentile(latencies, 0.90);
+    point.p99_ms = percentile(latencies, 0.99);
+    point.max_ms = latencies.empty()? 0 : latencies.back();
+    return point;
+}
+
+BenchmarkReport run_benchmark_plan(Detector &detector, const BenchmarkPlan &plan, std::ostream &log) {
+    BenchmarkReport report;
+    report.plan = plan;
+    report.recommended = -1;
+    for (int batch : plan.batches) {
+        for (int nireq : plan.nireqs) {
+            BenchmarkPoint point;
+            {
+                // Released before the next one is set up, so only one extra network is loaded at a time
+                auto session = detector.openBenchmark(batch, nireq);
+                point = run_benchmark(*session, batch, plan.duration_s);
+            }
+            log << "    batch " << batch << ", nireq " << nireq << ": " << point.fps << " fps (p50: "
+                << point.p50_ms << "mS; p99: " << point.p99_ms << "mS)" << std::endl;
+            report.points.push_back(point);
+
+            // Highest throughput within the budget, the lower latency of equal ones
+            bool fits = (plan.latency_budget_ms <= 0) || (point.p99_ms <= plan.latency_budget_ms);
+            if (fits) {
+                int best = report.recommended;
+                if ((best < 0) || (point.fps > report.points[best].fps) ||
+                    ((point.fps == report.points[best].fps) && (point.p99_ms < report.points[best].p99_ms))) {
+                    report.recommended = (int)report.points.size() - 1;
+                }
+            }
+        }
+    }
+    return report;
+}
+
+web::json::value BenchmarkReport::toJson() const {
+    web::json::value jsn;
+    jsn["duration_s"] = web::json::value::number(this->plan.duration_s);
+    if (this->plan.latency_budget_ms > 0) {
+        jsn["budget_ms"] = web::json::value::number(this->plan.latency_budget_ms);
+    }
+    jsn["points"] = web::json::value::array(this->points.size());
+    for (size_t idx = 0; idx < this->points.size(); idx++) {
+        const BenchmarkPoint &point = this->points[idx];
+        web::json::value &item = jsn["points"][idx];
+        item["batch"] = web::json::value::number(point.batch);
+        item["nireq"] = web::json::value::number(point.nireq);
+        item["requests"] = web::json::value::number(point.requests);
+        item["fps"] = web::json::value::number(point.fps);
+        item["latency_ms"]["mean"] = web::json::value::number(point.mean_ms);
+        item["latency_ms"]["p50"] = web::json::value::number(point.p50_ms);
+        item["latency_ms"]["p90"] = web::json::value::number(point.p90_ms);
+        item["latency_ms"]["p99"] = web::json::value::number(point.p99_ms);
+        item["latency_ms"]["max"] = web::json::value::number(point.max_ms);
+    }
+    if (this->recommended >= 0) {
+        const BenchmarkPoint &point = this->points[this->recommended];
+        jsn["recommended"]["batch"] = web::json::value::number(point.batch);
+        jsn["recommended"]["nireq"] = web::json::value::number(point.nireq);
+        jsn["recommended"]["fps"] = web::json::value::number(point.fps);
+        jsn["recommended"]["p99_ms"] = web::json::value::number(point.p99_ms);
+    }
+    else {
+        jsn["recommended"] = web::json::value::null();
+    }
+    return jsn;
+}
+
+} // namespace NexInferenceEngine
@@ -0,0 +1,94 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#pragma once
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <cpprest/json.h>
+
+namespace NexInferenceEngine {
+
+class Detector;
+
+// The loaded model set up with one batch size and number of infer requests, apart from the
+// network that serves requests. Each infer request runs the same synthetic input over and over.
+class BenchmarkSession {
+public:
+    typedef std::unique_ptr<BenchmarkSession> Ptr;
+
+    virtual ~BenchmarkSession() {};
+
+    virtual int requests() = 0;
+    virtual void start(int idx) = 0;
+    virtual void wait(int idx) = 0;
+};
+
+// Batch sizes and infer request counts to try, every pair of them for duration_s each.
+// The recommendation is the best throughput whose p99 latency fits latency_budget_ms.
+struct BenchmarkPlan {
+    std::vector<int> batches;
+    std::vector<int> nireqs;
+    double duration_s;
+    double latency_budget_ms;   // 0 for no budget
+
+    BenchmarkPlan(): batches({1, 2, 4}), nireqs({1, 2, 4, 8}), duration_s(3), latency_budget_ms(0) {};
+};
+
+// Parse "batch", "nireq", "duration" (seconds) and "budget_ms" as in a query string;
+// lists are separated by ','. Throws std::invalid_argument.
+BenchmarkPlan parse_benchmark_plan(const std::map<std::string, std::string> &params);
+
+struct BenchmarkPoint {
+    int batch;
+    int nireq;
+    uint64_t requests;      // infer requests completed
+    double duration_s;
+    double fps;             // images per second
+    double mean_ms;         // latency of an infer request, from start to result
+    double p50_ms;
+    double p90_ms;
+    double p99_ms;
+    double max_ms;
+};
+
+struct BenchmarkReport {
+    BenchmarkPlan plan;
+    std::vector<BenchmarkPoint> points;
+    int recommended;        // index into points, -1 when none fits the budget
+
+    web::json::value toJson() const;
+};
+
+// Keep every infer request of the session busy for duration_s, after one warm-up round
+BenchmarkPoint run_benchmark(BenchmarkSession &session, int batch, double duration_s);
+// Run the plan on the model of the detector, one line per point to log
+BenchmarkReport run_benchmark_plan(Detector &detector, const BenchmarkPlan &plan, std::ostream &log);
+
+} // namespace NexInferenceEngine
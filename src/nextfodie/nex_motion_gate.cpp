@@ -0,0 +1,119 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#include <algorithm>
+
+#include "nex_motion_gate.h"
+
+static const int thumbnail_width = 64;
+// Grey levels a pixel of the thumbnail changes by to count, above sensor and JPEG noise
+static const int pixel_level = 16;
+
+namespace NexInferenceEngine {
+
+MotionGate::MotionGate(double threshold, size_t max_streams) {
+    this->threshold = threshold;
+    this->max_streams = std::max<size_t>(1, max_streams);
+    this->counts.streams = 0;
+    this->counts.frames = 0;
+    this->counts.reused = 0;
+}
+
+cv::Mat MotionGate::thumbnail(const cv::Mat &img) {
+    // Shrink in colour first, so that the conversion runs on a few thousand pixels
+    int height = std::max(1, img.rows * thumbnail_width / std::max(1, img.cols));
+    cv::Mat small, gray;
+    cv::resize(img, small, cv::Size(thumbnail_width, height), 0, 0, cv::INTER_AREA);
+    cv::cvtColor(small, gray, cv::COLOR_BGR2GRAY);
+    return gray;
+}
+
+double MotionGate::change(const cv::Mat &a, const cv::Mat &b) {
+    if ((a.rows != b.rows) || (a.cols != b.cols)) {
+        return 1;
+    }
+    // Plain byte loops which the compiler vectorizes
+    int changed = 0;
+    for (int row = 0; row < a.rows; row++) {
+        const uint8_t *pa = a.ptr<uint8_t>(row);
+        const uint8_t *pb = b.ptr<uint8_t>(row);
+        for (int col = 0; col < a.cols; col++) {
+            int diff = (int)pa[col] - (int)pb[col];
+            changed += ((diff > pixel_level) || (diff < -pixel_level))? 1 : 0;
+        }
+    }
+    return (double)changed / ((size_t)a.rows * a.cols);
+}
+
+bool MotionGate::reuse(const std::string &stream_id, const cv::Mat &img, const cv::Mat &thumbnail,
+                       uint32_t model_version, Detections &detections) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->counts.frames++;
+    auto it = this->streams.find(stream_id);
+    if (it == this->streams.end()) {
+        return false;
+    }
+    Stream &stream = it->second;
+    this->order.splice(this->order.begin(), this->order, stream.order);
+    if ((stream.image != img.size()) || !stream.detections.model || (stream.detections.model->version != model_version)) {
+        return false;
+    }
+    if (change(stream.reference, thumbnail) >= this->threshold) {
+        return false;
+    }
+    detections = stream.detections;
+    this->counts.reused++;
+    return true;
+}
+
+void MotionGate::update(const std::string &stream_id, const cv::Mat &img, const cv::Mat &thumbnail,
+                        const Detections &detections) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto it = this->streams.find(stream_id);
+    if (it == this->streams.end()) {
+        while (this->streams.size() >= this->max_streams) {
+            this->streams.erase(this->order.back());
+            this->order.pop_back();
+        }
+        this->order.push_front(stream_id);
+        it = this->streams.insert(std::make_pair(stream_id, Stream())).first;
+        it->second.order = this->order.begin();
+    }
+    else {
+        this->order.splice(this->order.begin(), this->order, it->second.order);
+    }
+    it->second.reference = thumbnail;
+    it->second.image = img.size();
+    it->second.detections = detections;
+}
+
+MotionStats MotionGate::stats() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    MotionStats stats = this->counts;
+    stats.streams = this->streams.size();
+    return stats;
+}
+
+} // namespace NexInferenceEngine
@@ -0,0 +1,84 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#pragma once
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <opencv2/opencv.hpp>
+
+#include "nex_detector.h"
+
+namespace NexInferenceEngine {
+
+struct MotionStats {
+    size_t streams;
+    uint64_t frames;        // frames of streams looked up
+    uint64_t reused;        // answered with the detections of an earlier frame
+};
+
+// Per-stream memory of the last inferred frame of a camera, as a tiny grayscale thumbnail
+// with its detections. A frame whose thumbnail differs from it in less than `threshold` of
+// the pixels gets those detections again instead of being inferred. The reference is only
+// replaced by inferred frames, so slow changes add up until they are inferred. The least
+// recently seen of more than `max_streams` streams are forgotten.
+class MotionGate {
+private:
+    struct Stream {
+        std::list<std::string>::iterator order;
+        cv::Mat reference;
+        cv::Size image;
+        Detections detections;
+    };
+
+    double threshold;
+    size_t max_streams;
+    std::list<std::string> order;       // most recently seen first
+    std::unordered_map<std::string, Stream> streams;
+    MotionStats counts;
+    std::mutex mutex;
+
+public:
+    MotionGate(double threshold, size_t max_streams);
+
+    // Thumbnail of a frame to compare and to keep as a reference
+    static cv::Mat thumbnail(const cv::Mat &img);
+    // Share of the pixels of two thumbnails that differ visibly, 0 to 1
+    static double change(const cv::Mat &a, const cv::Mat &b);
+
+    // The detections of the reference of the stream when the frame hardly changed from it
+    // and the reference came from the model of this version
+    bool reuse(const std::string &stream_id, const cv::Mat &img, const cv::Mat &thumbnail, uint32_t model_version,
+               Detections &detections);
+    // Make an inferred frame the reference of its stream
+    void update(const std::string &stream_id, const cv::Mat &img, const cv::Mat &thumbnail,
+                const Detections &detections);
+    MotionStats stats();
+};
+
+} // namespace NexInferenceEngine
@@ -24,40 +24,660 @@
  *******************************************************************************
  */
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <climits>
+#include <cstdlib>
 #include <exception>
 #include <iostream>
 #include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <ostream>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 
-#include <cpprest/containerstream.h>
 #include <cpprest/http_listener.h>
 #include <cpprest/json.h>
+#include <cpprest/producerconsumerstream.h>
 #include <MPFDParser-1.1.1/Parser.h>
 
-#include "nex_inference_engine.h"
+#include "nex_arena.h"
+#include "nex_detector.h"
+#include "nex_json_writer.h"
+#include "nex_motion_gate.h"
+#include "nex_model_benchmark.h"
 #include "nex_request_handler.h"
+#include "nex_request_queue.h"
+#include "nex_thread_pool.h"
+#include "nex_tracker.h"
+#include "nex_video.h"
+#include "nex_websocket.h"
+#include "nex_workers.h"
 
 using namespace web;
 namespace NexIE = NexInferenceEngine;
 
-extern NexIE::ObjectDetection *ie;
+extern NexIE::Detector *ie;
+extern NexIE::RequestQueue *queue;
+extern NexIE::ThreadPool *decoders;
+extern NexIE::MotionGate *motion;
+extern NexIE::StreamTrackers *trackers;
+extern NexIE::Worker *worker;
 
 typedef std::chrono::duration<double, std::ratio<1, 1000>> ms;
 
+// Parse regions of interest given as "x,y,w,h" in pixels, separated by ';'
+static bool parse_regions(const std::string &text, std::vector<cv::Rect> &regions) {
+    std::istringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ';')) {
+        if (item.find_first_not_of(" \t\r\n") == std::string::npos) {
+            continue;
+        }
+        int x, y, w, h;
+        char sep1, sep2, sep3;
+        std::istringstream fields(item);
+        if (!(fields >> x >> sep1 >> y >> sep2 >> w >> sep3 >> h) || (sep1 != ',') || (sep2 != ',') || (sep3 != ',')) {
+            return false;
+        }
+        if ((w <= 0) || (h <= 0)) {
+            return false;
+        }
+        regions.push_back(cv::Rect(x, y, w, h));
+    }
+    return !regions.empty();
+}
+
+// Detections are formatted straight to JSON text into a per-thread buffer that keeps its
+// capacity between requests; errors still go through json::value
+static std::string& detection_buffer() {
+    static thread_local std::string buffer;
+    buffer.clear();
+    return buffer;
+}
+
+// Clients opt in to the binary detection format (doc/binary_format.md) with
+// "Accept: application/x-nextfodie-detections", optionally with ";score=f32" and/or ";box=f32"
+static const char binary_content_type[] = "application/x-nextfodie-detections";
+
+static bool accepts_binary(http_request &request, bool &score_f32, bool &box_f32) {
+    http_headers headers = request.headers();
+    if (!headers.has("accept")) {
+        return false;
+    }
+    std::string accept;
+    for (char c : headers["accept"]) {
+        if ((c != ' ') && (c != '\t')) {
+            accept.push_back(::tolower(c));
+        }
+    }
+    auto pos = accept.find(binary_content_type);
+    if (pos == std::string::npos) {
+        return false;
+    }
+    auto params = accept.substr(pos, accept.find(',', pos) - pos);
+    score_f32 = (params.find(";score=f32") != std::string::npos);
+    box_f32 = (params.find(";box=f32") != std::string::npos);
+    return true;
+}
+
+// Detections which were not inferred for this frame are flagged with a header, such as
+// "X-Detections-Reused: true"
+static void reply_detections(http_request &request, http::status_code status, json::value &jsn, std::string &body,
+                             bool binary, const char *flag=NULL) {
+    if ((status == status_codes::OK) && !body.empty() && (flag != NULL)) {
+        http_response response(status);
+        response.headers().add(flag, "true");
+        response.set_body(body, binary? binary_content_type : "application/json");
+        request.reply(response);
+    }
+    else if ((status == status_codes::OK) && !body.empty()) {
+        request.reply(status, body, binary? binary_content_type : "application/json");
+    }
+    else {
+        request.reply(status, jsn);
+    }
+}
+
+// Clients give a request a budget with "X-Deadline-Ms: <milliseconds>", counted from its
+// arrival. Work whose deadline has passed is dropped before decode and before inference.
+class deadline_exceeded : public std::runtime_error {
+public:
+    deadline_exceeded(): std::runtime_error("Deadline exceeded") {};
+};
+
+static NexIE::Deadline request_deadline(http_request &request, std::chrono::steady_clock::time_point arrival) {
+    http_headers headers = request.headers();
+    if (!headers.has("X-Deadline-Ms")) {
+        return NexIE::no_deadline();
+    }
+    char *end = NULL;
+    std::string value = headers["X-Deadline-Ms"];
+    long deadline_ms = strtol(value.c_str(), &end, 10);
+    if ((end == value.c_str()) || (deadline_ms < 0)) {
+        return NexIE::no_deadline();
+    }
+    return arrival + std::chrono::milliseconds(deadline_ms);
+}
+
+static void check_deadline(const NexIE::Deadline &deadline) {
+    if (std::chrono::steady_clock::now() >= deadline) {
+        throw deadline_exceeded();
+    }
+}
+
+static void reply_busy(http_request &request) {
+    json::value jsn;
+    jsn["error"] = json::value::string("Server busy");
+    std::cout << "Server busy" << std::endl;
+    http_response response(status_codes::ServiceUnavailable);
+    response.headers().add("Retry-After", std::to_string(queue->retryAfter()));
+    response.set_body(jsn);
+    request.reply(response);
+}
+
+// Inference paths are /inference and /inference/bulk. Bulk requests take the low priority
+// lane, others the high one unless they ask with "X-Priority: high|low".
+static bool inference_path(const std::vector<std::string> &paths) {
+    return ((paths.size() == 1) && (paths[0] == "inference")) ||
+           ((paths.size() == 2) && (paths[0] == "inference") && (paths[1] == "bulk"));
+}
+
+static NexIE::Priority request_priority(http_request &request, const std::vector<std::string> &paths) {
+    NexIE::Priority priority = (paths.size() == 2)? NexIE::PRIORITY_LOW : NexIE::PRIORITY_HIGH;
+    http_headers headers = request.headers();
+    if (headers.has("X-Priority") && !NexIE::parse_priority(headers["X-Priority"], priority)) {
+        std::cout << "Unknown priority (" << headers["X-Priority"] << "), using "
+                  << NexIE::priority_name(priority) << std::endl;
+    }
+    return priority;
+}
+
+// A WebSocket client streaming frames to /inference/stream, each frame in a binary message
+// and each answer in a text message as soon as its frame is done. At most `window` frames of
+// a stream go through the pipeline at once; a newer frame waits for a place, and replaces
+// (drops) the frame which was waiting before it, so a client ahead of the server gets the
+// latest frame answered rather than a growing backlog.
+static const int max_stream_window = 32;
+
+static std::atomic<int> stream_sessions(0);
+static std::atomic<uint64_t> stream_frames(0);
+static std::atomic<uint64_t> stream_dropped(0);
+
+struct StreamFrame {
+    uint64_t index;         // in the stream, from 0
+    std::string data;
+    std::chrono::steady_clock::time_point arrival;
+};
+
+struct StreamSession {
+    NexIE::WebSocket::Ptr socket;
+    NexIE::Priority priority = NexIE::PRIORITY_HIGH;
+    NexIE::DetectionFilter filter;
+    bool abs = false;
+    std::string stream_id;
+    int track_every = 0;
+    long deadline_ms = -1;  // for each frame from its arrival, none when negative
+    int window = 2;
+    std::mutex mutex;
+    int in_flight = 0;
+    bool waiting = false;
+    StreamFrame next;       // the frame waiting for a place
+    bool closed = false;    // the client left, no frame starts any more
+    uint64_t frames = 0;
+    uint64_t dropped = 0;
+};
+
+// Once a frame is answered its place goes to the waiting frame, if any
+static void finish_frame(std::shared_ptr<StreamSession> session);
+
+static void status_stage(json::value &jsn, const NexIE::StageStats &stats) {
+    jsn["threads"]     = json::value::number(stats.threads);
+    jsn["busy"]        = json::value::number(stats.busy);
+    jsn["queued"]      = json::value::number((uint64_t)stats.queued);
+    jsn["jobs"]        = json::value::number(stats.jobs);
+    jsn["utilization"] = json::value::number(stats.utilization);
+}
+
+static void handle_status(json::value &jsn) {
+    jsn["model_version"] = json::value::number(ie->modelVersion());
+    jsn["queue"]["capacity"] = json::value::number(queue->capacity());
+    jsn["queue"]["reserved"] = json::value::number(queue->reservedWorkers());
+    for (int lane = 0; lane < NexIE::PRIORITY_COUNT; lane++) {
+        NexIE::Priority priority = (NexIE::Priority)lane;
+        NexIE::LaneStats stats = queue->stats(priority);
+        json::value &item = jsn["queue"]["lanes"][NexIE::priority_name(priority)];
+        item["running"]  = json::value::number(stats.running);
+        item["waiting"]  = json::value::number(stats.waiting);
+        item["admitted"] = json::value::number(stats.admitted);
+        item["rejected"] = json::value::number(stats.rejected);
+        item["expired"]  = json::value::number(stats.expired);
+        item["queued"]   = json::value::number(stats.queued);
+    }
+    status_stage(jsn["stages"]["decode"], decoders->stats());
+    status_stage(jsn["stages"]["inference"], queue->stageStats());
+    NexIE::MotionStats motion_stats = motion->stats();
+    jsn["motion"]["streams"] = json::value::number((uint64_t)motion_stats.streams);
+    jsn["motion"]["frames"]  = json::value::number(motion_stats.frames);
+    jsn["motion"]["reused"]  = json::value::number(motion_stats.reused);
+    NexIE::TrackingStats tracking_stats = trackers->stats();
+    jsn["tracking"]["streams"]   = json::value::number((uint64_t)tracking_stats.streams);
+    jsn["tracking"]["tracks"]    = json::value::number((uint64_t)tracking_stats.tracks);
+    jsn["tracking"]["inferred"]  = json::value::number(tracking_stats.inferred);
+    jsn["tracking"]["predicted"] = json::value::number(tracking_stats.predicted);
+    jsn["streams"]["connections"] = json::value::number(stream_sessions.load());
+    jsn["streams"]["frames"]      = json::value::number(stream_frames.load());
+    jsn["streams"]["dropped"]     = json::value::number(stream_dropped.load());
+}
+
+// The body of a request goes straight from its stream buffer into the multipart parser
+// through one read buffer per request. Reads start at 64KB and double while they come back
+// full, up to 1MB, and each one is continued from the previous one instead of waited for.
+static const size_t min_read_chunk = 64 * 1024;
+static const size_t max_read_chunk = 1024 * 1024;
+
+struct BodyReader {
+    concurrency::streams::streambuf<uint8_t> stream;
+    std::shared_ptr<MPFD::Parser> parser;
+    std::vector<char> chunk;
+    size_t length;          // content length, 0 when unknown
+    size_t total;
+};
+
+static pplx::task<size_t> read_chunks(std::shared_ptr<BodyReader> reader) {
+    return reader->stream.getn((uint8_t*)reader->chunk.data(), reader->chunk.size())
+        .then([reader](size_t byte_read) -> pplx::task<size_t> {
+            reader->total += byte_read;
+            if (byte_read > 0) {
+                reader->parser->AcceptSomeData(reader->chunk.data(), (long)byte_read);
+            }
+            if ((byte_read == 0) || (reader->total == reader->length)) {
+                return pplx::task_from_result(reader->total);
+            }
+            if ((byte_read == reader->chunk.size()) && (reader->chunk.size() < max_read_chunk)) {
+                reader->chunk.resize(reader->chunk.size() * 2);
+            }
+            return read_chunks(reader);
+        });
+}
+
+static pplx::task<size_t> read_body(http_request &request, std::shared_ptr<MPFD::Parser> parser) {
+    auto reader = std::make_shared<BodyReader>();
+    reader->stream = request.body().streambuf();
+    reader->parser = parser;
+    reader->length = request.headers().content_length();
+    reader->total = 0;
+    // A small body is read at once
+    size_t chunk = min_read_chunk;
+    if ((reader->length > 0) && (reader->length < chunk)) {
+        chunk = reader->length;
+    }
+    reader->chunk.resize(chunk);
+    return read_chunks(reader);
+}
+
+// The body of an inference request is collected in an arena, which is recycled for another
+// request as soon as the image is decoded
+class RequestMemory : public MPFD::Allocator {
+private:
+    NexIE::Arena::Ptr arena;
+
+public:
+    RequestMemory(): arena(NexIE::Arena::acquire()) {};
+
+    void *Allocate(size_t size) {return this->arena->allocate(size);};
+    void *Reallocate(void *data, size_t old_size, size_t size) {return this->arena->reallocate(data, old_size, size);};
+    void Free(void *, size_t) {};
+};
+
+// A parser together with its memory, which outlives it
+struct ArenaParser {
+    RequestMemory memory;
+    MPFD::Parser parser;
+
+    ArenaParser() {this->parser.SetAllocator(&this->memory);};
+};
+
+static std::shared_ptr<MPFD::Parser> arena_parser() {
+    auto owner = std::make_shared<ArenaParser>();
+    return std::shared_ptr<MPFD::Parser>(owner, &owner->parser);
+}
+
+// A private directory for the files of one upload, so that concurrent uploads never race
+// for the same temporary file name. It is removed once empty.
+struct UploadDir {
+    std::string path;
+
+    UploadDir() {
+        const char *tmpdir = std::getenv("TMPDIR");
+        std::string dir_template = std::string((tmpdir != NULL)? tmpdir : "/tmp") + "/nextfodie-upload.XXXXXX";
+        std::vector<char> dirpath(dir_template.begin(), dir_template.end());
+        dirpath.push_back('\0');
+        if (mkdtemp(dirpath.data()) == NULL) {
+            throw std::logic_error("Cannot create " + dir_template);
+        }
+        this->path = dirpath.data();
+    };
+    ~UploadDir() {rmdir(this->path.c_str());};
+};
+
+// A parser storing uploaded files in a directory of its own, which goes after the parser
+// has removed its files
+struct FileParser {
+    UploadDir dir;
+    MPFD::Parser parser;
+
+    FileParser() {
+        this->parser.SetUploadedFilesStorage(MPFD::Parser::StoreUploadedFilesInFilesystem);
+        this->parser.SetTempDirForFileUpload(this->dir.path);
+    };
+};
+
+static std::shared_ptr<MPFD::Parser> file_parser() {
+    auto owner = std::make_shared<FileParser>();
+    return std::shared_ptr<MPFD::Parser>(owner, &owner->parser);
+}
+
+// Size of an uploaded file, 0 when the field is empty: MPFD creates no file for it then
+// and its name is only the directory
+static unsigned long uploaded_file_size(MPFD::Field *field) {
+    struct stat buffer;
+    if ((stat(field->GetTempFileName().c_str(), &buffer) != 0) || !S_ISREG(buffer.st_mode)) {
+        return 0;
+    }
+    return (unsigned long)buffer.st_size;
+}
+
+// An inference request on its way through the pipeline: the listener thread reads and
+// validates it, a decoder decodes the image and an executor of the queue infers and answers.
+struct InferenceJob {
+    typedef std::chrono::steady_clock clock;
+
+    http_request request;
+    std::shared_ptr<NexIE::QueueTicket> ticket;
+    NexIE::Deadline deadline;
+    std::shared_ptr<MPFD::Parser> parser;   // owns the uploaded image until it is decoded
+    char *img = NULL;
+    unsigned long img_size = 0;
+    std::string img_path;                   // GET reads the image from a file instead
+    bool raw = false;                       // uncompressed pixels in img, described by raw_image
+    NexIE::RawImage raw_image;
+    cv::Mat cvimg;
+    NexIE::DetectionFilter filter;          // threshold defaults to the one of inference engine
+    bool abs = false;
+    bool binary = false;
+    bool score_f32 = false;
+    bool box_f32 = false;
+    int tile_size = 0;                      // no tiling
+    double tile_overlap = 0.2;
+    int max_tiles = 16;
+    std::vector<cv::Rect> regions;          // whole image
+    std::string stream_id;                  // frames of one camera, for the motion gate or the tracker
+    std::string stream_key;                 // stream_id with the regions or tiles it was inferred on
+    int track_every = 0;                    // infer every so many frames of the stream and track between
+    cv::Mat thumbnail;                      // of the frame, while it goes through the gate
+    std::shared_ptr<StreamSession> session; // answered on the WebSocket of a stream instead
+    uint64_t frame = 0;                     // in the stream
+    std::string payload;                    // owns the image of a frame until it is decoded
+
+    clock::time_point arrival;
+    clock::time_point received;
+    clock::time_point decode_start;
+    clock::time_point decoded;
+    clock::time_point infer_start;
+    clock::time_point inferred;
+
+    InferenceJob(http_request request): request(request), deadline(NexIE::no_deadline()),
+                                        arrival(clock::now()) {};
+};
+
+// Answer a frame of a stream with {"frame":<n>,"<key>":<value>}, flagged with "<what>":true
+// when its detections were not inferred for it
+static void send_frame(InferenceJob &job, const char *key, const std::string &value, const char *what=NULL) {
+    std::string message("{\"frame\":");
+    NexIE::json_append_int(message, (long)job.frame);
+    if (what != NULL) {
+        message.append(",\"").append(what).append("\":true");
+    }
+    message.append(",\"").append(key).append("\":").append(value).append("}");
+    job.session->socket->send(message);
+    finish_frame(job.session);
+}
+
+static void reply_error(InferenceJob &job, http::status_code status, const std::string &message) {
+    json::value jsn;
+    jsn["error"] = json::value::string(message);
+    std::cout << "Inference failed (" << message << ")" << std::endl;
+    if (job.session) {
+        std::string text;
+        NexIE::json_append_string(text, message);
+        send_frame(job, "error", text);
+        return;
+    }
+    job.request.reply(status, jsn);
+}
+
+static void expire_job(InferenceJob &job) {
+    job.ticket->expire();
+    reply_error(job, status_codes::GatewayTimeout, "Deadline exceeded");
+}
+
+// Runs on an executor of the queue while the job holds its place in the lane
+static void infer_job(std::shared_ptr<InferenceJob> job) {
+    try {
+        job->infer_start = InferenceJob::clock::now();
+        NexIE::Detections inference;
+        if (job->raw && job->cvimg.empty()) {
+            // Converted on its way into the network input, then the upload can go
+            inference = ie->inferRaw(job->raw_image);
+            job->raw_image.data = NULL;
+            job->img = NULL;
+            job->parser.reset();
+        }
+        else if (!job->regions.empty()) {
+            // Crop regions to the image, each one runs on its own infer request
+            cv::Rect frame(0, 0, job->cvimg.size().width, job->cvimg.size().height);
+            for (auto &region : job->regions) {
+                region = region & frame;
+                if (region.area() == 0) {
+                    throw std::invalid_argument("roi is outside of the image");
+                }
+            }
+            inference = ie->inferRegions(job->cvimg, job->regions, job->filter);
+        }
+        else if (job->tile_size > 0) {
+            inference = ie->inferTiles(job->cvimg, job->tile_size, (float)job->tile_overlap, job->max_tiles, job->filter);
+        }
+        else {
+            inference = ie->infer(job->cvimg);
+        }
+        job->inferred = InferenceJob::clock::now();
+        if (job->track_every > 0) {
+            std::vector<float> boxes;
+            ie->collect(inference, boxes, job->filter);
+            inference = trackers->update(job->stream_key, job->cvimg.size(), boxes, inference.model);
+        }
+        else if (!job->thumbnail.empty()) {
+            motion->update(job->stream_key, job->cvimg, job->thumbnail, inference);
+        }
+        job->cvimg.release();
+
+        json::value jsn;
+        std::string &detections = detection_buffer();
+        if (job->binary) {
+            ie->pack(inference, detections, !job->abs, job->filter, job->score_f32, job->box_f32);
+        }
+        else {
+            ie->parse(inference, detections, !job->abs, job->filter);
+        }
+        auto t_done = InferenceJob::clock::now();
+        if (job->session) {
+            send_frame(*job, "detections", detections);
+        }
+        else {
+            reply_detections(job->request, status_codes::OK, jsn, detections, job->binary);
+        }
+
+        ms t_rx     = std::chrono::duration_cast<ms>(job->received - job->arrival);
+        ms t_decode = std::chrono::duration_cast<ms>(job->decoded - job->decode_start);
+        ms t_wait   = std::chrono::duration_cast<ms>((job->decode_start - job->received) + (job->infer_start - job->decoded));
+        ms t_infer  = std::chrono::duration_cast<ms>(job->inferred - job->infer_start);
+        ms t_parse  = std::chrono::duration_cast<ms>(t_done - job->inferred);
+        ms t_total  = std::chrono::duration_cast<ms>(t_done - job->arrival);
+        std::cout << "Inference done (rx: " << t_rx.count() << "mS; decode: " << t_decode.count() << "mS; wait: "
+                  << t_wait.count() << "mS; infer: " << t_infer.count() << "mS; parse: " << t_parse.count()
+                  << "mS; total: " << t_total.count() << "mS)" << std::endl;
+    }
+    catch (std::invalid_argument const &ex) {
+        reply_error(*job, status_codes::BadRequest, ex.what());
+    }
+    catch (std::exception const &ex) {
+        reply_error(*job, status_codes::InternalError, ex.what());
+    }
+}
+
+// Answer a frame which hardly changed from the last inferred one of its stream without
+// inferring it, otherwise keep its thumbnail for the gate to compare the next frames with
+static void reply_uninferred(InferenceJob &job, const NexIE::Detections &previous, const char *flag,
+                             const char *what) {
+    job.cvimg.release();
+    json::value jsn;
+    std::string &detections = detection_buffer();
+    if (job.binary) {
+        ie->pack(previous, detections, !job.abs, job.filter, job.score_f32, job.box_f32);
+    }
+    else {
+        ie->parse(previous, detections, !job.abs, job.filter);
+    }
+    if (job.session) {
+        send_frame(job, "detections", detections, what);
+    }
+    else {
+        reply_detections(job.request, status_codes::OK, jsn, detections, job.binary, flag);
+    }
+
+    ms t_decode = std::chrono::duration_cast<ms>(job.decoded - job.decode_start);
+    ms t_total  = std::chrono::duration_cast<ms>(InferenceJob::clock::now() - job.arrival);
+    std::cout << "Inference " << what << " (stream: " << job.stream_id << "; decode: " << t_decode.count()
+              << "mS; total: " << t_total.count() << "mS)" << std::endl;
+}
+
+// Detections of the whole frame, of regions and of tiles differ, so requests of a stream
+// which infer it in another way are kept apart as if they were another stream
+static std::string stream_key(const InferenceJob &job) {
+    std::string key = job.stream_id;
+    for (auto &region : job.regions) {
+        key.append(1, '\0').append("roi:").append(std::to_string(region.x)).append(",").append(std::to_string(region.y))
+           .append(",").append(std::to_string(region.width)).append(",").append(std::to_string(region.height));
+    }
+    if (job.regions.empty() && (job.tile_size > 0)) {
+        key.append(1, '\0').append("tile:").append(std::to_string(job.tile_size)).append(",")
+           .append(std::to_string(job.tile_overlap)).append(",").append(std::to_string(job.max_tiles));
+    }
+    return key;
+}
+
+static bool reuse_detections(std::shared_ptr<InferenceJob> job) {
+    job->thumbnail = NexIE::MotionGate::thumbnail(job->cvimg);
+    NexIE::Detections previous;
+    if (!motion->reuse(job->stream_key, job->cvimg, job->thumbnail, ie->modelVersion(), previous)) {
+        return false;
+    }
+    reply_uninferred(*job, previous, "X-Detections-Reused", "reused");
+    return true;
+}
+
+// Between the frames a tracked stream infers, its tracks are moved along instead
+static bool predict_tracks(std::shared_ptr<InferenceJob> job) {
+    NexIE::Detections tracked;
+    if (!trackers->predict(job->stream_key, job->cvimg.size(), ie->modelVersion(), job->track_every, tracked)) {
+        return false;
+    }
+    reply_uninferred(*job, tracked, "X-Detections-Predicted", "predicted");
+    return true;
+}
+
+// Runs on a decoder, then hands the decoded image over to the lane of the request
+static void decode_job(std::shared_ptr<InferenceJob> job) {
+    try {
+        check_deadline(job->deadline);
+        job->decode_start = InferenceJob::clock::now();
+        // Uncompressed pixels go straight into the network input, unless the request works on
+        // a decoded image
+        bool direct = job->raw && job->regions.empty() && (job->tile_size == 0) && job->stream_id.empty();
+        if (job->raw) {
+            if (!direct) {
+                job->cvimg = job->raw_image.toMat();
+            }
+        }
+        else if (job->img_path.empty()) {
+            try {
+                job->cvimg = ie->openImage(job->img, (size_t)job->img_size);
+            }
+            catch (cv::Exception const &) {
+                // OpenCV asserts on some malformed data instead of returning no image
+                job->cvimg.release();
+            }
+        }
+        else {
+            job->cvimg = ie->openImage(job->img_path);
+        }
+        job->decoded = InferenceJob::clock::now();
+        if (!direct) {
+            // The encoded image is not needed any more
+            job->img = NULL;
+            job->parser.reset();
+            std::string().swap(job->payload);
+            if (job->cvimg.empty()) {
+                throw std::invalid_argument("Cannot decode image");
+            }
+        }
+        job->stream_key = stream_key(*job);
+        if ((job->track_every > 0)? predict_tracks(job) : (!job->stream_id.empty() && reuse_detections(job))) {
+            return;
+        }
+        queue->submit(job->ticket->lane(), job->deadline,
+                      [job]() {infer_job(job);},
+                      [job]() {expire_job(*job);});
+    }
+    catch (deadline_exceeded const &) {
+        expire_job(*job);
+    }
+    catch (std::invalid_argument const &ex) {
+        reply_error(*job, status_codes::BadRequest, ex.what());
+    }
+    catch (std::exception const &ex) {
+        reply_error(*job, status_codes::InternalError, ex.what());
+    }
+}
+
+static void start_job(std::shared_ptr<InferenceJob> job) {
+    job->received = InferenceJob::clock::now();
+    decoders->submit([job]() {decode_job(job);});
+}
+
 void handle_get(http_request request) {
     http::status_code status = status_codes::OK;
     json::value jsn;
+    auto job = std::make_shared<InferenceJob>(request);
+    job->binary = accepts_binary(request, job->score_f32, job->box_f32);
     auto uri = request.relative_uri();
     auto path = uri.path();
     std::cout << "---------- GET " << uri.to_string() << std::endl;
 
     auto query = uri.query();
     auto paths = http::uri::split_path(http::uri::decode(path));
-    if ((paths.size() != 1) || (paths[0] != "inference")) {
+    if ((paths.size() == 1) && (paths[0] == "status")) {
+        handle_status(jsn);
+    }
+    else if (!inference_path(paths)) {
         status = status_codes::NotFound;
         std::ostringstream stream;
         stream << "Path not found (" << path << ")";
@@ -65,6 +685,11 @@ void handle_get(http_request request) {
         std::cout << stream.str() << std::endl;
     }
     else {
+        job->ticket = std::make_shared<NexIE::QueueTicket>(*queue, request_priority(request, paths));
+        if (!job->ticket->isAdmitted()) {
+            reply_busy(request);
+            return;
+        }
         auto queries = http::uri::split_query(query);
         int possible_query_count = queries.size();
         if ((possible_query_count < 1) || (possible_query_count > 3)) {
@@ -80,21 +705,19 @@ void handle_get(http_request request) {
             }
             else {
                 std::string::size_type sz;
-                auto  imgpath = queries["path"];
-                float threshold = -1;   // use default of inference engine
-                bool  abs = false;
+                job->img_path = queries["path"];
 
                 possible_query_count--;
                 if ((possible_query_count > 0) && (queries.find("threshold") != queries.end())) {
-                    threshold = stof(queries["threshold"], &sz);
+                    job->filter.threshold = stof(queries["threshold"], &sz);
                     possible_query_count--;
-                    if ((threshold < 0) || (threshold > 1)) {
-                        threshold = -1;
+                    if ((job->filter.threshold < 0) || (job->filter.threshold > 1)) {
+                        job->filter.threshold = -1;
                     }
                 }
                 if ((possible_query_count > 0) && (queries.find("abs") != queries.end())) {
                     if (queries["abs"] == "true") {
-                        abs = true;
+                        job->abs = true;
                     }
                     possible_query_count--;
                 }
@@ -105,26 +728,11 @@ void handle_get(http_request request) {
                     std::cout << "Bad Request (unknown query)" << std::endl;
                 }
                 else {
-                    std::cout << "Inference request (image: " << imgpath << "; threshold: " << threshold 
-                              << "; normalized: " << !abs << ")" << std::endl;
-
-                    std::cout << "Infering..." << std::flush;
-                    auto t0 = std::chrono::high_resolution_clock::now();
-                    auto img = ie->openImage(imgpath);
-                    auto t1 = std::chrono::high_resolution_clock::now();
-                    auto inference = ie->infer(img);
-                    auto t2 = std::chrono::high_resolution_clock::now();
-                    jsn = ie->parse(inference, !abs, threshold);
-                    auto t3 = std::chrono::high_resolution_clock::now();
-                    status = status_codes::OK;
-
-                    ms t_load  = std::chrono::duration_cast<ms>(t1 - t0);
-                    ms t_infer = std::chrono::duration_cast<ms>(t2 - t1);
-                    ms t_parse = std::chrono::duration_cast<ms>(t3 - t2);
-                    ms t_total = std::chrono::duration_cast<ms>(t3 - t0);
-                    std::cout << " done (load: " << t_load.count() << "mS; infer: " << t_infer.count() 
-                              << "mS; parse: " << t_parse.count() << "mS; total: " << t_total.count() 
-                              << "mS)" << std::endl;
+                    std::cout << "Inference request (image: " << job->img_path << "; threshold: " << job->filter.threshold
+                              << "; normalized: " << !job->abs << ")" << std::endl;
+                    job->deadline = request_deadline(request, job->arrival);
+                    start_job(job);
+                    return;
                 }
             }
         }
@@ -132,16 +740,683 @@ void handle_get(http_request request) {
     request.reply(status, jsn);
 }
 
+// Fields which choose the detections of a response, false for other fields. Numbers out of
+// range are invalid like any other malformed value.
+static bool parse_filter_field(const std::string &name, const std::string &value, NexIE::DetectionFilter &filter) {
+    try {
+        if (name == "threshold") {
+            filter.threshold = std::stof(value);
+            if ((filter.threshold > 1) || (filter.threshold < 0)) {
+                filter.threshold = -1;
+            }
+        }
+        else if (name == "class_thresholds") {
+            filter.class_thresholds = NexIE::parse_class_thresholds(value);
+        }
+        else if (name == "include_classes") {
+            filter.include_classes = NexIE::parse_class_list(value);
+        }
+        else if (name == "exclude_classes") {
+            filter.exclude_classes = NexIE::parse_class_list(value);
+        }
+        else if (name == "top_k") {
+            filter.top_k = std::stoi(value);
+            if (filter.top_k < 0) {
+                filter.top_k = 0;
+            }
+        }
+        else if (name == "min_box_area") {
+            filter.min_box_area = std::stof(value);
+            if (filter.min_box_area < 0) {
+                filter.min_box_area = 0;
+            }
+        }
+        else {
+            return false;
+        }
+    }
+    catch (std::out_of_range const &) {
+        throw std::invalid_argument("Invalid " + name + " (out of range)");
+    }
+    return true;
+}
+
+// A whole number field between min and max, or std::invalid_argument naming the field
+static int int_field(const std::string &name, const std::string &value, int min, int max=INT_MAX) {
+    size_t end = 0;
+    int number = 0;
+    try {
+        number = std::stoi(value, &end);
+    }
+    catch (std::logic_error const &) {
+        throw std::invalid_argument("Invalid " + name + " (" + value + ")");
+    }
+    if (end != value.size()) {
+        throw std::invalid_argument("Invalid " + name + " (" + value + ")");
+    }
+    if ((number < min) || (number > max)) {
+        throw std::invalid_argument(name + " must be " + ((max == INT_MAX)? "at least " + std::to_string(min) :
+                                    "between " + std::to_string(min) + " and " + std::to_string(max)));
+    }
+    return number;
+}
+
+static double double_field(const std::string &name, const std::string &value, double min, double max) {
+    size_t end = 0;
+    double number = 0;
+    try {
+        number = std::stod(value, &end);
+    }
+    catch (std::logic_error const &) {
+        throw std::invalid_argument("Invalid " + name + " (" + value + ")");
+    }
+    if ((end != value.size()) || !(number >= min) || !(number <= max)) {
+        std::ostringstream message;
+        message << name << " must be between " << min << " and " << max;
+        throw std::invalid_argument(message.str());
+    }
+    return number;
+}
+
+// Validate the fields of an uploaded request once its body has been read
+static void accept_upload(std::shared_ptr<InferenceJob> job, pplx::task<size_t> read) {
+    http::status_code status = status_codes::OK;
+    json::value jsn;
+    NexIE::DetectionFilter &filter = job->filter;
+    std::string img_filename;
+    try {
+        read.get();
+
+        // Validate parameters
+        const std::map<std::string, MPFD::Field*> &fields = job->parser->GetFieldsMap();
+        std::map<std::string, MPFD::Field*>::const_iterator it;
+        for (it=fields.begin(); it!=fields.end(); it++) {
+            if ((it->first == "image") && (it->second->GetType() == MPFD::Field::FileType)) {
+                job->img = it->second->GetFileContent();
+                job->img_size = it->second->GetFileContentSize();
+                img_filename = it->second->GetFileName();
+            }
+            else if ((it->second->GetType() == MPFD::Field::TextType) &&
+                     parse_filter_field(it->first, it->second->GetTextTypeContent(), filter)) {
+                continue;
+            }
+            else if ((it->first == "abs") && (it->second->GetType() == MPFD::Field::TextType)) {
+                auto temp = it->second->GetTextTypeContent();
+                // convert content to lower case
+                std::for_each(temp.begin(), temp.end(), [](char& c) {
+                    c = ::tolower(c);
+                });
+                if (temp == "true") {
+                    job->abs = true;
+                }
+            }
+            else if ((it->first == "tile") && (it->second->GetType() == MPFD::Field::TextType)) {
+                job->tile_size = int_field(it->first, it->second->GetTextTypeContent(), 0);
+            }
+            else if ((it->first == "tile_overlap") && (it->second->GetType() == MPFD::Field::TextType)) {
+                job->tile_overlap = double_field(it->first, it->second->GetTextTypeContent(), 0, 0.9);
+            }
+            else if ((it->first == "max_tiles") && (it->second->GetType() == MPFD::Field::TextType)) {
+                job->max_tiles = int_field(it->first, it->second->GetTextTypeContent(), 1);
+            }
+            else if ((it->first == "stream_id") && (it->second->GetType() == MPFD::Field::TextType)) {
+                job->stream_id = it->second->GetTextTypeContent();
+            }
+            else if ((it->first == "format") && (it->second->GetType() == MPFD::Field::TextType)) {
+                if (!NexIE::parse_pixel_format(it->second->GetTextTypeContent(), job->raw_image.format)) {
+                    status = status_codes::BadRequest;
+                    jsn["error"] = json::value::string("Invalid format");
+                    std::cout << "Invalid format" << std::endl;
+                    break;
+                }
+                job->raw = true;
+            }
+            else if ((it->first == "width") && (it->second->GetType() == MPFD::Field::TextType)) {
+                job->raw_image.width = int_field(it->first, it->second->GetTextTypeContent(), 1);
+            }
+            else if ((it->first == "height") && (it->second->GetType() == MPFD::Field::TextType)) {
+                job->raw_image.height = int_field(it->first, it->second->GetTextTypeContent(), 1);
+            }
+            else if ((it->first == "stride") && (it->second->GetType() == MPFD::Field::TextType)) {
+                job->raw_image.stride = int_field(it->first, it->second->GetTextTypeContent(), 0);
+            }
+            else if ((it->first == "track") && (it->second->GetType() == MPFD::Field::TextType)) {
+                job->track_every = int_field(it->first, it->second->GetTextTypeContent(), 1);
+            }
+            else if ((it->first == "roi") && (it->second->GetType() == MPFD::Field::TextType)) {
+                if (!parse_regions(it->second->GetTextTypeContent(), job->regions)) {
+                    status = status_codes::BadRequest;
+                    jsn["error"] = json::value::string("Invalid roi");
+                    std::cout << "Invalid roi" << std::endl;
+                    break;
+                }
+            }
+            else {
+                status = status_codes::BadRequest;
+                jsn["error"] = json::value::string("Invalid parameter");
+                std::cout << "Invalid parameter" << std::endl;
+                break;
+            }
+        }
+
+        if ((status == status_codes::OK) && (job->track_every > 0) && job->stream_id.empty()) {
+            status = status_codes::BadRequest;
+            jsn["error"] = json::value::string("track needs a stream_id");
+            std::cout << "track needs a stream_id" << std::endl;
+        }
+        if ((status == status_codes::OK) && !job->raw &&
+            (job->raw_image.width || job->raw_image.height || job->raw_image.stride)) {
+            status = status_codes::BadRequest;
+            jsn["error"] = json::value::string("width, height and stride need a format");
+            std::cout << "width, height and stride need a format" << std::endl;
+        }
+        if ((status == status_codes::OK) && (job->tile_size > 0) && !job->regions.empty()) {
+            status = status_codes::BadRequest;
+            jsn["error"] = json::value::string("Cannot combine tile and roi");
+            std::cout << "Cannot combine tile and roi" << std::endl;
+        }
+
+        if (status == status_codes::OK) {
+            if (job->img == NULL || job->img_size == 0) {
+                status = status_codes::BadRequest;
+                jsn["error"] = json::value::string("Cannot find image");
+                std::cout << "Cannot find image" << std::endl;
+            }
+            else {
+                std::string format("encoded");
+                if (job->raw) {
+                    job->raw_image.data = reinterpret_cast<const uint8_t*>(job->img);
+                    job->raw_image.size = job->img_size;
+                    job->raw_image.validate();
+                    format = std::string(NexIE::pixel_format_name(job->raw_image.format)) + " " +
+                             std::to_string(job->raw_image.width) + "x" + std::to_string(job->raw_image.height);
+                }
+                std::cout << "Inference request (image size: " << job->img_size << "; format: " << format
+                          << "; threshold: " << filter.threshold << "; normalized: " << !job->abs << "; tile: "
+                          << job->tile_size << "; roi: " << job->regions.size() << "; top_k: " << filter.top_k << ")"
+                          << std::endl;
+                start_job(job);
+                return;
+            }
+        }
+    }
+    catch (MPFD::Exception ex) {
+        status = status_codes::BadRequest;
+        jsn["error"] = json::value::string(ex.GetError());
+        std::cout << " " << ex.GetError() << std::endl;
+    }
+    catch (std::invalid_argument const &ex) {
+        status = status_codes::BadRequest;
+        jsn["error"] = json::value::string(ex.what());
+        std::cout << " " << ex.what() << std::endl;
+    }
+    catch (std::exception const &ex) {
+        status = status_codes::InternalError;
+        jsn["error"] = json::value::string(ex.what());
+        std::cout << " " << ex.what() << std::endl;
+    }
+    job->request.reply(status, jsn);
+}
+
+// Run the model over a grid of batch sizes and infer request counts. It takes a while and
+// competes with requests for the inference CPUs, so one runs at a time on its own thread.
+static void handle_benchmark(http_request request, const std::string &query) {
+    static std::atomic<bool> running(false);
+    json::value jsn;
+    NexIE::BenchmarkPlan plan;
+    try {
+        plan = NexIE::parse_benchmark_plan(http::uri::split_query(query));
+    }
+    catch (std::invalid_argument const &ex) {
+        jsn["error"] = json::value::string(ex.what());
+        std::cout << " " << ex.what() << std::endl;
+        request.reply(status_codes::BadRequest, jsn);
+        return;
+    }
+    if (running.exchange(true)) {
+        jsn["error"] = json::value::string("Benchmark already running");
+        std::cout << "Benchmark already running" << std::endl;
+        request.reply(status_codes::Conflict, jsn);
+        return;
+    }
+
+    std::cout << "Benchmark request (points: " << plan.batches.size() * plan.nireqs.size() << "; duration: "
+              << plan.duration_s << "S; budget: " << plan.latency_budget_ms << "mS)" << std::endl;
+    std::thread([request, plan]() {
+        http::status_code status = status_codes::OK;
+        json::value jsn;
+        try {
+            jsn = NexIE::run_benchmark_plan(*ie, plan, std::cout).toJson();
+        }
+        catch (std::exception const &ex) {
+            status = status_codes::InternalError;
+            jsn["error"] = json::value::string(ex.what());
+            std::cout << " " << ex.what() << std::endl;
+        }
+        running = false;
+        request.reply(status, jsn);
+    }).detach();
+}
+
+// A video in one request: a decoder thread samples its frames, executors of the low lane
+// (unless X-Priority says otherwise) infer them `batch` at a time, and each frame goes back
+// as one line of JSON as soon as it is inferred.
+static const int max_video_batch = 32;
+
+static std::string video_dir;   // media root of the path field, empty when it is disabled
+
+void set_video_dir(const std::string &dir) {
+    char *resolved = realpath(dir.c_str(), NULL);
+    if (resolved == NULL) {
+        throw std::logic_error("Cannot find video directory " + dir);
+    }
+    video_dir = resolved;
+    free(resolved);
+}
+
+// The path field as a regular file under video_dir, relative paths taken from there. The
+// resolved name is what gets opened, so symbolic links cannot lead out of it.
+static std::string video_file(const std::string &path) {
+    if (video_dir.empty()) {
+        throw std::invalid_argument("path is disabled, upload the video instead");
+    }
+    std::string full = (!path.empty() && (path[0] == '/'))? path : video_dir + "/" + path;
+    char *resolved = realpath(full.c_str(), NULL);
+    std::string file = (resolved != NULL)? resolved : "";
+    free(resolved);
+    struct stat buffer;
+    if ((file.compare(0, video_dir.size() + 1, video_dir + "/") != 0) ||
+        (stat(file.c_str(), &buffer) != 0) || !S_ISREG(buffer.st_mode)) {
+        throw std::invalid_argument("Cannot find video " + path);
+    }
+    return file;
+}
+
+struct VideoJob {
+    typedef std::chrono::steady_clock clock;
+
+    http_request request;
+    std::shared_ptr<NexIE::QueueTicket> ticket;
+    std::shared_ptr<MPFD::Parser> parser;   // owns an uploaded video until it is read
+    std::string path;
+    int stride = 1;
+    double fps = 0;                         // sample by stride
+    int batch = 4;
+    NexIE::DetectionFilter filter;
+    bool abs = false;
+    std::unique_ptr<NexIE::VideoReader> reader;
+    concurrency::streams::producer_consumer_buffer<uint8_t> body;
+    pplx::task<void> reply;                 // done before the body is closed when the client left
+    uint64_t frames = 0;
+    clock::time_point arrival;
+
+    VideoJob(http_request request): request(request), arrival(clock::now()) {};
+};
+
+static bool video_path(const std::vector<std::string> &paths) {
+    return (paths.size() == 2) && (paths[0] == "inference") && (paths[1] == "video");
+}
+
+static void write_body(VideoJob &job, const std::string &text) {
+    // The buffer copies the text before the task completes
+    job.body.putn_nocopy((const uint8_t*)text.data(), text.size()).wait();
+}
+
+// Runs on an executor for each batch of frames, then queues the next batch behind the
+// requests waiting in the lane meanwhile
+static void video_batch(std::shared_ptr<VideoJob> job) {
+    std::string lines;
+    bool more = !job->reply.is_done();
+    try {
+        std::vector<NexIE::VideoFrame> frames;
+        std::vector<cv::Mat> images;
+        NexIE::VideoFrame frame;
+        while (more && ((int)frames.size() < job->batch)) {
+            more = job->reader->next(frame);
+            if (more) {
+                images.push_back(frame.image);
+                frames.push_back(std::move(frame));
+            }
+        }
+        if (!images.empty()) {
+            auto results = ie->inferBatch(images);
+            std::string &detections = detection_buffer();
+            for (size_t idx = 0; idx < frames.size(); idx++) {
+                ie->parse(results[idx], detections, !job->abs, job->filter);
+                lines.append("{\"frame\":");
+                NexIE::json_append_int(lines, frames[idx].index);
+                lines.append(",\"timestamp_ms\":");
+                NexIE::json_append_float(lines, (float)frames[idx].timestamp_ms);
+                lines.append(",\"detections\":");
+                lines.append(detections);
+                lines.append("}\n");
+            }
+            job->frames += frames.size();
+        }
+    }
+    catch (std::exception const &ex) {
+        lines.append("{\"error\":");
+        NexIE::json_append_string(lines, ex.what());
+        lines.append("}\n");
+        more = false;
+        std::cout << "Video inference failed (" << ex.what() << ")" << std::endl;
+    }
+    write_body(*job, lines);
+
+    if (more) {
+        queue->submit(job->ticket->lane(), NexIE::no_deadline(), [job]() {video_batch(job);}, []() {});
+        return;
+    }
+    job->body.close(std::ios_base::out);
+    ms t_total = std::chrono::duration_cast<ms>(VideoJob::clock::now() - job->arrival);
+    std::cout << "Video inference done (frames: " << job->frames << "; total: " << t_total.count() << "mS)" << std::endl;
+}
+
+// Validate the fields of a video request once its body has been read, then start streaming
+static void accept_video(std::shared_ptr<VideoJob> job, pplx::task<size_t> read) {
+    http::status_code status = status_codes::OK;
+    json::value jsn;
+    try {
+        read.get();
+
+        const std::map<std::string, MPFD::Field*> &fields = job->parser->GetFieldsMap();
+        std::map<std::string, MPFD::Field*>::const_iterator it;
+        for (it=fields.begin(); it!=fields.end(); it++) {
+            MPFD::Field *field = it->second;
+            if ((it->first == "video") && (field->GetType() == MPFD::Field::FileType)) {
+                job->path = field->GetTempFileName();
+            }
+            else if ((it->first == "path") && (field->GetType() == MPFD::Field::TextType)) {
+                job->path = video_file(field->GetTextTypeContent());
+            }
+            else if ((it->first == "stride") && (field->GetType() == MPFD::Field::TextType)) {
+                job->stride = int_field(it->first, field->GetTextTypeContent(), 1);
+            }
+            else if ((it->first == "fps") && (field->GetType() == MPFD::Field::TextType)) {
+                job->fps = std::stod(field->GetTextTypeContent());
+                if (!(job->fps > 0)) {
+                    throw std::invalid_argument("fps must be positive");
+                }
+            }
+            else if ((it->first == "batch") && (field->GetType() == MPFD::Field::TextType)) {
+                job->batch = int_field(it->first, field->GetTextTypeContent(), 1, max_video_batch);
+            }
+            else if ((it->first == "abs") && (field->GetType() == MPFD::Field::TextType)) {
+                auto temp = field->GetTextTypeContent();
+                std::for_each(temp.begin(), temp.end(), [](char& c) {
+                    c = ::tolower(c);
+                });
+                job->abs = (temp == "true");
+            }
+            else if ((field->GetType() != MPFD::Field::TextType) ||
+                     !parse_filter_field(it->first, field->GetTextTypeContent(), job->filter)) {
+                throw std::invalid_argument("Invalid parameter");
+            }
+        }
+        if (job->path.empty()) {
+            throw std::invalid_argument("Cannot find video");
+        }
+
+        // Two batches are decoded ahead
+        job->reader.reset(new NexIE::VideoReader(job->path, job->stride, job->fps, 2 * job->batch));
+        std::cout << "Video inference request (stride: " << job->stride << "; fps: " << job->fps << "; batch: "
+                  << job->batch << "; threshold: " << job->filter.threshold << "; normalized: " << !job->abs << ")"
+                  << std::endl;
+        http_response response(status_codes::OK);
+        response.set_body(job->body.create_istream(), "application/x-ndjson");
+        job->reply = job->request.reply(response);
+        queue->submit(job->ticket->lane(), NexIE::no_deadline(), [job]() {video_batch(job);}, []() {});
+        return;
+    }
+    catch (MPFD::Exception ex) {
+        status = status_codes::BadRequest;
+        jsn["error"] = json::value::string(ex.GetError());
+        std::cout << " " << ex.GetError() << std::endl;
+    }
+    catch (std::invalid_argument const &ex) {
+        status = status_codes::BadRequest;
+        jsn["error"] = json::value::string(ex.what());
+        std::cout << " " << ex.what() << std::endl;
+    }
+    catch (std::exception const &ex) {
+        status = status_codes::InternalError;
+        jsn["error"] = json::value::string(ex.what());
+        std::cout << " " << ex.what() << std::endl;
+    }
+    job->request.reply(status, jsn);
+}
+
+static void handle_video(http_request request, const std::vector<std::string> &paths) {
+    auto job = std::make_shared<VideoJob>(request);
+    job->ticket = std::make_shared<NexIE::QueueTicket>(*queue, request_priority(request, paths));
+    if (!job->ticket->isAdmitted()) {
+        reply_busy(request);
+        return;
+    }
+    http_headers headers = request.headers();
+    if (!headers.has("content-type")) {
+        json::value jsn;
+        jsn["error"] = json::value::string("Invalid header (cannot find content-type)");
+        std::cout << "Invalid header (cannot find content-type)" << std::endl;
+        request.reply(status_codes::BadRequest, jsn);
+        return;
+    }
+    try {
+        // Uploads go to a temporary file (removed with the parser) for the decoder to open
+        job->parser = file_parser();
+        job->parser->SetMaxCollectedDataLength(std::numeric_limits<long>::max());
+        job->parser->SetContentType(headers["content-type"]);
+        read_body(request, job->parser).then([job](pplx::task<size_t> read) {
+            accept_video(job, read);
+        });
+    }
+    catch (MPFD::Exception ex) {
+        json::value jsn;
+        jsn["error"] = json::value::string(ex.GetError());
+        std::cout << " " << ex.GetError() << std::endl;
+        request.reply(status_codes::BadRequest, jsn);
+    }
+    catch (std::exception const &ex) {
+        json::value jsn;
+        jsn["error"] = json::value::string(ex.what());
+        std::cout << " " << ex.what() << std::endl;
+        request.reply(status_codes::InternalError, jsn);
+    }
+}
+
+// Send a frame of a stream into the pipeline, in its own place in the lane of the stream
+static void start_frame(std::shared_ptr<StreamSession> session, StreamFrame &frame) {
+    auto job = std::make_shared<InferenceJob>(http_request());
+    job->session = session;
+    job->frame = frame.index;
+    job->arrival = frame.arrival;
+    job->payload.swap(frame.data);
+    job->img = &job->payload[0];
+    job->img_size = job->payload.size();
+    job->filter = session->filter;
+    job->abs = session->abs;
+    job->stream_id = session->stream_id;
+    job->track_every = session->track_every;
+    if (session->deadline_ms >= 0) {
+        job->deadline = job->arrival + std::chrono::milliseconds(session->deadline_ms);
+    }
+    job->ticket = std::make_shared<NexIE::QueueTicket>(*queue, session->priority);
+    if (!job->ticket->isAdmitted()) {
+        std::cout << "Server busy" << std::endl;
+        std::string text;
+        NexIE::json_append_string(text, "Server busy");
+        send_frame(*job, "error", text);
+        return;
+    }
+    start_job(job);
+}
+
+static void finish_frame(std::shared_ptr<StreamSession> session) {
+    StreamFrame frame;
+    {
+        std::lock_guard<std::mutex> lock(session->mutex);
+        if (!session->waiting || session->closed) {
+            session->in_flight--;
+            return;
+        }
+        session->waiting = false;
+        std::swap(frame, session->next);
+    }
+    start_frame(session, frame);
+}
+
+// Options of a stream come with the query of the upgraded request, such as
+// /inference/stream?inflight=2&threshold=0.6&stream_id=cam1
+static void parse_stream_options(const std::string &target, StreamSession &session) {
+    auto pos = target.find('?');
+    if (pos == std::string::npos) {
+        return;
+    }
+    auto queries = http::uri::split_query(target.substr(pos + 1));
+    for (auto &query : queries) {
+        std::string value = http::uri::decode(query.second);
+        if (parse_filter_field(query.first, value, session.filter)) {
+            continue;
+        }
+        else if (query.first == "inflight") {
+            session.window = std::stoi(value);
+            if ((session.window < 1) || (session.window > max_stream_window)) {
+                throw std::invalid_argument("inflight must be between 1 and " + std::to_string(max_stream_window));
+            }
+        }
+        else if (query.first == "abs") {
+            std::for_each(value.begin(), value.end(), [](char& c) {
+                c = ::tolower(c);
+            });
+            session.abs = (value == "true");
+        }
+        else if (query.first == "priority") {
+            if (!NexIE::parse_priority(value, session.priority)) {
+                throw std::invalid_argument("Unknown priority (" + value + ")");
+            }
+        }
+        else if (query.first == "deadline_ms") {
+            session.deadline_ms = std::stol(value);
+        }
+        else if (query.first == "stream_id") {
+            session.stream_id = value;
+        }
+        else if (query.first == "track") {
+            session.track_every = std::stoi(value);
+            if (session.track_every < 1) {
+                throw std::invalid_argument("track must be at least 1");
+            }
+        }
+        else {
+            throw std::invalid_argument("Invalid parameter (" + query.first + ")");
+        }
+    }
+    if ((session.track_every > 0) && session.stream_id.empty()) {
+        throw std::invalid_argument("track needs a stream_id");
+    }
+    // The tracker takes the frames of a stream in order
+    if (session.track_every > 0) {
+        session.window = 1;
+    }
+}
+
+void handle_stream(NexIE::WebSocket::Ptr socket, int inflight) {
+    auto session = std::make_shared<StreamSession>();
+    session->socket = socket;
+    session->window = inflight;
+    std::cout << "---------- WebSocket " << socket->target() << std::endl;
+    try {
+        parse_stream_options(socket->target(), *session);
+    }
+    catch (std::exception const &ex) {
+        std::string message("{\"error\":");
+        NexIE::json_append_string(message, ex.what());
+        message.append("}");
+        std::cout << " " << ex.what() << std::endl;
+        socket->send(message);
+        socket->close(1008);    // policy violation
+        return;
+    }
+    std::cout << "Stream opened (inflight: " << session->window << "; threshold: " << session->filter.threshold
+              << "; normalized: " << !session->abs << "; stream: " << session->stream_id << ")" << std::endl;
+    stream_sessions++;
+
+    StreamFrame frame;
+    bool binary = false;
+    while (socket->receive(frame.data, binary)) {
+        if (!binary) {
+            socket->send("{\"error\":\"Frames go in binary messages\"}");
+            continue;
+        }
+        if (frame.data.empty()) {
+            // Would only trip the decoder
+            socket->send("{\"error\":\"Empty frame\"}");
+            continue;
+        }
+        frame.index = session->frames++;
+        frame.arrival = std::chrono::steady_clock::now();
+        stream_frames++;
+        bool start = false;
+        bool drop = false;
+        {
+            std::lock_guard<std::mutex> lock(session->mutex);
+            if (session->in_flight < session->window) {
+                session->in_flight++;
+                start = true;
+            }
+            else {
+                // The frame waits in place of the one before it, which comes back to be dropped
+                drop = session->waiting;
+                session->waiting = true;
+                std::swap(frame, session->next);
+            }
+        }
+        if (start) {
+            start_frame(session, frame);
+        }
+        else if (drop) {
+            session->dropped++;
+            stream_dropped++;
+            std::string message("{\"frame\":");
+            NexIE::json_append_int(message, (long)frame.index);
+            message.append(",\"dropped\":true}");
+            socket->send(message);
+        }
+    }
+    {
+        // A frame still waiting would only be inferred for nobody
+        std::lock_guard<std::mutex> lock(session->mutex);
+        session->closed = true;
+        if (session->waiting) {
+            session->waiting = false;
+            session->dropped++;
+            stream_dropped++;
+            std::string().swap(session->next.data);
+        }
+    }
+    stream_sessions--;
+    std::cout << "Stream closed (frames: " << session->frames << "; dropped: " << session->dropped << ")" << std::endl;
+}
+
 void handle_post(http_request request) {
-    auto t0 = std::chrono::high_resolution_clock::now();
     http::status_code status = status_codes::OK;
     json::value jsn;
+    auto job = std::make_shared<InferenceJob>(request);
+    job->binary = accepts_binary(request, job->score_f32, job->box_f32);
     auto uri = request.relative_uri();
     auto path = uri.path();
     std::cout << "---------- POST " << uri.to_string() << std::endl;
 
     auto paths = http::uri::split_path(http::uri::decode(path));
-    if ((paths.size() != 1) || (paths[0] != "inference")) {
+    if ((paths.size() == 1) && (paths[0] == "benchmark")) {
+        handle_benchmark(request, uri.query());
+        return;
+    }
+    if (video_path(paths)) {
+        handle_video(request, paths);
+        return;
+    }
+    if (!inference_path(paths)) {
         status = status_codes::NotFound;
         std::ostringstream stream;
         stream << "Path not found (" << path << ")";
@@ -149,102 +1424,40 @@ void handle_post(http_request request) {
         std::cout << stream.str() << std::endl;
     }
     else {
-        http_headers headers = request.headers();
-        concurrency::streams::istream body = request.body();
+        // Turn the request away before its body is read when the queue is full
+        job->ticket = std::make_shared<NexIE::QueueTicket>(*queue, request_priority(request, paths));
+        if (!job->ticket->isAdmitted()) {
+            reply_busy(request);
+            return;
+        }
 
-        char *img = NULL;
-        unsigned long img_size = 0;
-        double threshold = -1;  // use default of inference engine
-        bool abs = false;
-        std::string img_filename;
+        http_headers headers = request.headers();
 
         if (headers.has("content-type")) {
-            auto parser = MPFD::Parser();
+            job->parser = arena_parser();
+            MPFD::Parser &parser = *job->parser;
             try {
+                job->deadline = request_deadline(request, job->arrival);
                 parser.SetUploadedFilesStorage(MPFD::Parser::StoreUploadedFilesInMemory);
                 parser.SetMaxCollectedDataLength(std::numeric_limits<long>::max());
                 parser.SetContentType(headers["content-type"]);
 
-                // Move all body to parser to parse
-                // ref: https://docs.microsoft.com/zh-tw/previous-versions/jj950083%28v%3dvs.140%29
-                size_t total_read = 0;
-                auto content_length = headers.content_length();
-                while (total_read < content_length) {
-                    concurrency::streams::container_buffer<std::string> isbuf;  // in-stream buffer
-                    size_t byte_read = body.read(isbuf, 16*1024).get();
-                    total_read += byte_read;
-                    const std::string &data = isbuf.collection();
-                    parser.AcceptSomeData((const char*)data.c_str(), (long)byte_read);
-                }
-
-                // Validate parameters
-                std::map<std::string, MPFD::Field*> fields = parser.GetFieldsMap();
-                std::map<std::string, MPFD::Field*>::iterator it;
-                for (it=fields.begin(); it!=fields.end(); it++) {
-                    if ((it->first == "image") && (fields[it->first]->GetType() == MPFD::Field::FileType)) {
-                        img = fields[it->first]->GetFileContent();
-                        img_size = fields[it->first]->GetFileContentSize();
-                        img_filename = fields[it->first]->GetFileName();
-                    }
-                    else if ((it->first == "threshold") && (fields[it->first]->GetType() == MPFD::Field::TextType)) {
-                        threshold = std::stod(fields[it->first]->GetTextTypeContent());
-                        if ((threshold > 1) || (threshold < 0)) {
-                            threshold = -1;
-                        }
-                    }
-                    else if ((it->first == "abs") && (fields[it->first]->GetType() == MPFD::Field::TextType)) {
-                        auto temp = fields[it->first]->GetTextTypeContent();
-                        // convert content to lower case
-                        std::for_each(temp.begin(), temp.end(), [](char& c) {
-                            c = ::tolower(c);
-                        });
-                        if (temp == "true") {
-                            abs = true;
-                        }
-                    }
-                    else {
-                        status = status_codes::BadRequest;
-                        jsn["error"] = json::value::string("Invalid parameter");
-                        std::cout << "Invalid parameter" << std::endl;
-                        break;
-                    }
-                }
-
-                if (status == status_codes::OK) {
-                    if (img == NULL || img_size == 0) {
-                        status = status_codes::BadRequest;
-                        jsn["error"] = json::value::string("Cannot find image");
-                        std::cout << "Cannot find image" << std::endl;
-                    }
-                    else {
-                        std::cout << "Inference request (image size: " << img_size << "; threshold: " << threshold 
-                                  << "; normalized: " << !abs << ")" << std::endl;
-
-                        std::cout << "Infering..." << std::flush;
-                        auto t1 = std::chrono::high_resolution_clock::now();
-                        auto cvimg = ie->openImage(img, (size_t)img_size);
-                        auto t2 = std::chrono::high_resolution_clock::now();
-                        auto inference = ie->infer(cvimg);
-                        auto t3 = std::chrono::high_resolution_clock::now();
-                        jsn = ie->parse(inference, !abs, threshold);
-                        auto t4 = std::chrono::high_resolution_clock::now();
-                        status = status_codes::OK;
-
-                        ms t_rx    = std::chrono::duration_cast<ms>(t1 - t0);
-                        ms t_load  = std::chrono::duration_cast<ms>(t2 - t1);
-                        ms t_infer = std::chrono::duration_cast<ms>(t3 - t2);
-                        ms t_parse = std::chrono::duration_cast<ms>(t4 - t3);
-                        ms t_total = std::chrono::duration_cast<ms>(t4 - t0);
-                        std::cout << " done (rx: " << t_rx.count() << "mS; load: " << t_load.count() << "mS; infer: " << t_infer.count() 
-                                  << "mS; parse: " << t_parse.count() << "mS; total: " << t_total.count() << "mS)" << std::endl;
-                    }
-                }
+                // The body goes to the parser as it arrives, fields are validated when it is all in
+                read_body(request, job->parser).then([job](pplx::task<size_t> read) {
+                    accept_upload(job, read);
+                });
+                return;
             }
             catch (MPFD::Exception ex) {
                 status = status_codes::BadRequest;
                 jsn["error"] = json::value::string(ex.GetError());
                 std::cout << " " << ex.GetError() << std::endl;
             }
+            catch (std::invalid_argument const &ex) {
+                status = status_codes::BadRequest;
+                jsn["error"] = json::value::string(ex.what());
+                std::cout << " " << ex.what() << std::endl;
+            }
             catch (std::exception const &ex) {
                 status = status_codes::InternalError;
                 jsn["error"] = json::value::string(ex.what());
@@ -277,43 +1490,40 @@ void handle_put(http_request request) {
         std::cout << stream.str() << std::endl;
     }
     else {
-        char *labelmap = NULL, *model_xml = NULL, *model_bin = NULL;
+        MPFD::Field *labelmap = NULL, *model_xml = NULL, *model_bin = NULL;
         unsigned long xml_size = 0, bin_size = 0, labelmap_size = 0;
+        NexIE::ClassThresholds class_thresholds;
+        std::string class_thresholds_text;
+        bool has_class_thresholds = false;
 
         http_headers headers = request.headers();
-        concurrency::streams::istream body = request.body();
-        auto parser = MPFD::Parser();
+        std::shared_ptr<MPFD::Parser> parser;
         try {
-            parser.SetUploadedFilesStorage(MPFD::Parser::StoreUploadedFilesInMemory);
-            parser.SetMaxCollectedDataLength(std::numeric_limits<long>::max());
-            parser.SetContentType(headers.content_type());
-
-            // ref: https://docs.microsoft.com/zh-tw/previous-versions/jj950083%28v%3dvs.140%29
-            size_t total_read = 0;
-            auto content_length = headers.content_length();
-            while (total_read < content_length) {
-                concurrency::streams::container_buffer<std::string> isbuf;  // in-stream buffer
-                size_t byte_read = body.read(isbuf, 16*1024).get();
-                total_read += byte_read;
-                const std::string &data = isbuf.collection();
-                parser.AcceptSomeData((const char*)data.c_str(), (long)byte_read);
-            }
-
-            std::map<std::string, MPFD::Field*> fields = parser.GetFieldsMap();
-            std::map<std::string, MPFD::Field*>::iterator it;
+            // Keep uploads in temporary files (removed with the parser), so the weights can
+            // be mapped by the inference engine rather than held on the heap as well
+            parser = file_parser();
+            parser->SetMaxCollectedDataLength(std::numeric_limits<long>::max());
+            parser->SetContentType(headers.content_type());
+
+            // Model uploads are rare, the listener thread waits for the whole body
+            read_body(request, parser).get();
+
+            const std::map<std::string, MPFD::Field*> &fields = parser->GetFieldsMap();
+            std::map<std::string, MPFD::Field*>::const_iterator it;
             for (it=fields.begin(); it!=fields.end(); it++) {
-                if (fields[it->first]->GetType() == MPFD::Field::FileType) {
+                if (it->second->GetType() == MPFD::Field::FileType) {
                     if (it->first == "xml") {
-                        model_xml = fields[it->first]->GetFileContent();
-                        xml_size = fields[it->first]->GetFileContentSize();
+                        model_xml = it->second;
+                        xml_size = uploaded_file_size(model_xml);
                     }
                     else if (it->first == "bin") {
-                        model_bin = fields[it->first]->GetFileContent();
-                        bin_size = fields[it->first]->GetFileContentSize();
+                        model_bin = it->second;
+                        bin_size = uploaded_file_size(model_bin);
                     }
                     else if (it->first == "labelmap") {
-                        labelmap = fields[it->first]->GetFileContent();
-                        labelmap_size = fields[it->first]->GetFileContentSize();
+                        // An empty labelmap field is no labelmap
+                        labelmap_size = uploaded_file_size(it->second);
+                        labelmap = (labelmap_size > 0)? it->second : NULL;
                     }
                     else {
                         status = status_codes::BadRequest;
@@ -324,6 +1534,11 @@ void handle_put(http_request request) {
                         break;
                     }
                 }
+                else if (it->first == "class_thresholds") {
+                    class_thresholds_text = it->second->GetTextTypeContent();
+                    class_thresholds = NexIE::parse_class_thresholds(class_thresholds_text);
+                    has_class_thresholds = true;
+                }
                 else { // MPFD::Field::TextType
                     status = status_codes::BadRequest;
                     std::ostringstream stream;
@@ -342,27 +1557,28 @@ void handle_put(http_request request) {
                         std::cout << "Cannot find model" << std::endl;
                     }
                     else {
-                        std::cout << "Load model request (xml: " << xml_size << "; bin: " << bin_size << ")" << std::endl;
+                        std::cout << "Load model request (xml: " << xml_size << "; bin: " << bin_size
+                                  << "; labelmap: " << labelmap_size << ")" << std::endl;
 
                         auto t1 = std::chrono::high_resolution_clock::now();
 
-                        // Since OpenVINO cannot load model by file pointer or buffer, so we have to save it as a file
+                        // Load model straight from the uploaded files. A labelmap sent along
+                        // replaces the current one together with the model.
                         std::cout << "Loading..." << std::flush;
-                        std::ofstream fp;
-                        std::string filename_xml = "model.xml";
-                        std::string filename_bin = "model.bin";
-                        fp.open(filename_xml, std::ofstream::binary);
-                        fp.write(model_xml, xml_size);
-                        fp.close();
-                        fp.open(filename_bin, std::ofstream::binary);
-                        fp.write(model_bin, bin_size);
-                        fp.close();
-
-                        // Load model
-                        ie->loadModel(filename_xml, filename_bin);
-
-                        remove(filename_xml.c_str());
-                        remove(filename_bin.c_str());
+                        std::string filename_xml = model_xml->GetTempFileName();
+                        std::string filename_bin = model_bin->GetTempFileName();
+                        NexIE::LabelMap::Ptr labels;
+                        if (labelmap != NULL) {
+                            labels = NexIE::LabelMap::load(labelmap->GetTempFileName());
+                            jsn["labelmap"] = json::value::number(labelmap_size);
+                            jsn["classes"] = json::value::number((uint64_t)labels->size());
+                        }
+                        ie->loadModel(filename_xml, filename_bin, labels, has_class_thresholds? &class_thresholds : NULL);
+                        if (worker != NULL) {
+                            NexIE::publish_model(*worker, filename_xml, filename_bin,
+                                                 (labelmap != NULL)? labelmap->GetTempFileName() : "",
+                                                 has_class_thresholds? &class_thresholds_text : NULL);
+                        }
 
                         auto t2 = std::chrono::high_resolution_clock::now();
                         ms t_rx    = std::chrono::duration_cast<ms>(t1 - t0);
@@ -377,16 +1593,30 @@ void handle_put(http_request request) {
                     }
                 }
                 else {  // paths[0] == "labelmap"
-                    if (labelmap == NULL || labelmap_size == 0) {
+                    if ((labelmap == NULL || labelmap_size == 0) && !has_class_thresholds) {
                         status = status_codes::BadRequest;
                         jsn["error"] = json::value::string("Cannot find labelmap");
                         std::cout << "Cannot find labelmap" << std::endl;
                     }
                     else {
+                        // Class thresholds alone keep the labelmap, and the other way around
                         std::cout << "Load labelmap" << std::endl;
                         std::cout << "    labelmap_size: " << labelmap_size << std::endl;
+                        std::cout << "    class_thresholds: " << class_thresholds.size() << std::endl;
+                        NexIE::LabelMap::Ptr labels;
+                        if (labelmap != NULL) {
+                            labels = NexIE::LabelMap::load(labelmap->GetTempFileName());
+                            std::cout << "    classes: " << labels->size() << std::endl;
+                            jsn["labelmap"] = json::value::number(labelmap_size);
+                            jsn["classes"] = json::value::number((uint64_t)labels->size());
+                        }
+                        ie->setLabelMap(labels, has_class_thresholds? &class_thresholds : NULL);
+                        if (worker != NULL) {
+                            NexIE::publish_model(*worker, "", "", (labelmap != NULL)? labelmap->GetTempFileName() : "",
+                                                 has_class_thresholds? &class_thresholds_text : NULL);
+                        }
                         status = status_codes::OK;
-                        jsn["labelmap"] = json::value::number(labelmap_size);
+                        jsn["class_thresholds"] = json::value::number((uint64_t)class_thresholds.size());
                     }
                 }
             }
@@ -396,6 +1626,11 @@ void handle_put(http_request request) {
             jsn["error"] = json::value::string(ex.GetError());
             std::cout << " " << ex.GetError() << std::endl;
         }
+        catch (std::invalid_argument const &ex) {
+            status = status_codes::BadRequest;
+            jsn["error"] = json::value::string(ex.what());
+            std::cout << " " << ex.what() << std::endl;
+        }
         catch (std::exception const &ex) {
             status = status_codes::InternalError;
             jsn["error"] = json::value::string(ex.what());
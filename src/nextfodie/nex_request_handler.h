@@ -24,10 +24,16 @@
  *******************************************************************************
  */
 #pragma once
+#include "nex_websocket.h"
 
 using namespace web::http;
 
 void handle_get(http_request request);
 void handle_post(http_request request);
 void handle_put(http_request request);
+// Directory the path field of POST /inference/video may name files in, or none at all.
+// Throws std::logic_error when it does not exist.
+void set_video_dir(const std::string &dir);
+// Serves a client streaming frames over WebSocket until it leaves
+void handle_stream(NexInferenceEngine::WebSocket::Ptr socket, int inflight);
 //void handle_del(http_request request);
\ No newline at end of file
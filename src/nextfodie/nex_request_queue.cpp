@@ -0,0 +1,290 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <exception>
+#include <iostream>
+
+#include "nex_request_queue.h"
+
+// Stride scheduling: a lane advances by stride_unit / weight for every job it runs
+static const uint64_t stride_unit = 1 << 20;
+
+namespace NexInferenceEngine {
+
+const char* priority_name(Priority priority) {
+    return (priority == PRIORITY_HIGH)? "high" : "low";
+}
+
+bool parse_priority(const std::string &text, Priority &priority) {
+    std::string value;
+    for (char c : text) {
+        if ((c != ' ') && (c != '\t')) {
+            value.push_back(::tolower(c));
+        }
+    }
+    if ((value == "high") || (value == "interactive")) {
+        priority = PRIORITY_HIGH;
+    }
+    else if ((value == "low") || (value == "bulk")) {
+        priority = PRIORITY_LOW;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+RequestQueue::RequestQueue(int workers, int depth, int reserved, int high_weight): meter(std::max(1, workers)) {
+    this->workers    = std::max(1, workers);
+    this->depth      = std::max(0, depth);
+    this->reserved   = std::min(std::max(0, reserved), this->workers - 1);
+    this->running    = 0;
+    this->service_ms = 0;
+    this->stopping   = false;
+    this->next_expiry = no_deadline();
+    for (int lane = 0; lane < PRIORITY_COUNT; lane++) {
+        this->lanes[lane].weight    = 1;
+        this->lanes[lane].pass      = 0;
+        this->lanes[lane].in_system = 0;
+        this->lanes[lane].stats     = LaneStats();
+    }
+    this->lanes[PRIORITY_HIGH].weight = std::max(1, high_weight);
+    for (int idx = 0; idx < this->workers; idx++) {
+        this->threads.push_back(std::thread(&RequestQueue::run, this));
+    }
+    this->reaper = std::thread(&RequestQueue::reap, this);
+}
+
+RequestQueue::~RequestQueue() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->cv.notify_all();
+    this->reaper_cv.notify_all();
+    for (auto &thread : this->threads) {
+        thread.join();
+    }
+    this->reaper.join();
+}
+
+bool RequestQueue::admit(Priority priority) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    Lane &lane = this->lanes[priority];
+    if (lane.in_system >= this->capacity()) {
+        lane.stats.rejected++;
+        return false;
+    }
+    lane.in_system++;
+    lane.stats.admitted++;
+    return true;
+}
+
+void RequestQueue::leave(Priority priority) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->lanes[priority].in_system--;
+}
+
+bool RequestQueue::eligible(int lane) {
+    if (this->lanes[lane].ready.empty()) {
+        return false;
+    }
+    // The other lanes together never hold the executors reserved for the high lane
+    int others = this->running - this->lanes[PRIORITY_HIGH].stats.running;
+    return (lane == PRIORITY_HIGH) || (others < this->workers - this->reserved);
+}
+
+// Called with the mutex held, the lane whose job runs next or -1
+int RequestQueue::nextLane() {
+    int next = -1;
+    for (int lane = 0; lane < PRIORITY_COUNT; lane++) {
+        if (this->eligible(lane) && ((next < 0) || (this->lanes[lane].pass < this->lanes[next].pass))) {
+            next = lane;
+        }
+    }
+    return next;
+}
+
+void RequestQueue::submit(Priority priority, const Deadline &deadline, std::function<void()> run,
+                          std::function<void()> expired) {
+    bool sooner;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+
+        // A lane coming back from idle starts level with the busy ones instead of catching up
+        Lane &lane = this->lanes[priority];
+        if (lane.ready.empty()) {
+            for (int other = 0; other < PRIORITY_COUNT; other++) {
+                if (!this->lanes[other].ready.empty()) {
+                    lane.pass = std::max(lane.pass, this->lanes[other].pass);
+                }
+            }
+        }
+        Job job;
+        job.deadline = deadline;
+        job.run = std::move(run);
+        job.expired = std::move(expired);
+        lane.ready.push_back(std::move(job));
+        sooner = (deadline < this->next_expiry);
+        if (sooner) {
+            this->next_expiry = deadline;
+        }
+    }
+    this->cv.notify_one();
+    if (sooner) {
+        this->reaper_cv.notify_one();
+    }
+}
+
+void RequestQueue::run() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        int next;
+        while (((next = this->nextLane()) < 0) && !this->stopping) {
+            this->cv.wait(lock);
+        }
+        if (next < 0) {
+            return;
+        }
+
+        Lane &lane = this->lanes[next];
+        Job job = std::move(lane.ready.front());
+        lane.ready.pop_front();
+        bool late = (std::chrono::steady_clock::now() >= job.deadline);
+        if (!late) {
+            lane.pass += stride_unit / lane.weight;
+            lane.stats.running++;
+            this->running++;
+        }
+        auto start = this->meter.begin();
+        lock.unlock();
+        try {
+            if (late) {
+                job.expired();
+            } else {
+                job.run();
+            }
+        }
+        catch (std::exception const &e) {
+            // Jobs answer their own errors, this one escaped
+            std::cout << "Unhandled error in inference job: " << e.what() << std::endl;
+        }
+        // The job may hold the ticket of its request, which takes the lock to leave
+        job.run = nullptr;
+        job.expired = nullptr;
+        lock.lock();
+        this->meter.end(start);
+        if (!late) {
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            lane.stats.running--;
+            this->running--;
+            this->service_ms = (this->service_ms == 0)? elapsed.count() : (this->service_ms * 0.9 + elapsed.count() * 0.1);
+            // A low lane job may have waited for this executor
+            this->cv.notify_one();
+        }
+    }
+}
+
+// Expire the queued jobs whose deadline passed, then sleep until the next deadline. Executors
+// still check the deadline of the jobs they take, one may pass between two rounds.
+void RequestQueue::reap() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    std::vector<Job> expired;
+    while (!this->stopping) {
+        auto now = std::chrono::steady_clock::now();
+        Deadline next = no_deadline();
+        for (int idx = 0; idx < PRIORITY_COUNT; idx++) {
+            std::deque<Job> &ready = this->lanes[idx].ready;
+            for (auto it = ready.begin(); it != ready.end(); ) {
+                if (it->deadline <= now) {
+                    expired.push_back(std::move(*it));
+                    it = ready.erase(it);
+                }
+                else {
+                    next = std::min(next, it->deadline);
+                    ++it;
+                }
+            }
+        }
+        if (!expired.empty()) {
+            lock.unlock();
+            for (auto &job : expired) {
+                try {
+                    job.expired();
+                }
+                catch (std::exception const &e) {
+                    std::cout << "Unhandled error in expired job: " << e.what() << std::endl;
+                }
+            }
+            // The jobs may hold the tickets of their requests, which take the lock to leave
+            expired.clear();
+            lock.lock();
+            continue;
+        }
+
+        this->next_expiry = next;
+        if (next == no_deadline()) {
+            this->reaper_cv.wait(lock);
+        }
+        else {
+            this->reaper_cv.wait_until(lock, next);
+        }
+    }
+}
+
+void RequestQueue::expire(Priority priority) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->lanes[priority].stats.expired++;
+}
+
+int RequestQueue::retryAfter() {
+    // Time for the executors to drain full queues, at least a second
+    std::lock_guard<std::mutex> lock(this->mutex);
+    double drain_ms = this->service_ms * (this->workers + this->depth * PRIORITY_COUNT) / this->workers;
+    return std::max(1, (int)std::ceil(drain_ms / 1000.0));
+}
+
+LaneStats RequestQueue::stats(Priority priority) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    Lane &lane = this->lanes[priority];
+    LaneStats stats = lane.stats;
+    stats.queued  = (int)lane.ready.size();
+    stats.waiting = lane.in_system - stats.running;
+    return stats;
+}
+
+StageStats RequestQueue::stageStats() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    size_t queued = 0;
+    for (int lane = 0; lane < PRIORITY_COUNT; lane++) {
+        queued += this->lanes[lane].ready.size();
+    }
+    return this->meter.report(queued);
+}
+
+} // namespace NexInferenceEngine
@@ -0,0 +1,156 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "nex_thread_pool.h"
+
+namespace NexInferenceEngine {
+
+typedef std::chrono::steady_clock::time_point Deadline;
+
+// Deadline of a request which set none
+inline Deadline no_deadline() {return Deadline::max();};
+
+// Interactive requests go to the high lane, bulk processing to the low one
+enum Priority {
+    PRIORITY_HIGH = 0,
+    PRIORITY_LOW,
+    PRIORITY_COUNT
+};
+
+const char* priority_name(Priority priority);
+bool parse_priority(const std::string &text, Priority &priority);
+
+struct LaneStats {
+    int running;
+    int waiting;            // admitted and not running, read or decoded or queued
+    int queued;             // ready for inference
+    uint64_t admitted;
+    uint64_t rejected;
+    uint64_t expired;
+};
+
+// The inference stage: `workers` executor threads running jobs from a queue per priority
+// lane. A lane admits at most `depth` requests besides the running ones, and requests
+// beyond that are turned away before their body is read, so that a traffic spike costs
+// neither memory nor latency for the admitted ones. Executors take from the lanes in
+// proportion to their weights, and the low lane never holds the last `reserved` of them,
+// so bulk traffic cannot starve interactive requests. A job whose deadline passes while it
+// waits is expired right then by a thread of its own, not when an executor gets to it.
+class RequestQueue {
+private:
+    struct Job {
+        Deadline deadline;
+        std::function<void()> run;
+        std::function<void()> expired;
+    };
+
+    struct Lane {
+        int weight;
+        uint64_t pass;              // stride scheduling, the lane with the lowest pass goes next
+        int in_system;              // admitted and not left yet
+        std::deque<Job> ready;      // oldest first
+        LaneStats stats;
+    };
+
+    int workers;
+    int depth;
+    int reserved;
+    int running;
+    Lane lanes[PRIORITY_COUNT];
+    double service_ms;      // moving average of the time an executor takes for a job
+    StageMeter meter;
+    bool stopping;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread reaper;
+    std::condition_variable reaper_cv;
+    Deadline next_expiry;   // when the reaper wakes up next
+
+    bool eligible(int lane);
+    int nextLane();
+    void run();
+    void reap();
+
+    RequestQueue(const RequestQueue&);
+    RequestQueue& operator=(const RequestQueue&);
+
+public:
+    RequestQueue(int workers, int depth, int reserved=0, int high_weight=4);
+    ~RequestQueue();
+
+    bool admit(Priority priority);
+    void leave(Priority priority);
+    // Queue a job for inference; expired runs instead when the deadline passes first
+    void submit(Priority priority, const Deadline &deadline, std::function<void()> run, std::function<void()> expired);
+    void expire(Priority priority);
+
+    // Seconds a rejected client should wait before trying again
+    int retryAfter();
+    LaneStats stats(Priority priority);
+    StageStats stageStats();
+    // Requests a lane admits, running or waiting
+    int capacity() {return this->workers + this->depth;};
+    int reservedWorkers() {return this->reserved;};
+};
+
+// Admission of one request to a RequestQueue, given up when it goes out of scope. Stages
+// of the pipeline share it until the request is answered.
+class QueueTicket {
+private:
+    RequestQueue &queue;
+    Priority priority;
+    bool admitted;
+
+    QueueTicket(const QueueTicket&);
+    QueueTicket& operator=(const QueueTicket&);
+
+public:
+    QueueTicket(RequestQueue &queue, Priority priority=PRIORITY_HIGH)
+        : queue(queue), priority(priority), admitted(queue.admit(priority)) {};
+    ~QueueTicket() {
+        if (this->admitted) {
+            this->queue.leave(this->priority);
+        }
+    };
+
+    bool isAdmitted() const {return this->admitted;};
+    Priority lane() const {return this->priority;};
+    // Count the request as dropped for its deadline
+    void expire() {this->queue.expire(this->priority);};
+};
+
+} // namespace NexInferenceEngine
@@ -0,0 +1,316 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include "nex_stub_detector.h"
+
+static const int stub_input_size = 300;
+static const int stub_object_size = 7;
+static const int stub_max_output_count = 100;
+
+// 64-bit FNV-1a over every 7th byte of the network input, enough to tell images apart
+static uint64_t image_hash(const cv::Mat &img) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (int row = 0; row < img.rows; row++) {
+        const uint8_t *data = img.ptr<uint8_t>(row);
+        size_t size = (size_t)img.cols * img.channels();
+        for (size_t i = row % 7; i < size; i += 7) {
+            hash ^= data[i];
+            hash *= 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+namespace NexInferenceEngine {
+
+LatencyModel::LatencyModel(const std::string &spec) {
+    auto pos = spec.find(':');
+    std::string name = spec.substr(0, pos);
+    std::string args = (pos == std::string::npos)? "" : spec.substr(pos + 1);
+    char *end = NULL;
+    this->a = strtod(args.c_str(), &end);
+    bool valid = (end != args.c_str()) && (this->a >= 0);
+    this->b = 0;
+    if (*end == ',') {
+        const char *start = end + 1;
+        this->b = strtod(start, &end);
+        valid = valid && (end != start) && (this->b >= 0);
+    }
+    valid = valid && (*end == '\0');
+
+    if (name == "fixed") {
+        this->distribution = LATENCY_FIXED;
+    }
+    else if (name == "uniform") {
+        this->distribution = LATENCY_UNIFORM;
+        valid = valid && (this->b >= this->a);
+    }
+    else if (name == "normal") {
+        this->distribution = LATENCY_NORMAL;
+    }
+    else if (name == "lognormal") {
+        this->distribution = LATENCY_LOGNORMAL;
+        valid = valid && (this->a > 0);
+    }
+    else {
+        valid = false;
+    }
+    if (!valid) {
+        throw std::logic_error("Invalid stub latency (" + spec + "), use fixed:<ms>, uniform:<min>,<max>, "
+                               "normal:<mean>,<stddev> or lognormal:<median>,<sigma>");
+    }
+}
+
+double LatencyModel::sample(std::mt19937_64 &random) const {
+    switch (this->distribution) {
+    case LATENCY_UNIFORM:
+        return std::uniform_real_distribution<double>(this->a, this->b)(random);
+    case LATENCY_NORMAL:
+        return std::max(0.0, std::normal_distribution<double>(this->a, this->b)(random));
+    case LATENCY_LOGNORMAL:
+        return std::lognormal_distribution<double>(std::log(this->a), this->b)(random);
+    default:
+        return this->a;
+    }
+}
+
+std::string LatencyModel::describe() const {
+    static const char *names[] = {"fixed", "uniform", "normal", "lognormal"};
+    std::ostringstream stream;
+    stream << names[this->distribution] << ":" << this->a;
+    if (this->distribution != LATENCY_FIXED) {
+        stream << "," << this->b;
+    }
+    return stream.str();
+}
+
+StubDetector::StubDetector(const std::string &latency, int object_count, int class_count)
+    : latency(latency), random(0x6e657874) {
+    this->object_count = std::min(std::max(0, object_count), stub_max_output_count);
+    this->class_count = std::max(1, class_count);
+    this->infer_request_count = 1;
+    this->idle_requests = 1;
+    // Ready without a model, so that the server runs with nothing but the stub
+    std::lock_guard<std::mutex> lock(this->model_mutex);
+    this->setModel(makeNetwork(), nullptr, ClassThresholds());
+}
+
+NetworkShape::Ptr StubDetector::makeNetwork() {
+    auto network = std::make_shared<NetworkShape>();
+    network->input_w = stub_input_size;
+    network->input_h = stub_input_size;
+    network->input_ch = 3;
+    network->object_size = stub_object_size;
+    network->max_output_count = stub_max_output_count;
+    return network;
+}
+
+void StubDetector::loadModel(std::string &model_xml, std::string &model_bin, LabelMap::Ptr labels,
+                             const ClassThresholds *class_thresholds) {
+    // The files are not read, a new model only takes the labels and thresholds along
+    this->replaceNetwork(makeNetwork(), labels, class_thresholds);
+}
+
+void StubDetector::setInferRequests(int count) {
+    std::lock_guard<std::mutex> lock(this->request_mutex);
+    count = std::max(1, count);
+    this->idle_requests += count - this->infer_request_count;
+    this->infer_request_count = count;
+}
+
+std::string StubDetector::describe() const {
+    std::ostringstream stream;
+    stream << "Stub detector (latency: " << this->latency.describe() << "mS; objects: " << this->object_count
+           << "; classes: " << this->class_count << ")";
+    return stream.str();
+}
+
+// Like infer requests, at most infer_request_count inferences are in flight
+void StubDetector::acquireRequests(int count) {
+    std::unique_lock<std::mutex> lock(this->request_mutex);
+    count = std::min(count, this->infer_request_count);
+    while (this->idle_requests < count) {
+        this->request_cv.wait(lock);
+    }
+    this->idle_requests -= count;
+}
+
+void StubDetector::releaseRequests(int count) {
+    {
+        std::lock_guard<std::mutex> lock(this->request_mutex);
+        this->idle_requests += std::min(count, this->infer_request_count);
+    }
+    this->request_cv.notify_all();
+}
+
+double StubDetector::sampleLatency() {
+    std::lock_guard<std::mutex> lock(this->request_mutex);
+    return this->latency.sample(this->random);
+}
+
+// Infer requests that are done when their latency has passed
+class StubBenchmark : public BenchmarkSession {
+private:
+    typedef std::chrono::steady_clock clock;
+
+    LatencyModel latency;
+    int batch;
+    std::mt19937_64 random;
+    std::vector<clock::time_point> done;
+
+public:
+    StubBenchmark(const LatencyModel &latency, int batch, int nireq)
+        : latency(latency), batch(batch), random(0x6e657874), done(nireq) {};
+
+    int requests() {return (int)this->done.size();};
+    void start(int idx) {
+        double latency = 0;
+        for (int image = 0; image < this->batch; image++) {
+            latency += this->latency.sample(this->random);
+        }
+        this->done[idx] = clock::now() + std::chrono::duration_cast<clock::duration>(
+                          std::chrono::duration<double, std::milli>(latency));
+    };
+    void wait(int idx) {std::this_thread::sleep_until(this->done[idx]);};
+};
+
+BenchmarkSession::Ptr StubDetector::openBenchmark(int batch, int nireq) {
+    this->currentModel();   // throws without a model, like other backends
+    return BenchmarkSession::Ptr(new StubBenchmark(this->latency, batch, nireq));
+}
+
+// Rows (image_id, label, conf, xmin, ymin, xmax, ymax) seeded by the input pixels
+void StubDetector::synthesize(const cv::Mat &input, std::vector<float> &output) {
+    std::mt19937_64 rows(image_hash(input));
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    output.assign((size_t)stub_max_output_count * stub_object_size, 0.0f);
+    for (int obj = 0; obj < this->object_count; obj++) {
+        float *row = &output[obj * stub_object_size];
+        float w = 0.05f + 0.45f * unit(rows);
+        float h = 0.05f + 0.45f * unit(rows);
+        row[0] = 0;
+        row[1] = (float)(1 + (int)(rows() % this->class_count));
+        row[2] = 0.05f + 0.95f * unit(rows);
+        row[3] = (1.0f - w) * unit(rows);
+        row[4] = (1.0f - h) * unit(rows);
+        row[5] = row[3] + w;
+        row[6] = row[4] + h;
+    }
+    if (this->object_count < stub_max_output_count) {
+        output[this->object_count * stub_object_size] = -1;
+    }
+}
+
+Detections StubDetector::infer(cv::Mat &img) {
+    if (img.empty()) {
+        throw std::logic_error("Failed to get frame from image file");
+    }
+    Detections detections;
+    detections.model = this->currentModel();
+    cv::Mat resized;
+    detections.letterbox = detections.model->network->letterbox(img, resized);
+
+    auto latency = std::chrono::duration<double, std::milli>(this->sampleLatency());
+    this->acquireRequests(1);
+    std::this_thread::sleep_for(latency);
+    this->releaseRequests(1);
+    this->synthesize(resized, detections.data);
+    return detections;
+}
+
+Detections StubDetector::inferRaw(const RawImage &image) {
+    Detections detections;
+    detections.model = this->currentModel();
+    const NetworkShape &network = *detections.model->network;
+    detections.letterbox = make_letterbox(image.width, image.height, network.input_w, network.input_h);
+    // The planes of an input blob, stacked
+    cv::Mat input(network.input_ch * network.input_h, network.input_w, CV_8UC1);
+    fill_letterboxed(image, detections.letterbox, network.input_ch, input.ptr<uint8_t>());
+
+    auto latency = std::chrono::duration<double, std::milli>(this->sampleLatency());
+    this->acquireRequests(1);
+    std::this_thread::sleep_for(latency);
+    this->releaseRequests(1);
+    this->synthesize(input, detections.data);
+    return detections;
+}
+
+Detections StubDetector::runRegions(const std::shared_ptr<const Model> &model, cv::Mat &img,
+                                    std::vector<cv::Rect> &regions, const ClassRules &rules) {
+    // Regions run in parallel like on infer requests: the slowest of each batch counts
+    const NetworkShape &network = *model->network;
+    std::vector<float> merged;
+    std::vector<float> output;
+    for (size_t first = 0; first < regions.size(); first += this->infer_request_count) {
+        size_t last = std::min(regions.size(), first + this->infer_request_count);
+        double latency = 0;
+        for (size_t idx = first; idx < last; idx++) {
+            latency = std::max(latency, this->sampleLatency());
+        }
+        this->acquireRequests((int)(last - first));
+        std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(latency));
+        this->releaseRequests((int)(last - first));
+
+        for (size_t idx = first; idx < last; idx++) {
+            cv::Mat resized;
+            Letterbox letterbox = model->network->letterbox(img(regions[idx]), resized);
+            this->synthesize(resized, output);
+            mergeRegion(merged, output, network, rules, regions[idx], letterbox, img.size());
+        }
+    }
+    return mergedDetections(merged, model, img.size());
+}
+
+void StubDetector::runBatch(const std::shared_ptr<const Model> &model, std::vector<cv::Mat> &images,
+                            std::vector<Detections> &results) {
+    // Like regions, images run infer_request_count at a time
+    for (size_t first = 0; first < images.size(); first += this->infer_request_count) {
+        size_t last = std::min(images.size(), first + this->infer_request_count);
+        double latency = 0;
+        for (size_t idx = first; idx < last; idx++) {
+            latency = std::max(latency, this->sampleLatency());
+        }
+        this->acquireRequests((int)(last - first));
+        std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(latency));
+        this->releaseRequests((int)(last - first));
+
+        for (size_t idx = first; idx < last; idx++) {
+            cv::Mat resized;
+            results[idx].model = model;
+            results[idx].letterbox = model->network->letterbox(images[idx], resized);
+            this->synthesize(resized, results[idx].data);
+        }
+    }
+}
+
+} // namespace NexInferenceEngine
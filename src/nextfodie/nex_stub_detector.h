@@ -0,0 +1,101 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "nex_detector.h"
+
+namespace NexInferenceEngine {
+
+// Time a stub inference takes: "fixed:<ms>", "uniform:<min>,<max>", "normal:<mean>,<stddev>"
+// or "lognormal:<median>,<sigma>"
+class LatencyModel {
+private:
+    enum Distribution {
+        LATENCY_FIXED,
+        LATENCY_UNIFORM,
+        LATENCY_NORMAL,
+        LATENCY_LOGNORMAL
+    };
+
+    Distribution distribution;
+    double a;
+    double b;
+
+public:
+    explicit LatencyModel(const std::string &spec);
+
+    double sample(std::mt19937_64 &random) const;
+    std::string describe() const;
+};
+
+// A backend without inference hardware, to measure the server around the network and to
+// run the whole pipeline where OpenVINO cannot. Any model it is given becomes a 300x300
+// SSD-shaped network which letterboxes the image like the real one, then holds one of
+// infer_requests slots for a synthetic latency. Its rows are derived from the pixels, so
+// the same image always gets the same detections.
+class StubDetector : public Detector {
+private:
+    LatencyModel latency;
+    int object_count;
+    int class_count;
+    int infer_request_count;
+    int idle_requests;
+    std::mt19937_64 random;     // latency samples, one fixed sequence per run
+    std::mutex request_mutex;
+    std::condition_variable request_cv;
+
+    static NetworkShape::Ptr makeNetwork();
+    void acquireRequests(int count);
+    void releaseRequests(int count);
+    double sampleLatency();
+    void synthesize(const cv::Mat &input, std::vector<float> &output);
+
+protected:
+    Detections runRegions(const std::shared_ptr<const Model> &model, cv::Mat &img, std::vector<cv::Rect> &regions,
+                          const ClassRules &rules);
+    void runBatch(const std::shared_ptr<const Model> &model, std::vector<cv::Mat> &images,
+                  std::vector<Detections> &results);
+
+public:
+    StubDetector(const std::string &latency, int object_count=10, int class_count=90);
+
+    void loadModel(std::string &model_xml, std::string &model_bin, LabelMap::Ptr labels=nullptr,
+                   const ClassThresholds *class_thresholds=NULL);
+    void setInferRequests(int count);
+    // A batch takes the latency of each of its images in turn, infer requests run in parallel
+    BenchmarkSession::Ptr openBenchmark(int batch, int nireq);
+    std::string describe() const;
+    Detections infer(cv::Mat &img);
+    Detections inferRaw(const RawImage &image);
+};
+
+} // namespace NexInferenceEngine
@@ -0,0 +1,126 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#include <algorithm>
+#include <exception>
+#include <iostream>
+
+#include "nex_thread_pool.h"
+
+namespace NexInferenceEngine {
+
+StageMeter::StageMeter(int threads) {
+    this->threads = threads;
+    this->busy = 0;
+    this->jobs = 0;
+    this->busy_ms = 0;
+    this->report_time = clock::now();
+}
+
+StageMeter::clock::time_point StageMeter::begin() {
+    this->busy++;
+    return clock::now();
+}
+
+void StageMeter::end(const clock::time_point &start) {
+    std::chrono::duration<double, std::milli> elapsed = clock::now() - start;
+    this->busy--;
+    this->jobs++;
+    this->busy_ms += elapsed.count();
+}
+
+StageStats StageMeter::report(size_t queued) {
+    auto now = clock::now();
+    std::chrono::duration<double, std::milli> window = now - this->report_time;
+    StageStats stats;
+    stats.threads = this->threads;
+    stats.busy    = this->busy;
+    stats.queued  = queued;
+    stats.jobs    = this->jobs;
+    stats.utilization = (window.count() > 0)? std::min(1.0, this->busy_ms / (window.count() * this->threads)) : 0;
+    this->busy_ms = 0;
+    this->report_time = now;
+    return stats;
+}
+
+ThreadPool::ThreadPool(int threads): meter(std::max(1, threads)) {
+    this->stopping = false;
+    for (int idx = 0; idx < std::max(1, threads); idx++) {
+        this->threads.push_back(std::thread(&ThreadPool::run, this));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->cv.notify_all();
+    for (auto &thread : this->threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::run() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        while (this->jobs.empty() && !this->stopping) {
+            this->cv.wait(lock);
+        }
+        if (this->jobs.empty()) {
+            return;
+        }
+        auto job = std::move(this->jobs.front());
+        this->jobs.pop_front();
+        auto start = this->meter.begin();
+        lock.unlock();
+        try {
+            job();
+        }
+        catch (std::exception const &e) {
+            // Jobs answer their own errors, this one escaped
+            std::cout << "Unhandled error in job: " << e.what() << std::endl;
+        }
+        // What the job holds is released before the lock is taken again
+        job = nullptr;
+        lock.lock();
+        this->meter.end(start);
+    }
+}
+
+void ThreadPool::submit(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->jobs.push_back(std::move(job));
+    }
+    this->cv.notify_one();
+}
+
+StageStats ThreadPool::stats() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->meter.report(this->jobs.size());
+}
+
+} // namespace NexInferenceEngine
@@ -0,0 +1,88 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace NexInferenceEngine {
+
+struct StageStats {
+    int threads;
+    int busy;               // threads running a job now
+    size_t queued;          // jobs waiting for a thread
+    uint64_t jobs;          // jobs run since start
+    double utilization;     // busy share of the threads since the previous report, 0 to 1
+};
+
+// Busy time of the threads of a pipeline stage. Not locked, the owner holds its own lock.
+class StageMeter {
+private:
+    typedef std::chrono::steady_clock clock;
+
+    int threads;
+    int busy;
+    uint64_t jobs;
+    double busy_ms;         // finished work since the previous report
+    clock::time_point report_time;
+
+public:
+    explicit StageMeter(int threads);
+
+    clock::time_point begin();
+    void end(const clock::time_point &start);
+    StageStats report(size_t queued);
+};
+
+// A fixed set of threads running jobs first in, first out
+class ThreadPool {
+private:
+    std::deque<std::function<void()>> jobs;
+    std::vector<std::thread> threads;
+    StageMeter meter;
+    bool stopping;
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    void run();
+
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+public:
+    explicit ThreadPool(int threads);
+    ~ThreadPool();
+
+    void submit(std::function<void()> job);
+    StageStats stats();
+};
+
+} // namespace NexInferenceEngine
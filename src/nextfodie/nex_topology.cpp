@@ -0,0 +1,213 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <pthread.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <utility>
+
+#include "nex_topology.h"
+
+static std::string read_line(const std::string &filepath) {
+    std::ifstream file(filepath);
+    std::string line;
+    std::getline(file, line);
+    return line;
+}
+
+static bool file_exists(const std::string &filepath) {
+    struct stat buffer;
+    return stat(filepath.c_str(), &buffer) == 0;
+}
+
+// (package, core) of a CPU, hyper-threads of one core share it
+static std::pair<int, int> cpu_core(int cpu) {
+    std::ostringstream path;
+    path << "/sys/devices/system/cpu/cpu" << cpu << "/topology/";
+    std::string package = read_line(path.str() + "physical_package_id");
+    std::string core = read_line(path.str() + "core_id");
+    if (package.empty() || core.empty()) {
+        return std::make_pair(0, cpu);
+    }
+    return std::make_pair(std::stoi(package), std::stoi(core));
+}
+
+namespace NexInferenceEngine {
+
+std::vector<int> parse_cpulist(const std::string &text) {
+    std::vector<int> cpus;
+    std::istringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        int first = 0, last = 0, length = 0;
+        int fields = sscanf(item.c_str(), " %d%n-%d%n", &first, &length, &last, &length);
+        if (fields < 2) {
+            last = first;
+        }
+        bool trailing = (item.find_first_not_of(" \t\r\n", length) != std::string::npos);
+        if ((fields < 1) || trailing || (first < 0) || (last < first) || (last >= CPU_SETSIZE)) {
+            throw std::invalid_argument("Invalid CPU list (" + text + ")");
+        }
+        for (int cpu = first; cpu <= last; cpu++) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+std::string format_cpulist(const std::vector<int> &cpus) {
+    std::ostringstream stream;
+    for (size_t idx = 0; idx < cpus.size(); idx++) {
+        size_t end = idx;
+        while ((end + 1 < cpus.size()) && (cpus[end + 1] == cpus[end] + 1)) {
+            end++;
+        }
+        stream << ((idx > 0)? "," : "") << cpus[idx];
+        if (end > idx) {
+            stream << "-" << cpus[end];
+        }
+        idx = end;
+    }
+    return stream.str();
+}
+
+std::vector<int> allowed_cpus() {
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    return cpus;
+}
+
+bool set_affinity(const std::vector<int> &cpus) {
+    if (cpus.empty()) {
+        return true;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        CPU_SET(cpu, &set);
+    }
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+std::vector<std::vector<int>> numa_nodes(const std::vector<int> &cpus) {
+    std::vector<std::vector<int>> nodes;
+    for (int node = 0; ; node++) {
+        std::ostringstream path;
+        path << "/sys/devices/system/node/node" << node << "/cpulist";
+        if (!file_exists(path.str())) {
+            break;
+        }
+        std::vector<int> members;
+        for (int cpu : parse_cpulist(read_line(path.str()))) {
+            if (std::find(cpus.begin(), cpus.end(), cpu) != cpus.end()) {
+                members.push_back(cpu);
+            }
+        }
+        if (!members.empty()) {
+            nodes.push_back(members);
+        }
+    }
+    if (nodes.empty()) {
+        nodes.assign(1, cpus);
+    }
+    return nodes;
+}
+
+void split_cpus(const std::vector<int> &cpus, std::vector<int> &io_cpus, std::vector<int> &infer_cpus) {
+    io_cpus.clear();
+    infer_cpus.clear();
+    if (cpus.empty()) {
+        return;
+    }
+    for (auto &node : numa_nodes(cpus)) {
+        std::map<std::pair<int, int>, std::vector<int>> cores;
+        for (int cpu : node) {
+            cores[cpu_core(cpu)].push_back(cpu);
+        }
+        if (cores.size() < 2) {
+            // Nothing to split, both share the CPUs of the node
+            io_cpus.insert(io_cpus.end(), node.begin(), node.end());
+            infer_cpus.insert(infer_cpus.end(), node.begin(), node.end());
+            continue;
+        }
+        size_t io_cores = std::max((size_t)1, cores.size() / 4);
+        size_t idx = 0;
+        for (auto &core : cores) {
+            std::vector<int> &target = (idx++ < io_cores)? io_cpus : infer_cpus;
+            target.insert(target.end(), core.second.begin(), core.second.end());
+        }
+    }
+    std::sort(io_cpus.begin(), io_cpus.end());
+    std::sort(infer_cpus.begin(), infer_cpus.end());
+}
+
+void print_topology(std::ostream &out, const std::vector<int> &io_cpus, const std::vector<int> &infer_cpus) {
+    auto allowed = allowed_cpus();
+    auto nodes = numa_nodes(allowed);
+    out << "Topology: " << allowed.size() << " CPUs in " << nodes.size() << " NUMA node" << ((nodes.size() > 1)? "s" : "") << std::endl;
+    for (size_t node = 0; node < nodes.size(); node++) {
+        std::map<std::pair<int, int>, int> cores;
+        for (int cpu : nodes[node]) {
+            cores[cpu_core(cpu)]++;
+        }
+        out << "    node " << node << ": CPUs " << format_cpulist(nodes[node]) << " (" << cores.size() << " cores)" << std::endl;
+    }
+    out << "    I/O CPUs:       " << (io_cpus.empty()? "any" : format_cpulist(io_cpus)) << std::endl;
+    out << "    inference CPUs: " << (infer_cpus.empty()? "any" : format_cpulist(infer_cpus)) << std::endl;
+}
+
+ScopedAffinity::ScopedAffinity(const std::vector<int> &cpus) {
+    this->pinned = false;
+    if (cpus.empty() || (pthread_getaffinity_np(pthread_self(), sizeof(this->previous), &this->previous) != 0)) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        CPU_SET(cpu, &set);
+    }
+    this->pinned = (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0);
+}
+
+ScopedAffinity::~ScopedAffinity() {
+    if (this->pinned) {
+        pthread_setaffinity_np(pthread_self(), sizeof(this->previous), &this->previous);
+    }
+}
+
+} // namespace NexInferenceEngine
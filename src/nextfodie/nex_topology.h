@@ -0,0 +1,70 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#pragma once
+#include <ostream>
+#include <sched.h>
+#include <string>
+#include <vector>
+
+namespace NexInferenceEngine {
+
+// CPU lists as in /sys/devices/system/node/node0/cpulist, e.g. "0-3,8,10-11". Throws
+// std::invalid_argument for anything else.
+std::vector<int> parse_cpulist(const std::string &text);
+std::string format_cpulist(const std::vector<int> &cpus);
+
+// CPUs the calling thread may run on
+std::vector<int> allowed_cpus();
+
+// Pin the calling thread. Threads it starts afterwards inherit the set.
+bool set_affinity(const std::vector<int> &cpus);
+
+// CPUs of each NUMA node among the given ones, a single node without NUMA information
+std::vector<std::vector<int>> numa_nodes(const std::vector<int> &cpus);
+
+// Give whole cores to I/O (listener and decode), a quarter of the cores of each NUMA node,
+// and the rest to inference. Inference then spans the nodes, run one worker per node for
+// node-local memory.
+void split_cpus(const std::vector<int> &cpus, std::vector<int> &io_cpus, std::vector<int> &infer_cpus);
+
+void print_topology(std::ostream &out, const std::vector<int> &io_cpus, const std::vector<int> &infer_cpus);
+
+// Pins the calling thread for its lifetime. Memory first touched meanwhile is allocated
+// on the node of these CPUs, and threads started meanwhile inherit them.
+class ScopedAffinity {
+private:
+    cpu_set_t previous;
+    bool pinned;
+
+    ScopedAffinity(const ScopedAffinity&);
+    ScopedAffinity& operator=(const ScopedAffinity&);
+
+public:
+    explicit ScopedAffinity(const std::vector<int> &cpus);
+    ~ScopedAffinity();
+};
+
+} // namespace NexInferenceEngine
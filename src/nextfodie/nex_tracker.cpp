@@ -0,0 +1,293 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include "nex_tracker.h"
+
+// Standard deviations relative to the box size, from DeepSORT
+static const float std_position = 1.0f / 20;
+static const float std_velocity = 1.0f / 160;
+// Matches below this IoU start a new track
+static const float min_iou = 0.3f;
+// Inferred frames a track is kept without a match, so a missed detection keeps its id
+static const int max_misses = 1;
+// A track is re-inferred once its center is this uncertain, relative to its size
+static const float max_uncertainty = 0.5f;
+// Track ids are stored in float rows, which hold integers exactly up to 2^24
+static const uint32_t max_track_id = (1u << 24) - 1;
+static const int object_size = 7;
+
+static float iou(const float *a, const float *b) {
+    float w = std::min(a[2], b[2]) - std::max(a[0], b[0]);
+    float h = std::min(a[3], b[3]) - std::max(a[1], b[1]);
+    if ((w <= 0) || (h <= 0)) {
+        return 0;
+    }
+    float inter = w * h;
+    float area = (a[2] - a[0]) * (a[3] - a[1]) + (b[2] - b[0]) * (b[3] - b[1]) - inter;
+    return (area > 0)? inter / area : 0;
+}
+
+namespace NexInferenceEngine {
+
+void KalmanAxis::init(float z, float size) {
+    this->p = z;
+    this->v = 0;
+    this->p_var = (2 * std_position * size) * (2 * std_position * size);
+    this->pv_cov = 0;
+    this->v_var = (10 * std_velocity * size) * (10 * std_velocity * size);
+}
+
+void KalmanAxis::predict(float size) {
+    // x' = F x, P' = F P F^T + Q with F = [1 1; 0 1]
+    this->p += this->v;
+    this->p_var += 2 * this->pv_cov + this->v_var + (std_position * size) * (std_position * size);
+    this->pv_cov += this->v_var;
+    this->v_var += (std_velocity * size) * (std_velocity * size);
+}
+
+void KalmanAxis::correct(float z, float size) {
+    // The position is measured, H = [1 0]
+    float innovation_var = this->p_var + (std_position * size) * (std_position * size);
+    float gain_p = this->p_var / innovation_var;
+    float gain_v = this->pv_cov / innovation_var;
+    float residual = z - this->p;
+    this->p += gain_p * residual;
+    this->v += gain_v * residual;
+    this->v_var -= gain_v * this->pv_cov;
+    this->pv_cov -= gain_p * this->pv_cov;
+    this->p_var -= gain_p * this->p_var;
+}
+
+void Tracker::Track::box(float *bbox) const {
+    float w = std::max(0.0f, this->axes[2].p);
+    float h = std::max(0.0f, this->axes[3].p);
+    bbox[0] = this->axes[0].p - w / 2;
+    bbox[1] = this->axes[1].p - h / 2;
+    bbox[2] = this->axes[0].p + w / 2;
+    bbox[3] = this->axes[1].p + h / 2;
+}
+
+float Tracker::Track::uncertainty() const {
+    float w = std::max(1e-3f, this->axes[2].p);
+    float h = std::max(1e-3f, this->axes[3].p);
+    return std::sqrt(this->axes[0].p_var) / w + std::sqrt(this->axes[1].p_var) / h;
+}
+
+bool Tracker::due(int every) const {
+    if (!this->model || (this->frames + 1 >= every)) {
+        return true;
+    }
+    for (auto &track : this->tracks) {
+        if ((track.misses == 0) && (track.uncertainty() > std::max(max_uncertainty, track.settled))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Tracker::predict() {
+    for (auto &track : this->tracks) {
+        float w = std::max(1e-3f, track.axes[2].p);
+        float h = std::max(1e-3f, track.axes[3].p);
+        track.axes[0].predict(w);
+        track.axes[1].predict(h);
+        track.axes[2].predict(w);
+        track.axes[3].predict(h);
+    }
+    this->frames++;
+}
+
+void Tracker::update(const std::vector<float> &boxes) {
+    this->predict();
+    this->frames = 0;
+
+    // Greedy matching by IoU, highest first, between boxes and tracks of the same class
+    size_t box_count = boxes.size() / 6;
+    std::vector<std::pair<float, std::pair<size_t, size_t>>> pairs;    // (iou, (track, box))
+    for (size_t t = 0; t < this->tracks.size(); t++) {
+        float predicted[4];
+        this->tracks[t].box(predicted);
+        for (size_t b = 0; b < box_count; b++) {
+            const float *row = &boxes[b * 6];
+            if ((int)row[0] != this->tracks[t].class_id) {
+                continue;
+            }
+            float overlap = iou(predicted, row + 2);
+            if (overlap >= min_iou) {
+                pairs.push_back(std::make_pair(overlap, std::make_pair(t, b)));
+            }
+        }
+    }
+    std::sort(pairs.begin(), pairs.end(), [](const std::pair<float, std::pair<size_t, size_t>> &a,
+                                             const std::pair<float, std::pair<size_t, size_t>> &b) {
+        return a.first > b.first;
+    });
+
+    std::vector<bool> track_matched(this->tracks.size(), false);
+    std::vector<bool> box_matched(box_count, false);
+    for (auto &pair : pairs) {
+        size_t t = pair.second.first;
+        size_t b = pair.second.second;
+        if (track_matched[t] || box_matched[b]) {
+            continue;
+        }
+        track_matched[t] = true;
+        box_matched[b] = true;
+        const float *row = &boxes[b * 6];
+        Track &track = this->tracks[t];
+        float w = row[4] - row[2];
+        float h = row[5] - row[3];
+        track.axes[0].correct((row[2] + row[4]) / 2, w);
+        track.axes[1].correct((row[3] + row[5]) / 2, h);
+        track.axes[2].correct(w, w);
+        track.axes[3].correct(h, h);
+        track.score = row[1];
+        track.misses = 0;
+        track.settled = track.uncertainty();
+    }
+
+    std::vector<Track> kept;
+    for (size_t t = 0; t < this->tracks.size(); t++) {
+        if (!track_matched[t]) {
+            this->tracks[t].misses++;
+        }
+        if (this->tracks[t].misses <= max_misses) {
+            kept.push_back(this->tracks[t]);
+        }
+    }
+    for (size_t b = 0; b < box_count; b++) {
+        if (box_matched[b]) {
+            continue;
+        }
+        const float *row = &boxes[b * 6];
+        Track track;
+        track.id = this->next_id;
+        this->next_id = (this->next_id >= max_track_id)? 1 : this->next_id + 1;
+        track.class_id = (int)row[0];
+        track.score = row[1];
+        float w = row[4] - row[2];
+        float h = row[5] - row[3];
+        track.axes[0].init((row[2] + row[4]) / 2, w);
+        track.axes[1].init((row[3] + row[5]) / 2, h);
+        track.axes[2].init(w, w);
+        track.axes[3].init(h, h);
+        track.misses = 0;
+        track.settled = track.uncertainty();
+        kept.push_back(track);
+    }
+    this->tracks.swap(kept);
+}
+
+Detections Tracker::detections() const {
+    Detections detections;
+    detections.model = this->model;
+    detections.letterbox = make_letterbox(this->image.width, this->image.height, this->image.width, this->image.height);
+    detections.tracked = true;
+    for (auto &track : this->tracks) {
+        if (track.misses > 0) {
+            continue;
+        }
+        float bbox[4];
+        track.box(bbox);
+        detections.data.push_back((float)track.id);
+        detections.data.push_back((float)track.class_id);
+        detections.data.push_back(track.score);
+        for (int i = 0; i < 4; i++) {
+            detections.data.push_back(std::min(1.0f, std::max(0.0f, bbox[i])));
+        }
+    }
+    detections.data.resize(detections.data.size() + object_size, -1);
+    return detections;
+}
+
+StreamTrackers::StreamTrackers(size_t max_streams) {
+    this->max_streams = std::max<size_t>(1, max_streams);
+    this->counts.streams = 0;
+    this->counts.tracks = 0;
+    this->counts.inferred = 0;
+    this->counts.predicted = 0;
+}
+
+Tracker& StreamTrackers::find(const std::string &stream_id) {
+    auto it = this->streams.find(stream_id);
+    if (it != this->streams.end()) {
+        this->order.splice(this->order.begin(), this->order, it->second.order);
+        return it->second.tracker;
+    }
+    while (this->streams.size() >= this->max_streams) {
+        this->streams.erase(this->order.back());
+        this->order.pop_back();
+    }
+    this->order.push_front(stream_id);
+    it = this->streams.insert(std::make_pair(stream_id, Stream())).first;
+    it->second.order = this->order.begin();
+    return it->second.tracker;
+}
+
+bool StreamTrackers::predict(const std::string &stream_id, const cv::Size &image, uint32_t model_version, int every,
+                             Detections &tracked) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    Tracker &tracker = this->find(stream_id);
+    if ((tracker.image != image) || !tracker.model || (tracker.model->version != model_version) ||
+        tracker.due(every)) {
+        return false;
+    }
+    tracker.predict();
+    tracked = tracker.detections();
+    this->counts.predicted++;
+    return true;
+}
+
+Detections StreamTrackers::update(const std::string &stream_id, const cv::Size &image, const std::vector<float> &boxes,
+                                  const std::shared_ptr<const Model> &model) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    Tracker &tracker = this->find(stream_id);
+    if ((tracker.image != image) || (tracker.model && (tracker.model->version != model->version))) {
+        // Another camera resolution or other classes, start over
+        tracker = Tracker();
+    }
+    tracker.image = image;
+    tracker.model = model;
+    tracker.update(boxes);
+    this->counts.inferred++;
+    return tracker.detections();
+}
+
+TrackingStats StreamTrackers::stats() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    TrackingStats stats = this->counts;
+    stats.streams = this->streams.size();
+    stats.tracks = 0;
+    for (auto &item : this->streams) {
+        stats.tracks += item.second.tracker.size();
+    }
+    return stats;
+}
+
+} // namespace NexInferenceEngine
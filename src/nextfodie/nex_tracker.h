@@ -0,0 +1,130 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#pragma once
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include "nex_detector.h"
+
+namespace NexInferenceEngine {
+
+// Position and velocity of one box coordinate under a constant velocity model, with the
+// covariance of the two. Noise is relative to the box size like in DeepSORT.
+struct KalmanAxis {
+    float p;
+    float v;
+    float p_var;
+    float pv_cov;
+    float v_var;
+
+    void init(float z, float size);
+    void predict(float size);
+    void correct(float z, float size);
+};
+
+// Objects of one camera followed from frame to frame, SORT style: boxes of inferred frames
+// are matched to the predicted tracks by IoU, and frames in between get the predictions.
+class Tracker {
+private:
+    struct Track {
+        uint32_t id;
+        int class_id;
+        float score;            // of the last matched detection
+        KalmanAxis axes[4];     // center x, center y, width, height, normalized to the image
+        int misses;             // inferred frames in a row without a match
+        float settled;          // uncertainty just after the last match
+
+        void box(float *bbox) const;
+        float uncertainty() const;
+    };
+
+    std::vector<Track> tracks;
+    uint32_t next_id;
+    int frames;                 // since the last inference
+
+public:
+    std::shared_ptr<const Model> model;     // the detections came from
+    cv::Size image;
+
+    Tracker(): next_id(1), frames(0) {};
+
+    // Whether the next frame should be inferred: every `every` frames, or sooner once the
+    // position of a track is too uncertain
+    bool due(int every) const;
+    // Move the tracks one frame ahead, for a frame which is not inferred
+    void predict();
+    // Match the boxes of an inferred frame, (class_id, score, xmin, ymin, xmax, ymax)
+    // normalized to the image, start tracks for the others and drop lost ones
+    void update(const std::vector<float> &boxes);
+    // Tracks matched at the last inference as tracked rows of detections
+    Detections detections() const;
+    size_t size() const {return this->tracks.size();};
+};
+
+struct TrackingStats {
+    size_t streams;
+    size_t tracks;
+    uint64_t inferred;      // frames of tracked streams
+    uint64_t predicted;
+};
+
+// A Tracker per stream_id, the least recently seen of more than max_streams forgotten
+class StreamTrackers {
+private:
+    struct Stream {
+        std::list<std::string>::iterator order;
+        Tracker tracker;
+    };
+
+    size_t max_streams;
+    std::list<std::string> order;       // most recently seen first
+    std::unordered_map<std::string, Stream> streams;
+    TrackingStats counts;
+    std::mutex mutex;
+
+    Tracker& find(const std::string &stream_id);
+
+public:
+    explicit StreamTrackers(size_t max_streams);
+
+    // The predicted tracks of the stream for a frame which needs no inference, false when
+    // the frame is due for inference
+    bool predict(const std::string &stream_id, const cv::Size &image, uint32_t model_version, int every,
+                 Detections &tracked);
+    // Update the tracks of the stream with an inferred frame and return them
+    Detections update(const std::string &stream_id, const cv::Size &image, const std::vector<float> &boxes,
+                      const std::shared_ptr<const Model> &model);
+    TrackingStats stats();
+};
+
+} // namespace NexInferenceEngine
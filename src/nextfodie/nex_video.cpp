@@ -0,0 +1,128 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <utility>
+
+#include "nex_video.h"
+
+namespace NexInferenceEngine {
+
+VideoReader::VideoReader(const std::string &path, int stride, double fps, size_t capacity) {
+    if (!this->capture.open(path) || !this->capture.isOpened()) {
+        throw std::invalid_argument("Cannot open video");
+    }
+    this->stride = std::max(1, stride);
+    this->interval_ms = (fps > 0)? 1000.0 / fps : 0;
+    this->capacity = std::max<size_t>(1, capacity);
+    this->finished = false;
+    this->stopping = false;
+    this->thread = std::thread(&VideoReader::run, this);
+}
+
+VideoReader::~VideoReader() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->cv.notify_all();
+    this->thread.join();
+}
+
+void VideoReader::run() {
+    std::string error;
+    try {
+        // Containers without a frame rate give timestamps of their own
+        double source_fps = this->capture.get(cv::CAP_PROP_FPS);
+        double next_due = 0;
+        for (int index = 0; ; index++) {
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                while ((this->frames.size() >= this->capacity) && !this->stopping) {
+                    this->cv.wait(lock);
+                }
+                if (this->stopping) {
+                    break;
+                }
+            }
+            if (!this->capture.grab()) {
+                break;
+            }
+            double timestamp = (source_fps > 0)? index * 1000.0 / source_fps : this->capture.get(cv::CAP_PROP_POS_MSEC);
+            bool take = (this->interval_ms > 0)? (timestamp >= next_due) : (index % this->stride == 0);
+            if (!take) {
+                continue;
+            }
+            while ((this->interval_ms > 0) && (next_due <= timestamp)) {
+                next_due += this->interval_ms;
+            }
+
+            VideoFrame frame;
+            frame.index = index;
+            frame.timestamp_ms = timestamp;
+            if (!this->capture.retrieve(frame.image) || frame.image.empty()) {
+                error = "Cannot decode frame " + std::to_string(index);
+                break;
+            }
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->frames.push_back(std::move(frame));
+            }
+            this->cv.notify_all();
+        }
+    }
+    catch (std::exception const &e) {
+        error = e.what();
+    }
+    this->capture.release();
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->error = error;
+        this->finished = true;
+    }
+    this->cv.notify_all();
+}
+
+bool VideoReader::next(VideoFrame &frame) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (this->frames.empty() && !this->finished) {
+        this->cv.wait(lock);
+    }
+    if (!this->frames.empty()) {
+        frame = std::move(this->frames.front());
+        this->frames.pop_front();
+        lock.unlock();
+        this->cv.notify_all();
+        return true;
+    }
+    if (!this->error.empty()) {
+        throw std::runtime_error(this->error);
+    }
+    return false;
+}
+
+} // namespace NexInferenceEngine
@@ -0,0 +1,74 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <opencv2/opencv.hpp>
+
+namespace NexInferenceEngine {
+
+struct VideoFrame {
+    int index;              // in the video, from 0
+    double timestamp_ms;    // from the start of the video
+    cv::Mat image;
+};
+
+// Frames of a video file decoded on a thread of its own, up to `capacity` ahead of the
+// reader. Every `stride`th frame is taken, or with a target fps the first frame of every
+// 1/fps seconds of video; frames in between are grabbed but not decoded into images.
+class VideoReader {
+private:
+    cv::VideoCapture capture;
+    int stride;
+    double interval_ms;     // 0 to sample by stride
+    size_t capacity;
+    std::deque<VideoFrame> frames;
+    bool finished;
+    bool stopping;
+    std::string error;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread thread;
+
+    void run();
+
+    VideoReader(const VideoReader&);
+    VideoReader& operator=(const VideoReader&);
+
+public:
+    // Throws std::invalid_argument when the file is not a video OpenCV can read
+    VideoReader(const std::string &path, int stride=1, double fps=0, size_t capacity=8);
+    ~VideoReader();
+
+    // The next sampled frame, false after the last one. Throws when decoding failed.
+    bool next(VideoFrame &frame);
+};
+
+} // namespace NexInferenceEngine
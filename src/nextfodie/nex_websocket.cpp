@@ -0,0 +1,554 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <map>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
+#include "nex_websocket.h"
+
+namespace NexInferenceEngine {
+
+enum {
+    OPCODE_CONTINUATION = 0x0,
+    OPCODE_TEXT = 0x1,
+    OPCODE_BINARY = 0x2,
+    OPCODE_CLOSE = 0x8,
+    OPCODE_PING = 0x9,
+    OPCODE_PONG = 0xA
+};
+
+enum {
+    CLOSE_NORMAL = 1000,
+    CLOSE_GOING_AWAY = 1001,
+    CLOSE_PROTOCOL_ERROR = 1002,
+    CLOSE_POLICY = 1008,
+    CLOSE_TOO_BIG = 1009
+};
+
+static const size_t max_handshake = 8192;
+static const int max_handshakes = 16;       // connections on their way to an upgrade
+static const int handshake_timeout_s = 10;
+static const int send_timeout_s = 5;        // for the handshake and what is left at the end
+static const size_t max_queued = 4 * 1024 * 1024;   // a client this far behind is dropped
+static const int ping_interval_s = 30;      // of silence before a ping, and then before dropping
+
+static bool write_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = ::send(fd, data, size, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+static void set_timeout(int fd, int option, int seconds) {
+    struct timeval timeout;
+    timeout.tv_sec = seconds;
+    timeout.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, option, &timeout, sizeof(timeout));
+}
+
+WebSocket::WebSocket(int fd, const std::string &path, const std::string &input, size_t max_message):
+    fd(fd), path(path), max_message(max_message), input(input), last_received(clock::now()), pinged(false),
+    closed(false) {
+    this->wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (this->wake < 0) {
+        throw std::logic_error(std::string("Cannot create eventfd (") + strerror(errno) + ")");
+    }
+    fcntl(this->fd, F_SETFL, fcntl(this->fd, F_GETFL) | O_NONBLOCK);
+}
+
+WebSocket::~WebSocket() {
+    ::close(this->wake);
+}
+
+bool WebSocket::read(char *data, size_t size) {
+    while (this->input.size() < size) {
+        if (!this->pump()) {
+            return false;
+        }
+    }
+    memcpy(data, this->input.data(), size);
+    this->input.erase(0, size);
+    return true;
+}
+
+// Send as much of the queue as the socket takes without blocking
+bool WebSocket::flush() {
+    std::lock_guard<std::mutex> lock(this->send_mutex);
+    while (!this->output.empty()) {
+        ssize_t written = ::send(this->fd, this->output.data(), this->output.size(), MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                return true;
+            }
+            this->closed = true;
+            this->output.clear();
+            return false;
+        }
+        this->output.erase(0, written);
+    }
+    return true;
+}
+
+// Wait for the socket or the queue and move data either way, pinging a silent client and
+// dropping it when it stays silent. False once the connection is closed.
+bool WebSocket::pump() {
+    bool writing;
+    {
+        std::lock_guard<std::mutex> lock(this->send_mutex);
+        if (this->closed) {
+            return false;
+        }
+        writing = !this->output.empty();
+    }
+    auto silence = std::chrono::seconds(this->pinged? 2 * ping_interval_s : ping_interval_s);
+    auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(this->last_received + silence - clock::now());
+    struct pollfd fds[2];
+    fds[0].fd = this->fd;
+    fds[0].events = POLLIN | (writing? POLLOUT : 0);
+    fds[1].fd = this->wake;
+    fds[1].events = POLLIN;
+    int ready = poll(fds, 2, (int)std::max((int64_t)0, (int64_t)timeout.count()));
+    if (ready < 0) {
+        return errno == EINTR;
+    }
+    if (fds[1].revents & POLLIN) {
+        uint64_t count;
+        (void)!::read(this->wake, &count, sizeof(count));
+    }
+    if (!this->flush()) {
+        return false;
+    }
+    if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+        char chunk[64 * 1024];
+        ssize_t received = ::recv(this->fd, chunk, sizeof(chunk), 0);
+        if (received < 0) {
+            return (errno == EINTR) || (errno == EAGAIN) || (errno == EWOULDBLOCK);
+        }
+        if (received == 0) {
+            return false;
+        }
+        this->input.append(chunk, received);
+        this->last_received = clock::now();
+        this->pinged = false;
+    }
+    else if (clock::now() >= this->last_received + silence) {
+        if (this->pinged) {
+            std::cout << "WebSocket client went silent" << std::endl;
+            this->close(CLOSE_GOING_AWAY);
+            return false;
+        }
+        this->pinged = true;
+        this->sendFrame(OPCODE_PING, "", 0);
+    }
+    return true;
+}
+
+// A close frame goes after whatever is queued, under send_mutex
+void WebSocket::queueClose(int code) {
+    char frame[4] = {(char)(0x80 | OPCODE_CLOSE), 2, (char)(code >> 8), (char)code};
+    this->output.append(frame, sizeof(frame));
+    this->closed = true;
+}
+
+bool WebSocket::sendFrame(int opcode, const char *data, size_t size) {
+    // Servers send unmasked frames
+    std::string frame;
+    frame.reserve(size + 10);
+    frame.push_back((char)(0x80 | opcode));
+    if (size < 126) {
+        frame.push_back((char)size);
+    }
+    else if (size <= 0xFFFF) {
+        frame.push_back((char)126);
+        frame.push_back((char)(size >> 8));
+        frame.push_back((char)size);
+    }
+    else {
+        frame.push_back((char)127);
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            frame.push_back((char)((uint64_t)size >> shift));
+        }
+    }
+    frame.append(data, size);
+
+    bool queued = false;
+    {
+        std::lock_guard<std::mutex> lock(this->send_mutex);
+        if (this->closed) {
+            return false;
+        }
+        if (this->output.size() + frame.size() > max_queued) {
+            std::cout << "WebSocket client too far behind" << std::endl;
+            this->queueClose(CLOSE_POLICY);
+        }
+        else {
+            this->output.append(frame);
+            queued = true;
+        }
+    }
+    uint64_t one = 1;
+    (void)!::write(this->wake, &one, sizeof(one));
+    return queued;
+}
+
+bool WebSocket::send(const std::string &message, bool binary) {
+    return this->sendFrame(binary? OPCODE_BINARY : OPCODE_TEXT, message.data(), message.size());
+}
+
+void WebSocket::close(int code) {
+    {
+        std::lock_guard<std::mutex> lock(this->send_mutex);
+        if (this->closed) {
+            return;
+        }
+        // Sent without waiting for the answer of the client, whatever comes next is dropped
+        this->queueClose(code);
+    }
+    uint64_t one = 1;
+    (void)!::write(this->wake, &one, sizeof(one));
+}
+
+void WebSocket::finish() {
+    this->close();
+    auto end = clock::now() + std::chrono::seconds(send_timeout_s);
+    while (this->flush()) {
+        auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(end - clock::now());
+        {
+            std::lock_guard<std::mutex> lock(this->send_mutex);
+            if (this->output.empty() || (timeout.count() <= 0)) {
+                break;
+            }
+        }
+        struct pollfd out;
+        out.fd = this->fd;
+        out.events = POLLOUT;
+        poll(&out, 1, (int)timeout.count());
+    }
+    ::shutdown(this->fd, SHUT_RDWR);
+}
+
+bool WebSocket::receive(std::string &message, bool &binary) {
+    bool fragmented = false;
+    message.clear();
+    while (true) {
+        unsigned char header[2];
+        if (!this->read((char*)header, sizeof(header))) {
+            this->close(CLOSE_PROTOCOL_ERROR);
+            return false;
+        }
+        bool fin = (header[0] & 0x80) != 0;
+        int opcode = header[0] & 0x0F;
+        bool masked = (header[1] & 0x80) != 0;
+        uint64_t length = header[1] & 0x7F;
+        bool control = (opcode & 0x8) != 0;
+        // Clients mask every frame, no extension was negotiated, and control frames come whole
+        if (((header[0] & 0x70) != 0) || !masked || (control && (!fin || (length > 125)))) {
+            this->close(CLOSE_PROTOCOL_ERROR);
+            return false;
+        }
+        if (length >= 126) {
+            unsigned char extended[8];
+            size_t size = (length == 126)? 2 : 8;
+            if (!this->read((char*)extended, size)) {
+                this->close(CLOSE_PROTOCOL_ERROR);
+                return false;
+            }
+            length = 0;
+            for (size_t idx = 0; idx < size; idx++) {
+                length = (length << 8) | extended[idx];
+            }
+        }
+        if (!control && (length > this->max_message - message.size())) {
+            this->close(CLOSE_TOO_BIG);
+            return false;
+        }
+        unsigned char mask[4];
+        if (!this->read((char*)mask, sizeof(mask))) {
+            this->close(CLOSE_PROTOCOL_ERROR);
+            return false;
+        }
+        std::string control_payload;
+        std::string &payload = control? control_payload : message;
+        size_t offset = payload.size();
+        payload.resize(offset + (size_t)length);
+        if ((length > 0) && !this->read(&payload[offset], (size_t)length)) {
+            this->close(CLOSE_PROTOCOL_ERROR);
+            return false;
+        }
+        for (size_t idx = 0; idx < (size_t)length; idx++) {
+            payload[offset + idx] ^= mask[idx % 4];
+        }
+
+        if (opcode == OPCODE_CLOSE) {
+            this->close(CLOSE_NORMAL);
+            return false;
+        }
+        else if (opcode == OPCODE_PING) {
+            this->sendFrame(OPCODE_PONG, payload.data(), payload.size());
+        }
+        else if (opcode == OPCODE_PONG) {
+            continue;
+        }
+        else if ((opcode == OPCODE_TEXT) || (opcode == OPCODE_BINARY)) {
+            if (fragmented) {
+                this->close(CLOSE_PROTOCOL_ERROR);
+                return false;
+            }
+            binary = (opcode == OPCODE_BINARY);
+            fragmented = !fin;
+        }
+        else if ((opcode == OPCODE_CONTINUATION) && fragmented) {
+            fragmented = !fin;
+        }
+        else {
+            this->close(CLOSE_PROTOCOL_ERROR);
+            return false;
+        }
+        if (!control && fin) {
+            return true;
+        }
+    }
+}
+
+// Sec-WebSocket-Accept, base64 of the SHA-1 of the key of the client and the magic of RFC 6455
+static std::string accept_key(const std::string &key) {
+    std::string text = key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    unsigned char digest[SHA_DIGEST_LENGTH];
+    SHA1((const unsigned char*)text.data(), text.size(), digest);
+    unsigned char encoded[4 * ((SHA_DIGEST_LENGTH + 2) / 3) + 1];
+    EVP_EncodeBlock(encoded, digest, SHA_DIGEST_LENGTH);
+    return std::string((const char*)encoded);
+}
+
+static std::string lower(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+    return text;
+}
+
+static void reply_status(int fd, const std::string &status, const std::string &headers="") {
+    std::string response = "HTTP/1.1 " + status + "\r\n" + headers + "Content-Length: 0\r\nConnection: close\r\n\r\n";
+    write_all(fd, response.data(), response.size());
+}
+
+WebSocketServer::WebSocketServer(const std::string &host, int port, const std::string &path, size_t max_message,
+                                 int max_connections, std::function<void(WebSocket::Ptr)> serve):
+    fd(-1), path(path), max_message(max_message), max_connections(max_connections), serve(serve), connections(0) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    struct addrinfo *addrs = NULL;
+    std::string service = std::to_string(port);
+    if (getaddrinfo(host.empty()? NULL : host.c_str(), service.c_str(), &hints, &addrs) != 0) {
+        throw std::logic_error("Cannot resolve " + host);
+    }
+    for (struct addrinfo *addr = addrs; (addr != NULL) && (this->fd < 0); addr = addr->ai_next) {
+        this->fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+        if (this->fd < 0) {
+            continue;
+        }
+        int one = 1;
+        setsockopt(this->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if ((bind(this->fd, addr->ai_addr, addr->ai_addrlen) != 0) || (listen(this->fd, SOMAXCONN) != 0)) {
+            ::close(this->fd);
+            this->fd = -1;
+        }
+    }
+    freeaddrinfo(addrs);
+    if (this->fd < 0) {
+        throw std::logic_error("Cannot listen to " + host + ":" + service);
+    }
+    this->thread = std::thread(&WebSocketServer::run, this);
+}
+
+WebSocketServer::~WebSocketServer() {
+    // Wakes accept() up, then every connection, whose threads use this until they are done
+    ::shutdown(this->fd, SHUT_RDWR);
+    this->thread.join();
+    ::close(this->fd);
+    std::unique_lock<std::mutex> lock(this->mutex);
+    for (int client : this->clients) {
+        ::shutdown(client, SHUT_RDWR);
+    }
+    while (!this->clients.empty()) {
+        this->closed.wait(lock);
+    }
+}
+
+void WebSocketServer::run() {
+    static const char busy[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    while (true) {
+        int client = accept(this->fd, NULL, NULL);
+        if (client < 0) {
+            if ((errno == EINTR) || (errno == ECONNABORTED) || (errno == EMFILE) || (errno == ENFILE)) {
+                continue;
+            }
+            break;
+        }
+        bool admitted;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            admitted = ((int)this->clients.size() < this->max_connections + max_handshakes);
+            if (admitted) {
+                this->clients.insert(client);
+            }
+        }
+        if (!admitted) {
+            // Turned away without a thread, and without waiting for the client
+            ::send(client, busy, sizeof(busy) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+            ::close(client);
+            continue;
+        }
+        std::thread(&WebSocketServer::connect, this, client).detach();
+    }
+}
+
+// The thread of a connection. Its socket is closed under the mutex, so that the destructor
+// never shuts down a descriptor which has been reused meanwhile.
+void WebSocketServer::connect(int client) {
+    this->upgrade(client);
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->clients.erase(client);
+    ::close(client);
+    this->closed.notify_all();
+}
+
+// Upgrade a connection and serve it
+void WebSocketServer::upgrade(int client) {
+    int one = 1;
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    set_timeout(client, SO_RCVTIMEO, handshake_timeout_s);
+    set_timeout(client, SO_SNDTIMEO, send_timeout_s);
+
+    std::string request;
+    size_t end = std::string::npos;
+    char chunk[1024];
+    while ((end == std::string::npos) && (request.size() < max_handshake)) {
+        ssize_t received = ::recv(client, chunk, sizeof(chunk), 0);
+        if (received <= 0) {
+            return;
+        }
+        request.append(chunk, received);
+        end = request.find("\r\n\r\n");
+    }
+    if (end == std::string::npos) {
+        reply_status(client, "431 Request Header Fields Too Large");
+        return;
+    }
+
+    std::istringstream lines(request.substr(0, end + 2));
+    std::string line, method, target, version;
+    std::getline(lines, line);
+    std::istringstream(line) >> method >> target >> version;
+    std::map<std::string, std::string> headers;
+    while (std::getline(lines, line)) {
+        auto colon = line.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        auto first = line.find_first_not_of(" \t", colon + 1);
+        auto last = line.find_last_not_of(" \t\r");
+        headers[lower(line.substr(0, colon))] = (first == std::string::npos)? "" : line.substr(first, last + 1 - first);
+    }
+
+    std::string status;
+    if ((method != "GET") || (version != "HTTP/1.1") ||
+        (lower(headers["upgrade"]).find("websocket") == std::string::npos) ||
+        (lower(headers["connection"]).find("upgrade") == std::string::npos) || headers["sec-websocket-key"].empty()) {
+        status = "400 Bad Request";
+    }
+    else if (headers["sec-websocket-version"] != "13") {
+        reply_status(client, "426 Upgrade Required", "Sec-WebSocket-Version: 13\r\n");
+        return;
+    }
+    else if (target.substr(0, target.find('?')) != this->path) {
+        status = "404 Not Found";
+    }
+    else {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (this->connections < this->max_connections) {
+            this->connections++;
+        }
+        else {
+            status = "503 Service Unavailable";
+        }
+    }
+    if (!status.empty()) {
+        std::cout << "WebSocket rejected (" << status << ")" << std::endl;
+        reply_status(client, status);
+        return;
+    }
+
+    std::string response = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                           "Sec-WebSocket-Accept: " + accept_key(headers["sec-websocket-key"]) + "\r\n\r\n";
+    if (write_all(client, response.data(), response.size())) {
+        // From here on the socket does not block, and pings keep an idle client in check.
+        // Other threads may still hold the socket, but only this one touches the descriptor.
+        WebSocket::Ptr socket;
+        try {
+            socket = std::make_shared<WebSocket>(client, target, request.substr(end + 4), this->max_message);
+            this->serve(socket);
+        }
+        catch (std::exception const &e) {
+            std::cout << "WebSocket failed (" << e.what() << ")" << std::endl;
+        }
+        if (socket) {
+            socket->finish();
+        }
+    }
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->connections--;
+}
+
+} // namespace NexInferenceEngine
@@ -0,0 +1,120 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+namespace NexInferenceEngine {
+
+// The server end of one WebSocket connection (RFC 6455). Only the thread which receives
+// touches the socket: any thread may send, which queues the message whole and never blocks,
+// and the queue goes out from within receive(). A client which falls too far behind on
+// reading is disconnected, as is one which stays silent through a ping.
+class WebSocket {
+private:
+    typedef std::chrono::steady_clock clock;
+
+    int fd;                 // owned by the caller, non-blocking from here on
+    int wake;               // eventfd, signalled when output is queued or the socket closed
+    std::string path;       // of the upgraded request, with its query
+    size_t max_message;
+    std::string input;      // received ahead of the frame being read
+    clock::time_point last_received;
+    bool pinged;
+    std::mutex send_mutex;
+    std::string output;     // queued for the client
+    bool closed;            // no more frames are queued
+
+    bool read(char *data, size_t size);
+    bool pump();
+    bool flush();
+    bool sendFrame(int opcode, const char *data, size_t size);
+    void queueClose(int code);
+
+    WebSocket(const WebSocket&);
+    WebSocket& operator=(const WebSocket&);
+
+public:
+    typedef std::shared_ptr<WebSocket> Ptr;
+
+    WebSocket(int fd, const std::string &path, const std::string &input, size_t max_message);
+    ~WebSocket();
+
+    const std::string& target() const {return this->path;};
+
+    // Blocks for the next text or binary message, sending the queue and answering pings
+    // meanwhile. False once the connection is closed, by either end, because the client
+    // broke the protocol, stopped reading or went silent.
+    bool receive(std::string &message, bool &binary);
+    // False once the connection is closed
+    bool send(const std::string &message, bool binary=false);
+    // Say goodbye with a status code. Nothing is received or queued after it.
+    void close(int code=1000);
+    // On the thread which received: close, send what is still queued for a few seconds at
+    // most, and stop both directions
+    void finish();
+};
+
+// Accepts WebSocket connections to one path on a port of its own, as the HTTP listener of
+// cpprestsdk cannot hand a connection over after an upgrade. Each connection is served by
+// a thread of its own for as long as `serve` runs. Connections beyond max_connections and a
+// few handshakes are turned away before they get a thread. The destructor closes every
+// connection and waits for their threads.
+class WebSocketServer {
+private:
+    int fd;
+    std::string path;
+    size_t max_message;
+    int max_connections;
+    std::function<void(WebSocket::Ptr)> serve;
+    std::mutex mutex;
+    std::condition_variable closed;
+    std::set<int> clients;  // sockets which have a thread
+    int connections;        // upgraded ones
+    std::thread thread;
+
+    void run();
+    void connect(int client);
+    void upgrade(int client);
+
+    WebSocketServer(const WebSocketServer&);
+    WebSocketServer& operator=(const WebSocketServer&);
+
+public:
+    // Throws std::logic_error when the address cannot be bound
+    WebSocketServer(const std::string &host, int port, const std::string &path, size_t max_message,
+                    int max_connections, std::function<void(WebSocket::Ptr)> serve);
+    ~WebSocketServer();
+};
+
+} // namespace NexInferenceEngine
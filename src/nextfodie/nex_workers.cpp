@@ -0,0 +1,413 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sched.h>
+#include <signal.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/file.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <set>
+#include <unistd.h>
+
+#include "nex_topology.h"
+#include "nex_workers.h"
+
+static bool reuse_port = false;
+
+// cpprestsdk gives no access to its listening socket, so SO_REUSEPORT is set on the way
+// into bind(), which the executable provides ahead of libc for the libraries it links
+extern "C" int bind(int fd, const struct sockaddr *addr, socklen_t len) {
+    typedef int (*bind_function)(int, const struct sockaddr*, socklen_t);
+    static bind_function libc_bind = (bind_function)dlsym(RTLD_NEXT, "bind");
+    if (reuse_port && (addr != NULL) && ((addr->sa_family == AF_INET) || (addr->sa_family == AF_INET6))) {
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    }
+    return libc_bind(fd, addr, len);
+}
+
+static void copy_file(const std::string &from, const std::string &to) {
+    std::ifstream src(from, std::ios::binary);
+    std::ofstream dst(to, std::ios::binary);
+    if (!src || !dst || !(dst << src.rdbuf())) {
+        throw std::logic_error("Cannot copy " + from + " to " + to);
+    }
+}
+
+static void remove_directory(const std::string &dirpath) {
+    DIR *dir = opendir(dirpath.c_str());
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if ((strcmp(entry->d_name, ".") != 0) && (strcmp(entry->d_name, "..") != 0)) {
+            remove((dirpath + "/" + entry->d_name).c_str());
+        }
+    }
+    closedir(dir);
+    rmdir(dirpath.c_str());
+}
+
+// Serializes updates of the shared manifest between workers, and between the threads of
+// one worker (flock() locks of separate open()s exclude each other)
+class ManifestLock {
+private:
+    int fd;
+
+public:
+    ManifestLock(const std::string &manifest) {
+        this->fd = open((manifest + ".lock").c_str(), O_CREAT | O_RDWR, 0600);
+        if ((this->fd < 0) || (flock(this->fd, LOCK_EX) != 0)) {
+            if (this->fd >= 0) {
+                close(this->fd);
+            }
+            throw std::logic_error("Cannot lock " + manifest);
+        }
+    };
+    ~ManifestLock() {close(this->fd);};
+};
+
+static std::mutex worker_mutex;     // Worker::model, between the listener and the reloading thread
+
+static std::string directory_of(const std::string &filepath) {
+    return filepath.substr(0, filepath.rfind('/'));
+}
+
+namespace NexInferenceEngine {
+
+// Where a worker notes the manifest it is loading
+static std::string loading_path(const Worker &worker) {
+    return directory_of(worker.manifest) + "/loading." + std::to_string(worker.index);
+}
+
+// Remove the model files in the shared directory which neither the manifest nor a worker
+// still loading an earlier one names. Runs under the manifest lock.
+static void remove_superseded(const Worker &worker) {
+    std::string shared_dir = directory_of(worker.manifest);
+    std::set<std::string> needed;
+    std::vector<std::string> models;
+    DIR *dir = opendir(shared_dir.c_str());
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        std::string name(entry->d_name);
+        if ((name == ".") || (name == "..") || (name.compare(0, 8, "manifest") == 0)) {
+            continue;
+        }
+        if (name.compare(0, 8, "loading.") != 0) {
+            models.push_back(shared_dir + "/" + name);
+            continue;
+        }
+        ModelManifest loading;
+        if (loading.read(shared_dir + "/" + name)) {
+            needed.insert({loading.xml, loading.bin, loading.labelmap});
+        }
+    }
+    closedir(dir);
+
+    ModelManifest current;
+    if (current.read(worker.manifest)) {
+        needed.insert({current.xml, current.bin, current.labelmap});
+    }
+    for (auto &path : models) {
+        if (needed.find(path) == needed.end()) {
+            remove(path.c_str());
+        }
+    }
+}
+
+bool ModelManifest::read(const std::string &filepath) {
+    std::ifstream file(filepath);
+    if (!file) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        auto pos = line.find(' ');
+        std::string key = line.substr(0, pos);
+        std::string value = (pos == std::string::npos)? "" : line.substr(pos + 1);
+        if (key == "xml") {
+            this->xml = value;
+        }
+        else if (key == "bin") {
+            this->bin = value;
+        }
+        else if (key == "labelmap") {
+            this->labelmap = value;
+        }
+        else if (key == "class_thresholds") {
+            this->class_thresholds = value;
+        }
+    }
+    return true;
+}
+
+void ModelManifest::write(const std::string &filepath) const {
+    // One line per entry, written aside and renamed so that readers never see half of it
+    std::string thresholds = this->class_thresholds;
+    std::replace(thresholds.begin(), thresholds.end(), '\n', ',');
+    std::string temp_path = filepath + ".tmp";
+    {
+        std::ofstream file(temp_path);
+        file << "xml " << this->xml << "\n"
+             << "bin " << this->bin << "\n"
+             << "labelmap " << this->labelmap << "\n"
+             << "class_thresholds " << thresholds << "\n";
+        if (!file) {
+            throw std::logic_error("Cannot write " + temp_path);
+        }
+    }
+    if (rename(temp_path.c_str(), filepath.c_str()) != 0) {
+        throw std::logic_error("Cannot write " + filepath);
+    }
+}
+
+std::vector<std::vector<int>> partition_cpus(int count) {
+    std::vector<int> allowed = allowed_cpus();
+    std::vector<std::vector<int>> nodes = numa_nodes(allowed);
+
+    // Workers go round the nodes, and split the CPUs of their node between them
+    std::vector<std::vector<int>> result(count);
+    if (allowed.empty()) {
+        return result;
+    }
+    for (size_t node = 0; node < nodes.size(); node++) {
+        std::vector<int> members;
+        for (int idx = (int)node; idx < count; idx += (int)nodes.size()) {
+            members.push_back(idx);
+        }
+        const std::vector<int> &cpus = nodes[node];
+        for (size_t member = 0; member < members.size(); member++) {
+            std::vector<int> &set = result[members[member]];
+            if (members.size() > cpus.size()) {
+                set.push_back(cpus[member % cpus.size()]);
+                continue;
+            }
+            size_t first = cpus.size() * member / members.size();
+            size_t last  = cpus.size() * (member + 1) / members.size();
+            set.assign(cpus.begin() + first, cpus.begin() + last);
+        }
+    }
+    return result;
+}
+
+void set_reuseport(bool enable) {
+    reuse_port = enable;
+}
+
+bool run_workers(int count, const ModelManifest &manifest, Worker &worker) {
+    // The shared manifest, and the models uploaded to any worker, live in a private directory
+    const char *tmpdir = std::getenv("TMPDIR");
+    std::string dir_template = std::string((tmpdir != NULL)? tmpdir : "/tmp") + "/nextfodie.XXXXXX";
+    std::vector<char> dirpath(dir_template.begin(), dir_template.end());
+    dirpath.push_back('\0');
+    if (mkdtemp(dirpath.data()) == NULL) {
+        throw std::logic_error("Cannot create " + dir_template);
+    }
+    std::string shared_dir(dirpath.data());
+    std::string manifest_path = shared_dir + "/manifest";
+    manifest.write(manifest_path);
+
+    sigset_t signals, previous;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGCHLD);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    sigprocmask(SIG_BLOCK, &signals, &previous);
+
+    auto cpu_sets = partition_cpus(count);
+    std::vector<pid_t> pids(count, 0);
+    std::vector<std::chrono::steady_clock::time_point> started(count);
+    auto spawn = [&](int idx) {
+        std::cout << std::flush;
+        pid_t pid = fork();
+        if (pid < 0) {
+            throw std::logic_error("Cannot fork worker");
+        }
+        if (pid == 0) {
+            // SIGHUP stays blocked in every thread of the worker for wait_model_update()
+            sigset_t hangup;
+            sigemptyset(&hangup);
+            sigaddset(&hangup, SIGHUP);
+            sigprocmask(SIG_SETMASK, &previous, NULL);
+            sigprocmask(SIG_BLOCK, &hangup, NULL);
+            prctl(PR_SET_PDEATHSIG, SIGTERM);
+            worker.index = idx;
+            worker.cpus = cpu_sets[idx];
+            worker.manifest = manifest_path;
+            return true;
+        }
+        pids[idx] = pid;
+        started[idx] = std::chrono::steady_clock::now();
+        std::cout << "Worker " << idx << " (pid " << pid << ") on CPUs "
+                  << (cpu_sets[idx].empty()? "any" : format_cpulist(cpu_sets[idx])) << std::endl;
+        return false;
+    };
+
+    for (int idx = 0; idx < count; idx++) {
+        if (spawn(idx)) {
+            return true;
+        }
+    }
+
+    while (true) {
+        siginfo_t info;
+        int sig = sigwaitinfo(&signals, &info);
+        if (sig == SIGHUP) {
+            // A worker published a model, the others reload it
+            for (pid_t pid : pids) {
+                if ((pid > 0) && (pid != info.si_pid)) {
+                    kill(pid, SIGHUP);
+                }
+            }
+        }
+        else if (sig == SIGCHLD) {
+            int status;
+            pid_t pid;
+            while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+                auto it = std::find(pids.begin(), pids.end(), pid);
+                if (it == pids.end()) {
+                    continue;
+                }
+                int idx = (int)(it - pids.begin());
+                pids[idx] = 0;
+                if (WIFSIGNALED(status)) {
+                    std::cout << "Worker " << idx << " (pid " << pid << ") killed by signal " << WTERMSIG(status) << std::endl;
+                } else {
+                    std::cout << "Worker " << idx << " (pid " << pid << ") exited with " << WEXITSTATUS(status) << std::endl;
+                }
+
+                // Do not spin on a worker which cannot start
+                if (std::chrono::steady_clock::now() - started[idx] < std::chrono::seconds(1)) {
+                    std::this_thread::sleep_for(std::chrono::seconds(1));
+                }
+                if (spawn(idx)) {
+                    return true;
+                }
+            }
+        }
+        else if ((sig == SIGTERM) || (sig == SIGINT)) {
+            for (pid_t pid : pids) {
+                if (pid > 0) {
+                    kill(pid, SIGTERM);
+                }
+            }
+            for (pid_t pid : pids) {
+                if (pid > 0) {
+                    waitpid(pid, NULL, 0);
+                }
+            }
+            remove_directory(shared_dir);
+            return false;
+        }
+    }
+}
+
+void publish_model(Worker &worker, const std::string &xml, const std::string &bin,
+                   const std::string &labelmap, const std::string *class_thresholds) {
+    static std::atomic<int> sequence(0);
+    std::ostringstream prefix;
+    prefix << directory_of(worker.manifest) << "/" << getpid() << "-" << sequence++;
+
+    {
+        // Serialize updates from different workers, the last one wins
+        ManifestLock lock(worker.manifest);
+        ModelManifest manifest;
+        manifest.read(worker.manifest);
+        if (!xml.empty()) {
+            manifest.xml = prefix.str() + ".xml";
+            manifest.bin = prefix.str() + ".bin";
+            copy_file(xml, manifest.xml);
+            copy_file(bin, manifest.bin);
+        }
+        if (!labelmap.empty()) {
+            manifest.labelmap = prefix.str() + ".labelmap";
+            copy_file(labelmap, manifest.labelmap);
+        }
+        if (class_thresholds != NULL) {
+            manifest.class_thresholds = *class_thresholds;
+        }
+        manifest.write(worker.manifest);
+        remove_superseded(worker);
+        std::lock_guard<std::mutex> guard(worker_mutex);
+        worker.model = manifest;
+    }
+    kill(getppid(), SIGHUP);
+}
+
+bool begin_model_load(Worker &worker, ModelManifest &manifest, bool &same_network) {
+    ManifestLock lock(worker.manifest);
+    if (!manifest.read(worker.manifest)) {
+        return false;
+    }
+    manifest.write(loading_path(worker));
+    std::lock_guard<std::mutex> guard(worker_mutex);
+    same_network = !manifest.xml.empty() && (manifest.xml == worker.model.xml) && (manifest.bin == worker.model.bin);
+    return true;
+}
+
+void finish_model_load(Worker &worker, const ModelManifest *loaded) {
+    ManifestLock lock(worker.manifest);
+    remove(loading_path(worker).c_str());
+    remove_superseded(worker);
+    if (loaded != NULL) {
+        std::lock_guard<std::mutex> guard(worker_mutex);
+        worker.model = *loaded;
+    }
+}
+
+void wait_model_update() {
+    sigset_t hangup;
+    sigemptyset(&hangup);
+    sigaddset(&hangup, SIGHUP);
+    int sig;
+    while (sigwait(&hangup, &sig) != 0);
+}
+
+} // namespace NexInferenceEngine
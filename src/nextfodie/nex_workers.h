@@ -0,0 +1,79 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#pragma once
+#include <string>
+#include <vector>
+
+namespace NexInferenceEngine {
+
+// Model files and settings every worker runs. Workers load it when they start and again
+// whenever another worker publishes a change.
+struct ModelManifest {
+    std::string xml;
+    std::string bin;                // empty for the .bin next to the .xml
+    std::string labelmap;           // empty for none
+    std::string class_thresholds;   // as given to parse_class_thresholds()
+
+    bool read(const std::string &filepath);
+    void write(const std::string &filepath) const;
+};
+
+// One process of the prefork mode
+struct Worker {
+    int index;
+    std::vector<int> cpus;          // empty to run on any CPU
+    std::string manifest;           // path of the shared ModelManifest
+    ModelManifest model;            // what it runs, to tell what a new manifest changes
+};
+
+// Prefork mode: the supervisor forks `count` workers which all listen on the same port,
+// each pinned to its own CPUs (a NUMA node when there are several), and restarts the ones
+// that die. Returns true in a worker, and false in the supervisor once it was told to stop.
+bool run_workers(int count, const ModelManifest &manifest, Worker &worker);
+
+// Listening sockets bound from now on share their port with the other workers
+void set_reuseport(bool enable);
+
+// Replace the shared model after this worker loaded it and have the other workers reload.
+// Files are copied next to the manifest since uploads are temporary, empty ones are kept.
+// Copies which no worker needs any more are removed.
+void publish_model(Worker &worker, const std::string &xml, const std::string &bin,
+                   const std::string &labelmap, const std::string *class_thresholds);
+
+// Read the shared manifest to load it, false when there is none. same_network tells that
+// it names the network the worker runs, so only labels and class thresholds changed. The
+// files it names stay until finish_model_load(), even when another worker replaces them.
+bool begin_model_load(Worker &worker, ModelManifest &manifest, bool &same_network);
+// After loading what begin_model_load() returned, or failing to (loaded is NULL then).
+// Shared files which no worker needs any more are removed.
+void finish_model_load(Worker &worker, const ModelManifest *loaded);
+
+// Block until another worker published a model
+void wait_model_update();
+
+std::vector<std::vector<int>> partition_cpus(int count);
+
+} // namespace NexInferenceEngine
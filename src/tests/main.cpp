@@ -0,0 +1,71 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#include <cstring>
+#include <iostream>
+
+#include "nex_tests.h"
+
+int test_binary_format();
+int test_class_rules();
+int test_letterbox();
+int test_nms();
+int test_tracker();
+
+static const struct {
+    const char *name;
+    int (*run)();
+} tests[] = {
+    {"binary_format", test_binary_format},
+    {"class_rules", test_class_rules},
+    {"letterbox", test_letterbox},
+    {"nms", test_nms},
+    {"tracker", test_tracker},
+};
+
+int &NexTests::failure_count() {
+    static int count = 0;
+    return count;
+}
+
+// Runs the test named on the command line, or all of them
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    int run = 0;
+    for (auto &test : tests) {
+        if ((argc > 1) && (strcmp(argv[1], test.name) != 0)) {
+            continue;
+        }
+        int failures = test.run();
+        std::cout << test.name << ": " << (failures? "FAILED" : "passed") << std::endl;
+        failed += (failures > 0);
+        run++;
+    }
+    if (run == 0) {
+        std::cerr << "No test named " << argv[1] << std::endl;
+        return 1;
+    }
+    return failed? 1 : 0;
+}
@@ -0,0 +1,50 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#pragma once
+#include <iostream>
+#include <string>
+
+// The smallest test harness: checks report what failed and count, a test returns the count
+namespace NexTests {
+
+int &failure_count();
+
+inline void reset() {failure_count() = 0;}
+inline int failures() {return failure_count();}
+
+inline void fail(const std::string &name, const char *condition, const char *file, int line) {
+    std::cerr << file << ":" << line << ": " << name << ": " << condition << std::endl;
+    failure_count()++;
+}
+
+} // namespace NexTests
+
+#define NEX_CHECK(name, condition) \
+    do { \
+        if (!(condition)) { \
+            NexTests::fail((name), #condition, __FILE__, __LINE__); \
+        } \
+    } while (0)
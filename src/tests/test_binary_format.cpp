@@ -0,0 +1,202 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "nex_binary_writer.h"
+#include "nex_detector.h"
+#include "nex_tests.h"
+
+namespace NexIE = NexInferenceEngine;
+
+// Only formats detections, pack() is all that is used of it
+class PackingDetector : public NexIE::Detector {
+protected:
+    NexIE::Detections runRegions(const std::shared_ptr<const NexIE::Model> &, cv::Mat &, std::vector<cv::Rect> &,
+                                 const NexIE::ClassRules &) {return NexIE::Detections();};
+    void runBatch(const std::shared_ptr<const NexIE::Model> &, std::vector<cv::Mat> &,
+                  std::vector<NexIE::Detections> &) {};
+
+public:
+    void loadModel(std::string &, std::string &, NexIE::LabelMap::Ptr, const NexIE::ClassThresholds *) {};
+    NexIE::BenchmarkSession::Ptr openBenchmark(int, int) {return nullptr;};
+    NexIE::Detections infer(cv::Mat &) {return NexIE::Detections();};
+    NexIE::Detections inferRaw(const NexIE::RawImage &) {return NexIE::Detections();};
+};
+
+// Reads a body back as doc/binary_format.md lays it out
+class Reader {
+private:
+    const std::string &data;
+    size_t offset;
+
+public:
+    Reader(const std::string &data, size_t offset=0): data(data), offset(offset) {};
+
+    bool done() const {return this->offset == this->data.size();};
+    uint32_t uint(int bytes) {
+        uint32_t value = 0;
+        for (int idx = 0; idx < bytes; idx++) {
+            value |= (uint32_t)(uint8_t)this->data.at(this->offset++) << (8 * idx);
+        }
+        return value;
+    };
+    float f32() {
+        uint32_t bits = this->uint(4);
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    };
+    float f16() {
+        uint32_t half = this->uint(2);
+        float magnitude = std::ldexp((float)(half & 0x3ff) + (((half >> 10) & 0x1f)? 1024.0f : 0.0f),
+                                     std::max(1, (int)((half >> 10) & 0x1f)) - 25);
+        return (half & 0x8000)? -magnitude : magnitude;
+    };
+};
+
+static void check_halves() {
+    struct {
+        float value;
+        uint16_t half;
+    } cases[] = {
+        {0.0f, 0x0000},
+        {-0.0f, 0x8000},
+        {1.0f, 0x3c00},
+        {-2.0f, 0xc000},
+        {0.1f, 0x2e66},
+        {65504.0f, 0x7bff},                         // largest finite
+        {65519.0f, 0x7bff},                         // rounds down to it
+        {65520.0f, 0x7c00},                         // rounds up to infinity
+        {1e10f, 0x7c00},
+        {-1e10f, 0xfc00},
+        {std::numeric_limits<float>::infinity(), 0x7c00},
+        {std::ldexp(1.0f, -14), 0x0400},            // smallest normal
+        {std::ldexp(1023.0f, -24), 0x03ff},         // largest subnormal
+        {std::ldexp(1.0f, -24), 0x0001},            // smallest subnormal
+        {std::ldexp(3.0f, -26), 0x0001},            // 0.75 of it rounds up
+        {std::ldexp(1.0f, -25), 0x0000},            // half of it rounds to even
+        {std::ldexp(1.0f, -30), 0x0000},            // underflow
+        {1.0f + std::ldexp(1.0f, -11), 0x3c00},     // halfway, to even
+        {1.0f + std::ldexp(3.0f, -11), 0x3c02},     // halfway, to even upwards
+    };
+    for (auto &item : cases) {
+        uint16_t half = NexIE::float_to_half(item.value);
+        NEX_CHECK("half of " + std::to_string(item.value), half == item.half);
+    }
+    // A NaN stays a NaN: all exponent bits and some mantissa bit set
+    uint16_t nan = NexIE::float_to_half(std::numeric_limits<float>::quiet_NaN());
+    NEX_CHECK("half of nan", ((nan & 0x7c00) == 0x7c00) && ((nan & 0x3ff) != 0));
+}
+
+// Output rows (image_id, label, conf, xmin, ymin, xmax, ymax) of a 300x300 network on a
+// 300x300 image, so that boxes are 300 times their coordinates
+static NexIE::Detections make_detections(const std::vector<std::vector<float>> &rows, bool tracked=false) {
+    auto network = std::make_shared<NexIE::NetworkShape>();
+    network->input_w = 300;
+    network->input_h = 300;
+    network->object_size = 7;
+    auto model = std::make_shared<NexIE::Model>();
+    model->network = network;
+    model->version = 42;
+    NexIE::Detections detections;
+    detections.model = model;
+    detections.letterbox = NexIE::make_letterbox(300, 300, 300, 300);
+    detections.tracked = tracked;
+    for (auto &row : rows) {
+        detections.data.insert(detections.data.end(), row.begin(), row.end());
+    }
+    detections.data.insert(detections.data.end(), {-1, 0, 0, 0, 0, 0, 0});
+    return detections;
+}
+
+static void check_header(const std::string &name, Reader &reader, uint8_t flags, uint16_t count) {
+    NEX_CHECK(name, reader.uint(4) == 0x4446584e);  // "NXFD"
+    NEX_CHECK(name, reader.uint(1) == 1);
+    NEX_CHECK(name, reader.uint(1) == flags);
+    NEX_CHECK(name, reader.uint(2) == count);
+    NEX_CHECK(name, reader.uint(4) == 42);
+    NEX_CHECK(name, reader.uint(4) == 300);
+    NEX_CHECK(name, reader.uint(4) == 300);
+}
+
+static void check_pack() {
+    PackingDetector detector;
+    detector.setThreshold(0.5f);
+    auto detections = make_detections({{0, 1, 0.9f, 0.1f, 0.2f, 0.5f, 0.6f},
+                                        {0, 2, 0.3f, 0.0f, 0.0f, 1.0f, 1.0f},    // under the threshold
+                                        {0, 3, 0.75f, 0.5f, 0.5f, 1.2f, 1.0f}}); // clipped to the image
+    std::string data;
+
+    // Default fields: f16 score and u16 boxes in pixels, 12 byte records
+    detector.pack(detections, data);
+    NEX_CHECK("default", data.size() == 20 + 2 * 12);
+    Reader plain(data);
+    check_header("default", plain, 0x00, 2);
+    NEX_CHECK("default", plain.uint(2) == 1);
+    NEX_CHECK("default", std::fabs(plain.f16() - 0.9f) < 1e-3f);
+    NEX_CHECK("default", (plain.uint(2) == 30) && (plain.uint(2) == 60) && (plain.uint(2) == 150) &&
+                         (plain.uint(2) == 180));
+    NEX_CHECK("default", plain.uint(2) == 3);
+    NEX_CHECK("default", std::fabs(plain.f16() - 0.75f) < 1e-3f);
+    NEX_CHECK("default", (plain.uint(2) == 150) && (plain.uint(2) == 150) && (plain.uint(2) == 300) &&
+                         (plain.uint(2) == 300));
+    NEX_CHECK("default", plain.done());
+
+    // f32 score and normalized f32 boxes with track ids, 26 byte records
+    auto tracked = make_detections({{7, 1, 0.9f, 0.1f, 0.2f, 0.5f, 0.6f}}, true);
+    detector.pack(tracked, data, true, NexIE::DetectionFilter(), true, true);
+    NEX_CHECK("f32", data.size() == 20 + 26);
+    Reader wide(data);
+    check_header("f32", wide, 0x0f, 1);
+    NEX_CHECK("f32", wide.uint(2) == 1);
+    NEX_CHECK("f32", wide.f32() == 0.9f);
+    NEX_CHECK("f32", std::fabs(wide.f32() - 0.1f) < 1e-6f);
+    NEX_CHECK("f32", std::fabs(wide.f32() - 0.2f) < 1e-6f);
+    NEX_CHECK("f32", std::fabs(wide.f32() - 0.5f) < 1e-6f);
+    NEX_CHECK("f32", std::fabs(wide.f32() - 0.6f) < 1e-6f);
+    NEX_CHECK("f32", wide.uint(4) == 7);
+    NEX_CHECK("f32", wide.done());
+
+    // The count is a u16, records beyond it are left out
+    std::vector<std::vector<float>> many(70000, {0, 1, 0.9f, 0.1f, 0.1f, 0.2f, 0.2f});
+    detector.pack(make_detections(many), data);
+    Reader capped(data);
+    check_header("count cap", capped, 0x00, 0xffff);
+    NEX_CHECK("count cap", data.size() == 20 + 0xffff * 12);
+}
+
+int test_binary_format() {
+    NexTests::reset();
+    check_halves();
+    check_pack();
+    return NexTests::failures();
+}
@@ -0,0 +1,75 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#include <memory>
+
+#include "nex_detector.h"
+#include "nex_tests.h"
+
+namespace NexIE = NexInferenceEngine;
+
+// Labels 0 background, 1 person, 2 car, 3 dog with default thresholds for person and car
+static std::shared_ptr<NexIE::Model> make_model() {
+    auto model = std::make_shared<NexIE::Model>();
+    model->labels = NexIE::LabelMap::parse("background\nperson\ncar\ndog\n");
+    model->class_thresholds["person"] = 0.3f;
+    model->class_thresholds["2"] = 0.7f;
+    model->version = 1;
+    return model;
+}
+
+int test_class_rules() {
+    NexTests::reset();
+    auto model = make_model();
+
+    // Without a threshold in the request the model defaults apply over the detector threshold
+    NexIE::ClassRules defaults(NexIE::DetectionFilter(), model.get(), 0.5f);
+    NEX_CHECK("defaults", defaults.minScore(1) == 0.3f);
+    NEX_CHECK("defaults", defaults.minScore(2) == 0.7f);
+    NEX_CHECK("defaults", defaults.minScore(3) == 0.5f);
+    NEX_CHECK("defaults", defaults.minScore(99) == 0.5f);
+
+    // A threshold in the request applies to every class, the model defaults included
+    NexIE::ClassRules strict(NexIE::DetectionFilter(0.9f), model.get(), 0.5f);
+    NEX_CHECK("threshold", strict.minScore(1) == 0.9f);
+    NEX_CHECK("threshold", strict.minScore(2) == 0.9f);
+    NEX_CHECK("threshold", strict.minScore(3) == 0.9f);
+
+    // Only the class thresholds of the request come before its threshold
+    NexIE::DetectionFilter filter(0.9f);
+    filter.class_thresholds["person"] = 0.4f;
+    NexIE::ClassRules mixed(filter, model.get(), 0.5f);
+    NEX_CHECK("class_thresholds", mixed.minScore(1) == 0.4f);
+    NEX_CHECK("class_thresholds", mixed.minScore(2) == 0.9f);
+
+    // Included classes keep their thresholds, the others never pass
+    NexIE::DetectionFilter included;
+    included.include_classes.insert("car");
+    NexIE::ClassRules only_cars(included, model.get(), 0.5f);
+    NEX_CHECK("include_classes", only_cars.minScore(2) == 0.7f);
+    NEX_CHECK("include_classes", only_cars.minScore(1) > 1.0f);
+    NEX_CHECK("include_classes", only_cars.minScore(99) > 1.0f);
+    return NexTests::failures();
+}
@@ -0,0 +1,110 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#include <cmath>
+#include <string>
+
+#include "nex_detector.h"
+#include "nex_tests.h"
+
+namespace NexIE = NexInferenceEngine;
+
+static const float tolerance = 0.01f;  // source pixels
+
+// Properties every letterbox must have, whatever the image and input sizes
+static void check_letterbox(int image_w, int image_h, int input_w, int input_h) {
+    std::string name = std::to_string(image_w) + "x" + std::to_string(image_h) + " in " +
+                       std::to_string(input_w) + "x" + std::to_string(input_h);
+    NexIE::Letterbox letterbox = NexIE::make_letterbox(image_w, image_h, input_w, input_h);
+    int resized_w = (int)(image_w * letterbox.scale_x + 0.5);
+    int resized_h = (int)(image_h * letterbox.scale_y + 0.5);
+
+    NEX_CHECK(name, (resized_w >= 1) && (resized_w <= input_w));
+    NEX_CHECK(name, (resized_h >= 1) && (resized_h <= input_h));
+    // Fills the input along at least one axis, unless an axis had to be clamped to 1 pixel
+    NEX_CHECK(name, (resized_w == input_w) || (resized_h == input_h) || (resized_w == 1) || (resized_h == 1));
+
+    // Centered: the padding on both sides differs by at most one pixel
+    int right = input_w - resized_w - letterbox.pad_left;
+    int bottom = input_h - resized_h - letterbox.pad_top;
+    NEX_CHECK(name, (letterbox.pad_left >= 0) && (right - letterbox.pad_left >= 0) && (right - letterbox.pad_left <= 1));
+    NEX_CHECK(name, (letterbox.pad_top >= 0) && (bottom - letterbox.pad_top >= 0) && (bottom - letterbox.pad_top <= 1));
+
+    // The edges of the image in the input map back to the edges of the image
+    float left_edge = (float)letterbox.pad_left / input_w;
+    float right_edge = (float)(letterbox.pad_left + resized_w) / input_w;
+    float top_edge = (float)letterbox.pad_top / input_h;
+    float bottom_edge = (float)(letterbox.pad_top + resized_h) / input_h;
+    NEX_CHECK(name, std::fabs(letterbox.imageX(left_edge)) < tolerance);
+    NEX_CHECK(name, std::fabs(letterbox.imageX(right_edge) - image_w) < tolerance);
+    NEX_CHECK(name, std::fabs(letterbox.imageY(top_edge)) < tolerance);
+    NEX_CHECK(name, std::fabs(letterbox.imageY(bottom_edge) - image_h) < tolerance);
+
+    // Without padding along an axis, 0 and 1 of the input are the image edges
+    if ((letterbox.pad_left == 0) && (right == 0)) {
+        NEX_CHECK(name, std::fabs(letterbox.imageX(0.0f)) < tolerance);
+        NEX_CHECK(name, std::fabs(letterbox.imageX(1.0f) - image_w) < tolerance);
+    }
+    if ((letterbox.pad_top == 0) && (bottom == 0)) {
+        NEX_CHECK(name, std::fabs(letterbox.imageY(0.0f)) < tolerance);
+        NEX_CHECK(name, std::fabs(letterbox.imageY(1.0f) - image_h) < tolerance);
+    }
+}
+
+int test_letterbox() {
+    NexTests::reset();
+
+    // Square, landscape and portrait
+    check_letterbox(640, 640, 300, 300);
+    check_letterbox(1920, 1080, 300, 300);
+    check_letterbox(1080, 1920, 300, 300);
+    check_letterbox(1920, 1080, 416, 320);
+    check_letterbox(1080, 1920, 416, 320);
+
+    // Exactly the input size: no scaling and no padding
+    check_letterbox(300, 300, 300, 300);
+    NexIE::Letterbox same = NexIE::make_letterbox(300, 300, 300, 300);
+    NEX_CHECK("300x300 in 300x300", (same.scale_x == 1.0f) && (same.scale_y == 1.0f));
+    NEX_CHECK("300x300 in 300x300", (same.pad_left == 0) && (same.pad_top == 0));
+
+    // Extreme strips, clamped to one pixel across
+    check_letterbox(1, 4000, 300, 300);
+    check_letterbox(4000, 1, 300, 300);
+    check_letterbox(1, 1, 300, 300);
+
+    // Sources smaller than the input are scaled up
+    check_letterbox(100, 50, 300, 300);
+    check_letterbox(37, 91, 300, 300);
+    NexIE::Letterbox upscaled = NexIE::make_letterbox(100, 50, 300, 300);
+    NEX_CHECK("100x50 in 300x300", (upscaled.scale_x == 3.0f) && (upscaled.scale_y == 3.0f));
+    NEX_CHECK("100x50 in 300x300", (upscaled.pad_left == 0) && (upscaled.pad_top == 75));
+
+    // Odd sizes, where the padding cannot be split evenly
+    for (int size = 1; size < 64; size += 3) {
+        check_letterbox(size * 7, size * 3 + 1, 300, 299);
+        check_letterbox(size * 3 + 1, size * 7, 301, 300);
+    }
+    return NexTests::failures();
+}
@@ -0,0 +1,91 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#include <memory>
+#include <vector>
+
+#include "nex_detector.h"
+#include "nex_tests.h"
+
+namespace NexIE = NexInferenceEngine;
+
+// Only opens up how regions are merged
+class MergingDetector : public NexIE::Detector {
+public:
+    using NexIE::Detector::mergedDetections;
+};
+
+// Merged rows (0, label, conf, xmin, ymin, xmax, ymax) of a model with room for 10 of them,
+// without the end marker
+static std::vector<std::vector<float>> merge(std::vector<float> merged) {
+    auto network = std::make_shared<NexIE::NetworkShape>();
+    network->object_size = 7;
+    network->max_output_count = 10;
+    auto model = std::make_shared<NexIE::Model>();
+    model->network = network;
+    NexIE::Detections detections = MergingDetector::mergedDetections(merged, model, cv::Size(100, 100));
+    std::vector<std::vector<float>> rows;
+    for (size_t idx = 0; idx + 7 <= detections.data.size(); idx += 7) {
+        if (detections.data[idx] < 0) {
+            break;
+        }
+        rows.emplace_back(detections.data.begin() + idx, detections.data.begin() + idx + 7);
+    }
+    return rows;
+}
+
+int test_nms() {
+    NexTests::reset();
+
+    // The same object seen by two tiles is kept once, the best scored
+    auto rows = merge({0, 1, 0.6f, 0.10f, 0.10f, 0.50f, 0.50f,
+                       0, 1, 0.9f, 0.12f, 0.11f, 0.51f, 0.52f});
+    NEX_CHECK("same class", rows.size() == 1);
+    NEX_CHECK("same class", !rows.empty() && (rows[0][2] == 0.9f));
+
+    // Overlapping boxes of different classes, a rider on a bicycle, are both kept
+    rows = merge({0, 1, 0.6f, 0.10f, 0.10f, 0.50f, 0.50f,
+                  0, 2, 0.9f, 0.12f, 0.11f, 0.51f, 0.52f,
+                  0, 1, 0.5f, 0.11f, 0.10f, 0.50f, 0.51f});
+    NEX_CHECK("other class", rows.size() == 2);
+    NEX_CHECK("other class", (rows.size() == 2) && (rows[0][1] == 2) && (rows[0][2] == 0.9f));
+    NEX_CHECK("other class", (rows.size() == 2) && (rows[1][1] == 1) && (rows[1][2] == 0.6f));
+
+    // Boxes overlapping by no more than the IoU threshold are separate objects
+    rows = merge({0, 1, 0.6f, 0.0f, 0.0f, 0.4f, 0.4f,
+                  0, 1, 0.7f, 0.3f, 0.3f, 0.7f, 0.7f});
+    NEX_CHECK("apart", rows.size() == 2);
+    NEX_CHECK("apart", (rows.size() == 2) && (rows[0][2] == 0.7f) && (rows[1][2] == 0.6f));
+
+    // At most max_output_count survive
+    std::vector<float> many;
+    for (int idx = 0; idx < 15; idx++) {
+        float x = 0.06f * idx;
+        many.insert(many.end(), {0, 1, 0.5f, x, 0.0f, x + 0.05f, 0.05f});
+    }
+    NEX_CHECK("output count", merge(many).size() == 10);
+
+    return NexTests::failures();
+}
@@ -0,0 +1,138 @@
+/*
+ *******************************************************************************
+ *
+ * Copyright (C) 2019 NEXAIOT Co., Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ *******************************************************************************
+ */
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "nex_tests.h"
+#include "nex_tracker.h"
+
+namespace NexIE = NexInferenceEngine;
+
+// Rows of Tracker::detections() which are not the end marker
+static std::vector<std::vector<float>> tracked_rows(const NexIE::Tracker &tracker) {
+    std::vector<std::vector<float>> rows;
+    NexIE::Detections detections = tracker.detections();
+    for (size_t idx = 0; idx + 7 <= detections.data.size(); idx += 7) {
+        if (detections.data[idx] < 0) {
+            break;
+        }
+        rows.emplace_back(detections.data.begin() + idx, detections.data.begin() + idx + 7);
+    }
+    return rows;
+}
+
+static NexIE::Tracker make_tracker() {
+    auto model = std::make_shared<NexIE::Model>();
+    model->version = 1;
+    NexIE::Tracker tracker;
+    tracker.model = model;
+    tracker.image = cv::Size(640, 480);
+    return tracker;
+}
+
+// Two objects moving at constant velocity, inferred every third frame, keep their ids and
+// the frames in between follow them
+static void check_constant_velocity() {
+    NexIE::Tracker tracker = make_tracker();
+    uint32_t ids[2] = {0, 0};
+    for (int frame = 0; frame < 30; frame++) {
+        float x = 0.1f + 0.01f * frame;
+        float y = 0.6f - 0.005f * frame;
+        if (frame % 3 == 0) {
+            tracker.update({1, 0.9f, x, 0.2f, x + 0.1f, 0.4f,
+                            2, 0.8f, 0.5f, y, 0.7f, y + 0.2f});
+        }
+        else {
+            tracker.predict();
+        }
+        auto rows = tracked_rows(tracker);
+        std::string name = "constant velocity, frame " + std::to_string(frame);
+        NEX_CHECK(name, rows.size() == 2);
+        if (rows.size() != 2) {
+            return;
+        }
+        for (auto &row : rows) {
+            int object = (row[1] == 1)? 0 : 1;
+            if (frame == 0) {
+                ids[object] = (uint32_t)row[0];
+            }
+            NEX_CHECK(name, (uint32_t)row[0] == ids[object]);
+            // Predictions lag until the velocity is learned, then stay close
+            if (frame >= 9) {
+                float expected = (object == 0)? x : 0.5f;
+                NEX_CHECK(name, std::fabs(row[3] - expected) < 0.01f);
+                NEX_CHECK(name, std::fabs(row[4] - ((object == 0)? 0.2f : y)) < 0.01f);
+            }
+        }
+    }
+    NEX_CHECK("constant velocity", (ids[0] != 0) && (ids[1] != 0) && (ids[0] != ids[1]));
+    NEX_CHECK("constant velocity", tracker.size() == 2);
+}
+
+// A track survives max_misses inferred frames without a match, reported but not drawn, and
+// is dropped after that
+static void check_misses() {
+    NexIE::Tracker tracker = make_tracker();
+    std::vector<float> box = {1, 0.9f, 0.2f, 0.2f, 0.4f, 0.4f};
+    tracker.update(box);
+    auto rows = tracked_rows(tracker);
+    NEX_CHECK("misses", rows.size() == 1);
+    uint32_t id = rows.empty()? 0 : (uint32_t)rows[0][0];
+
+    // One miss keeps the track, the box coming back keeps its id
+    tracker.update({});
+    NEX_CHECK("one miss", tracker.size() == 1);
+    NEX_CHECK("one miss", tracked_rows(tracker).empty());
+    tracker.update(box);
+    rows = tracked_rows(tracker);
+    NEX_CHECK("one miss", (rows.size() == 1) && ((uint32_t)rows[0][0] == id));
+
+    // Two in a row drop it, the box coming back is a new track
+    tracker.update({});
+    tracker.update({});
+    NEX_CHECK("two misses", tracker.size() == 0);
+    tracker.update(box);
+    rows = tracked_rows(tracker);
+    NEX_CHECK("two misses", (rows.size() == 1) && ((uint32_t)rows[0][0] != id));
+
+    // A box of another class is not a match
+    std::vector<float> other = box;
+    other[0] = 2;
+    tracker.update(other);
+    tracker.update(other);
+    rows = tracked_rows(tracker);
+    NEX_CHECK("other class", (rows.size() == 1) && (rows[0][1] == 2));
+    NEX_CHECK("other class", tracker.size() == 1);
+}
+
+int test_tracker() {
+    NexTests::reset();
+    check_constant_velocity();
+    check_misses();
+    return NexTests::failures();
+}
@@ -0,0 +1,33 @@
+// This file is distributed under GPLv3 licence
+// Author: Gorelov Grigory (gorelov@grigory.info)
+//
+// Contacts and other info are on the WEB page:  grigory.info/MPFDParser
+
+
+#include <stdlib.h>
+
+#include "Allocator.h"
+
+namespace {
+
+    class HeapAllocator : public MPFD::Allocator {
+    public:
+
+        void *Allocate(size_t size) {
+            return malloc(size);
+        }
+
+        void *Reallocate(void *data, size_t old_size, size_t size) {
+            return realloc(data, size);
+        }
+
+        void Free(void *data, size_t size) {
+            free(data);
+        }
+    };
+}
+
+MPFD::Allocator *MPFD::Allocator::Heap() {
+    static HeapAllocator heap;
+    return &heap;
+}
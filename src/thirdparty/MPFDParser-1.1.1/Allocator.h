@@ -0,0 +1,31 @@
+// This file is distributed under GPLv3 licence
+// Author: Gorelov Grigory (gorelov@grigory.info)
+//
+// Contacts and other info are on the WEB page:  grigory.info/MPFDParser
+
+
+#ifndef _MPFD_ALLOCATOR_H
+#define	_MPFD_ALLOCATOR_H
+
+#include <stddef.h>
+
+
+namespace MPFD {
+
+    // Memory of the data collector and of field contents. Sizes are passed back so that
+    // an allocator may hand out memory without keeping track of it, as an arena does.
+    class Allocator {
+    public:
+        virtual ~Allocator() {}
+
+        virtual void *Allocate(size_t size) = 0;
+        // Keeps the first old_size bytes, data may be NULL
+        virtual void *Reallocate(void *data, size_t old_size, size_t size) = 0;
+        virtual void Free(void *data, size_t size) = 0;
+
+        // malloc() and friends, the default
+        static Allocator *Heap();
+    };
+}
+
+#endif	/* _MPFD_ALLOCATOR_H */
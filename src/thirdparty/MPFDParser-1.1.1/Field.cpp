@@ -9,15 +9,17 @@
 MPFD::Field::Field() {
     type = 0;
     FieldContent = NULL;
+    Memory = Allocator::Heap();
 
     FieldContentLength = 0;
+    FieldContentCapacity = 0;
 
 }
 
 MPFD::Field::~Field() {
 
     if (FieldContent) {
-        delete FieldContent;
+        Memory->Free(FieldContent, FieldContentCapacity);
     }
 
     if (type == FileType) {
@@ -49,11 +51,7 @@ int MPFD::Field::GetType() {
 
 void MPFD::Field::AcceptSomeData(char *data, long length) {
     if (type == TextType) {
-        if (FieldContent == NULL) {
-            FieldContent = new char[length + 1];
-        } else {
-            FieldContent = (char*) realloc(FieldContent, FieldContentLength + length + 1);
-        }
+        Reserve(FieldContentLength + length + 1);
 
         memcpy(FieldContent + FieldContentLength, data, length);
         FieldContentLength += length;
@@ -94,11 +92,7 @@ void MPFD::Field::AcceptSomeData(char *data, long length) {
                 throw MPFD::Exception("Trying to AcceptSomeData for a file but no TempDir is set.");
             }
         } else { // If files are stored in memory
-            if (FieldContent == NULL) {
-                FieldContent = new char[length];
-            } else {
-                FieldContent = (char*) realloc(FieldContent, FieldContentLength + length);
-            }
+            Reserve(FieldContentLength + length);
             memcpy(FieldContent + FieldContentLength, data, length);
             FieldContentLength += length;
         }
@@ -107,6 +101,26 @@ void MPFD::Field::AcceptSomeData(char *data, long length) {
     }
 }
 
+void MPFD::Field::SetAllocator(Allocator *allocator) {
+    Memory = allocator;
+}
+
+// Content grows by doubling, so that a field sent in many small pieces is copied a few times
+void MPFD::Field::Reserve(unsigned long size) {
+    if (size <= FieldContentCapacity) {
+        return;
+    }
+    unsigned long capacity = FieldContentCapacity * 2;
+    if (capacity < size) {
+        capacity = size;
+    }
+    FieldContent = (char*) Memory->Reallocate(FieldContent, FieldContentLength, capacity);
+    if (FieldContent == NULL) {
+        throw MPFD::Exception("Cannot allocate field content.");
+    }
+    FieldContentCapacity = capacity;
+}
+
 void MPFD::Field::SetTempDir(std::string dir) {
     TempDir = dir;
 }
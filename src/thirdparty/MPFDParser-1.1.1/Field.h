@@ -7,6 +7,7 @@
 #ifndef _FIELD_H
 #define	_FIELD_H
 
+#include "Allocator.h"
 #include "Exception.h"
 #include <iostream>
 #include <fstream>
@@ -27,6 +28,7 @@ namespace MPFD {
         int GetType();
 
         void AcceptSomeData(char *data, long length);
+        void SetAllocator(Allocator *allocator);
 
 
         // File functions
@@ -51,7 +53,8 @@ namespace MPFD {
 
 
     private:
-        unsigned long FieldContentLength;
+        unsigned long FieldContentLength, FieldContentCapacity;
+        Allocator *Memory;
 
         int WhereToStoreUploadedFiles;
 
@@ -60,6 +63,7 @@ namespace MPFD {
 
         int type;
         char * FieldContent;
+        void Reserve(unsigned long size);
         std::ofstream file;
 
     };
@@ -6,7 +6,7 @@
 
 #include "Parser.h"
 
-std::map<std::string, MPFD::Field *> MPFD::Parser::GetFieldsMap() {
+const std::map<std::string, MPFD::Field *> &MPFD::Parser::GetFieldsMap() {
     return Fields;
 }
 
@@ -19,8 +19,10 @@ MPFD::Field * MPFD::Parser::GetField(std::string Name) {
 }
 
 MPFD::Parser::Parser() {
+    Memory = Allocator::Heap();
     DataCollector = NULL;
     DataCollectorLength = 0;
+    DataCollectorCapacity = 0;
     _HeadersOfTheFieldAreProcessed = false;
     CurrentStatus = Status_LookingForStartingBoundary;
 
@@ -36,7 +38,7 @@ MPFD::Parser::~Parser() {
     }
 
     if (DataCollector) {
-        delete DataCollector;
+        Memory->Free(DataCollector, DataCollectorCapacity);
     }
 }
 
@@ -57,16 +59,21 @@ void MPFD::Parser::SetContentType(const std::string type) {
 
 void MPFD::Parser::AcceptSomeData(const char *data, const long length) {
     if (Boundary.length() > 0) {
-        // Append data to existing accumulator
-        if (DataCollector == NULL) {
-            DataCollector = new char[length];
-            memcpy(DataCollector, data, length);
-            DataCollectorLength = length;
-        } else {
-            DataCollector = (char*) realloc(DataCollector, DataCollectorLength + length);
-            memcpy(DataCollector + DataCollectorLength, data, length);
-            DataCollectorLength += length;
+        // Append data to existing accumulator, which grows by doubling and is reused as
+        // it is emptied
+        if (DataCollectorLength + length > DataCollectorCapacity) {
+            long capacity = DataCollectorCapacity * 2;
+            if (capacity < DataCollectorLength + length) {
+                capacity = DataCollectorLength + length;
+            }
+            DataCollector = (char*) Memory->Reallocate(DataCollector, DataCollectorLength, capacity);
+            if (DataCollector == NULL) {
+                throw Exception("Cannot allocate the data collector.");
+            }
+            DataCollectorCapacity = capacity;
         }
+        memcpy(DataCollector + DataCollectorLength, data, length);
+        DataCollectorLength += length;
 
         if (DataCollectorLength > MaxDataCollectorLength) {
             throw Exception("Maximum data collector length reached.");
@@ -138,17 +145,10 @@ bool MPFD::Parser::ProcessContentOfTheField() {
 bool MPFD::Parser::WaitForHeadersEndAndParseThem() {
     for (int i = 0; i < DataCollectorLength - 3; i++) {
         if ((DataCollector[i] == 13) && (DataCollector[i + 1] == 10) && (DataCollector[i + 2] == 13) && (DataCollector[i + 3] == 10)) {
-            long headers_length = i;
-            char *headers = new char[headers_length + 1];
-            memset(headers, 0, headers_length + 1);
-            memcpy(headers, DataCollector, headers_length);
-
-            _ParseHeaders(std::string(headers));
+            _ParseHeaders(std::string(DataCollector, i));
 
             TruncateDataCollectorFromTheBeginning(i + 4);
 
-            delete headers;
-
             return true;
         }
     }
@@ -159,11 +159,15 @@ void MPFD::Parser::SetUploadedFilesStorage(int where) {
     WhereToStoreUploadedFiles = where;
 }
 
+void MPFD::Parser::SetAllocator(Allocator *allocator) {
+    Memory = allocator;
+}
+
 void MPFD::Parser::SetTempDirForFileUpload(std::string dir) {
     TempDirForFileUpload = dir;
 }
 
-void MPFD::Parser::_ParseHeaders(std::string headers) {
+void MPFD::Parser::_ParseHeaders(const std::string &headers) {
     // Check if it is form data
     if (headers.find("Content-Disposition: form-data;") == std::string::npos) {
         throw Exception(std::string("Accepted headers of field does not contain \"Content-Disposition: form-data;\"\nThe headers are: \"") + headers + std::string("\""));
@@ -180,6 +184,7 @@ void MPFD::Parser::_ParseHeaders(std::string headers) {
         } else {
             ProcessingFieldName = headers.substr(name_pos + 6, name_end_pos - (name_pos + 6));
             Fields[ProcessingFieldName] = new Field();
+            Fields[ProcessingFieldName]->SetAllocator(Memory);
         }
 
 
@@ -228,15 +233,10 @@ void MPFD::Parser::SetMaxCollectedDataLength(long max) {
 void MPFD::Parser::TruncateDataCollectorFromTheBeginning(long n) {
     long TruncatedDataCollectorLength = DataCollectorLength - n;
 
-    char *tmp = DataCollector;
-
-    DataCollector = new char[TruncatedDataCollectorLength];
-    memcpy(DataCollector, tmp + n, TruncatedDataCollectorLength);
+    memmove(DataCollector, DataCollector + n, TruncatedDataCollectorLength);
 
     DataCollectorLength = TruncatedDataCollectorLength;
 
-    delete tmp;
-
 }
 
 long MPFD::Parser::BoundaryPositionInDataCollector() {
@@ -11,6 +11,7 @@
 #include <iostream>
 #include <string>
 #include <map>
+#include "Allocator.h"
 #include "Exception.h"
 #include "Field.h"
 #include <string.h>
@@ -35,8 +36,10 @@ namespace MPFD {
         void SetMaxCollectedDataLength(long max);
         void SetTempDirForFileUpload(std::string dir);
         void SetUploadedFilesStorage(int where);
+        // Before any data is accepted. The allocator must outlive the parser.
+        void SetAllocator(Allocator *allocator);
 
-        std::map<std::string, Field *> GetFieldsMap();
+        const std::map<std::string, Field *> &GetFieldsMap();
         Field * GetField(std::string Name);
 
     private:
@@ -56,11 +59,12 @@ namespace MPFD {
         std::string ProcessingFieldName;
         bool _HeadersOfTheFieldAreProcessed;
         long ContentLength;
+        Allocator *Memory;
         char *DataCollector;
-        long DataCollectorLength, MaxDataCollectorLength;
+        long DataCollectorLength, DataCollectorCapacity, MaxDataCollectorLength;
         bool FindStartingBoundaryAndTruncData();
         void _ProcessData();
-        void _ParseHeaders(std::string headers);
+        void _ParseHeaders(const std::string &headers);
         bool WaitForHeadersEndAndParseThem();
         void TruncateDataCollectorFromTheBeginning(long n);
         long BoundaryPositionInDataCollector();